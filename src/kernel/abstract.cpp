@@ -6,14 +6,35 @@ Author: Leonardo de Moura
 */
 #include <algorithm>
 #include <utility>
+#include <unordered_map>
+#include <vector>
 #include "kernel/abstract.h"
 #include "kernel/free_vars.h"
 #include "kernel/replace_fn.h"
 
 namespace lean {
-expr abstract(expr const & e, unsigned n, expr const * s) {
+/**
+   \brief Return the union of the name fingerprints of s[0], ..., s[n-1], or 0 if one of them is empty.
+   If the result \c m is not 0 and <tt>(get_name_fingerprint(e) & m) == 0</tt>, then \c e does not contain s[0], ..., s[n-1].
+*/
+static unsigned get_name_fingerprint(unsigned n, expr const * s) {
+    unsigned r = 0;
+    for (unsigned i = 0; i < n; i++) {
+        unsigned f = get_name_fingerprint(s[i]);
+        if (f == 0)
+            return 0;
+        r |= f;
+    }
+    return r;
+}
+
+template<typename E>
+static expr abstract_core(E && e, unsigned n, expr const * s) {
     lean_assert(std::all_of(s, s+n, closed));
-    return replace(e, [=](expr const & e, unsigned offset) -> optional<expr> {
+    unsigned fingerprint = get_name_fingerprint(n, s);
+    return replace(std::forward<E>(e), [=](expr const & e, unsigned offset) -> optional<expr> {
+            if (fingerprint != 0 && (get_name_fingerprint(e) & fingerprint) == 0)
+                return some_expr(e); // skip: e does not contain s[0], ..., s[n-1]
             unsigned i = n;
             while (i > 0) {
                 --i;
@@ -23,9 +44,15 @@ expr abstract(expr const & e, unsigned n, expr const * s) {
             return none_expr();
         });
 }
+expr abstract(expr const & e, unsigned n, expr const * s) { return abstract_core(e, n, s); }
+expr abstract(expr && e, unsigned n, expr const * s) { return abstract_core(std::move(e), n, s); }
+
 expr abstract_p(expr const & e, unsigned n, expr const * s) {
     lean_assert(std::all_of(s, s+n, closed));
+    unsigned fingerprint = get_name_fingerprint(n, s);
     return replace(e, [=](expr const & e, unsigned offset) -> optional<expr> {
+            if (fingerprint != 0 && (get_name_fingerprint(e) & fingerprint) == 0)
+                return some_expr(e); // skip: e does not contain s[0], ..., s[n-1]
             unsigned i = n;
             while (i > 0) {
                 --i;
@@ -35,18 +62,78 @@ expr abstract_p(expr const & e, unsigned n, expr const * s) {
             return none_expr();
         });
 }
-#define MkBinder(FName)                                                 \
+/**
+   \brief Auxiliary object for abstracting many local constants (in many expressions).
+   The local constants are indexed by name.
+*/
+class abstract_locals_fn {
+    unsigned                                           m_n;
+    std::unordered_map<name, unsigned, name_hash>      m_idx;
+    std::vector<unsigned>                              m_fingerprints; // m_fingerprints[k] is the fingerprint of s[0], ..., s[k-1]
+public:
+    abstract_locals_fn(unsigned n, expr const * s):m_n(n) {
+        m_idx.reserve(n);
+        m_fingerprints.push_back(0);
+        for (unsigned i = 0; i < n; i++) {
+            lean_assert(is_local(s[i]) && closed(s[i]));
+            m_idx.insert(mk_pair(mlocal_name(s[i]), i));
+            m_fingerprints.push_back(m_fingerprints.back() | mk_name_fingerprint(mlocal_name(s[i])));
+        }
+    }
+
+    /** \brief Abstract the local constants s[0], ..., s[k-1] in \c e. */
+    expr operator()(expr const & e, unsigned k) const {
+        lean_assert(k <= m_n);
+        if (k == 0 || !has_local(e))
+            return e;
+        unsigned fingerprint = m_fingerprints[k];
+        return replace(e, [&](expr const & e, unsigned offset) -> optional<expr> {
+                if (!has_local(e) || (get_name_fingerprint(e) & fingerprint) == 0)
+                    return some_expr(e); // skip: e does not contain local constants s[0], ..., s[k-1]
+                if (is_local(e)) {
+                    auto it = m_idx.find(mlocal_name(e));
+                    if (it != m_idx.end() && it->second < k)
+                        return some_expr(mk_var(offset + k - it->second - 1));
+                }
+                return none_expr();
+            });
+    }
+};
+
+expr abstract_locals(expr const & e, unsigned n, expr const * s) {
+    if (n == 0 || !has_local(e))
+        return e;
+    return abstract_locals_fn(n, s)(e, n);
+}
+
+template<bool is_lambda>
+static expr mk_telescope(unsigned n, expr const * s, expr const & b) {
+    abstract_locals_fn fn(n, s);
+    expr r = fn(b, n);
+    unsigned i = n;
+    while (i > 0) {
+        --i;
+        expr d = fn(mlocal_type(s[i]), i);
+        r = is_lambda ? mk_lambda(mlocal_name(s[i]), d, r) : mk_pi(mlocal_name(s[i]), d, r);
+    }
+    return r;
+}
+
+expr Pi(unsigned n, expr const * s, expr const & b) { return mk_telescope<false>(n, s, b); }
+expr Fun(unsigned n, expr const * s, expr const & b) { return mk_telescope<true>(n, s, b); }
+
+#define MkBinder(FName, MkFn)                                           \
 expr FName(std::initializer_list<std::pair<expr const &, expr const &>> const & l, expr const & b) { \
     expr r = b;                                                         \
     auto it = l.end();                                                  \
     while (it != l.begin()) {                                           \
         --it;                                                           \
         auto const & p = *it;                                           \
-        r = FName(p.first, p.second, r);                                \
+        r = MkFn(const_name(p.first), p.second, abstract(std::move(r), p.first)); \
     }                                                                   \
     return r;                                                           \
 }
 
-MkBinder(Fun);
-MkBinder(Pi);
+MkBinder(Fun, mk_lambda);
+MkBinder(Pi, mk_pi);
 }
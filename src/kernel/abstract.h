@@ -6,6 +6,7 @@ Author: Leonardo de Moura
 */
 #pragma once
 #include <utility>
+#include "util/buffer.h"
 #include "kernel/expr.h"
 
 namespace lean {
@@ -19,6 +20,9 @@ namespace lean {
 expr abstract(expr const & e, unsigned n, expr const * s);
 inline expr abstract(expr const & e, expr const & s) { return abstract(e, 1, &s); }
 inline expr abstract(expr const & e, std::initializer_list<expr> const & l) { return abstract(e, l.size(), l.begin()); }
+/** \brief Similar to the previous procedures, but the cells of \c e that are not shared are reused. */
+expr abstract(expr && e, unsigned n, expr const * s);
+inline expr abstract(expr && e, expr const & s) { return abstract(std::move(e), 1, &s); }
 
 /**
    \brief Replace the expressions s[0], ..., s[n-1] in e with var(n-1), ..., var(0).
@@ -30,6 +34,29 @@ inline expr abstract(expr const & e, std::initializer_list<expr> const & l) { re
 expr abstract_p(expr const & e, unsigned n, expr const * s);
 inline expr abstract_p(expr const & e, expr const & s) { return abstract_p(e, 1, &s); }
 
+/**
+   \brief Replace the local constants s[0], ..., s[n-1] in e with var(n-1), ..., var(0).
+
+   Local constants are identified by their names, and they are indexed using a hash table.
+   Subexpressions that do not contain local constants are not visited.
+
+   \pre s[0], ..., s[n-1] must be closed local constants with distinct names.
+*/
+expr abstract_locals(expr const & e, unsigned n, expr const * s);
+inline expr abstract_locals(expr const & e, buffer<expr> const & s) { return abstract_locals(e, s.size(), s.data()); }
+
+/**
+   \brief Create the telescope (pi (x_1 : A_1) ... (x_n : A_n), b) where x_1 ... x_n are
+   the local constants s[0], ..., s[n-1], and A_i is the type of x_i.
+   The local constants are abstracted in \c b and in the types A_i in a single pass
+   (see abstract_locals). The names of the local constants are used as binder names.
+*/
+expr Pi(unsigned n, expr const * s, expr const & b);
+inline expr Pi(buffer<expr> const & s, expr const & b) { return Pi(s.size(), s.data(), b); }
+/** \brief Similar to Pi, but creates the telescope (fun (x_1 : A_1) ... (x_n : A_n), b) */
+expr Fun(unsigned n, expr const * s, expr const & b);
+inline expr Fun(buffer<expr> const & s, expr const & b) { return Fun(s.size(), s.data(), b); }
+
 /**
    \brief Create a lambda expression (lambda (x : t) b), the term b is abstracted using abstract(b, constant(x)).
 */
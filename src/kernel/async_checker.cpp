@@ -0,0 +1,186 @@
+/*
+Copyright (c) 2014 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+
+Author: Leonardo de Moura
+*/
+#include <utility>
+#include <vector>
+#include <algorithm>
+#include "util/interrupt.h"
+#include "kernel/async_checker.h"
+#include "kernel/type_checker.h"
+#include "kernel/check_cache.h"
+
+namespace lean {
+void pending_certificate::set(status s, exception const * ex) {
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_status = s;
+        if (ex)
+            m_error.reset(ex->clone());
+    }
+    m_cv.notify_all();
+}
+
+pending_certificate::status pending_certificate::get_status() const {
+    lock_guard<mutex> lock(m_mutex);
+    return m_status;
+}
+
+void pending_certificate::wait() const {
+    unique_lock<mutex> lock(m_mutex);
+#if defined(LEAN_MULTI_THREAD)
+    while (m_status == status::Pending) {
+        check_interrupted();
+        m_cv.wait_for(lock, chrono::milliseconds(g_small_sleep));
+    }
+#endif
+    switch (m_status) {
+    case status::Pending: case status::Certified:
+        return;
+    case status::Failed:
+        m_error->rethrow();
+        return;
+    case status::Cancelled:
+        throw interrupted();
+    }
+}
+
+bool certified_definition::is_pending() const {
+    return m_pending && m_pending->get_status() == pending_certificate::status::Pending;
+}
+
+void certified_definition::wait() const {
+    if (m_pending)
+        m_pending->wait();
+}
+
+async_checker::async_checker(unsigned num_threads):
+    m_num_threads(num_threads), m_num_running(0), m_shutdown(false) {
+#if defined(LEAN_MULTI_THREAD)
+    if (m_num_threads == 0)
+        m_num_threads = std::max(thread::hardware_concurrency(), 1u);
+#endif
+}
+
+async_checker::~async_checker() {
+    cancel();
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_shutdown = true;
+    }
+    m_todo_cv.notify_all();
+    for (auto & th : m_threads)
+        th->join();
+}
+
+void async_checker::check_proof(task const & t) {
+    try {
+        check_definition_value(t.m_env, t.m_definition, t.m_ngen, t.m_extra_opaque, t.m_memoize);
+        if (std::shared_ptr<check_cache> cache = get_check_cache()) {
+            if (auto key = mk_check_cache_key(t.m_env, t.m_definition))
+                cache->insert(*key);
+        }
+        t.m_certificate->set_certified();
+    } catch (interrupted &) {
+        t.m_certificate->set_cancelled();
+    } catch (exception & ex) {
+        t.m_certificate->set_failed(ex);
+    } catch (...) {
+        t.m_certificate->set_failed(exception("unexpected error when checking proof"));
+    }
+}
+
+void async_checker::worker() {
+    while (true) {
+        std::unique_ptr<task> t;
+        {
+            unique_lock<mutex> lock(m_mutex);
+            while (m_todo.empty() && !m_shutdown)
+                m_todo_cv.wait(lock);
+            if (m_todo.empty())
+                return;
+            t.reset(new task(std::move(m_todo.front())));
+            m_todo.pop_front();
+            m_num_running++;
+            // Remark: \c cancel only interrupts threads while holding m_mutex.
+            // So, interrupt requests sent while this thread was idle are stale.
+            reset_interrupt();
+        }
+        check_proof(*t);
+        {
+            lock_guard<mutex> lock(m_mutex);
+            m_num_running--;
+        }
+        m_done_cv.notify_all();
+    }
+}
+
+void async_checker::start_workers() {
+    while (m_threads.size() < m_num_threads)
+        m_threads.emplace_back(new interruptible_thread([this]() { worker(); }));
+}
+
+certified_definition async_checker::check(environment const & env, definition const & d, name_generator const & g,
+                                          name_set const & extra_opaque, bool memoize) {
+    if (!d.is_theorem() || !env.proof_irrel())
+        return lean::check(env, d, g, extra_opaque, memoize);
+    if (std::shared_ptr<check_cache> cache = get_check_cache()) {
+        auto key = mk_check_cache_key(env, d);
+        if (key && cache->contains(*key))
+            return lean::check(env, d, g, extra_opaque, memoize);
+    }
+    check_definition_type(env, d, g, extra_opaque, memoize);
+    auto c = std::make_shared<pending_certificate>();
+#if defined(LEAN_MULTI_THREAD)
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_certificates.push_back(c);
+        m_todo.emplace_back(env, d, g, extra_opaque, memoize, c);
+        start_workers();
+    }
+    m_todo_cv.notify_one();
+#else
+    m_certificates.push_back(c);
+    check_proof(task(env, d, g, extra_opaque, memoize, c));
+#endif
+    return certified_definition(env.get_id(), d, c);
+}
+
+unsigned async_checker::num_pending() {
+    lock_guard<mutex> lock(m_mutex);
+    return m_todo.size() + m_num_running;
+}
+
+void async_checker::wait_all() {
+    std::vector<std::shared_ptr<pending_certificate>> certs;
+    {
+        unique_lock<mutex> lock(m_mutex);
+#if defined(LEAN_MULTI_THREAD)
+        while (!m_todo.empty() || m_num_running > 0) {
+            if (interrupt_requested()) {
+                lock.unlock();
+                cancel();
+                check_interrupted();
+            }
+            m_done_cv.wait_for(lock, chrono::milliseconds(g_small_sleep));
+        }
+#endif
+        std::swap(certs, m_certificates);
+    }
+    for (auto const & c : certs)
+        c->wait();
+}
+
+void async_checker::cancel() {
+    lock_guard<mutex> lock(m_mutex);
+    for (task const & t : m_todo)
+        t.m_certificate->set_cancelled();
+    m_todo.clear();
+    if (m_num_running > 0) {
+        for (auto & th : m_threads)
+            th->request_interrupt();
+    }
+}
+}
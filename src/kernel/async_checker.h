@@ -0,0 +1,106 @@
+/*
+Copyright (c) 2014 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+
+Author: Leonardo de Moura
+*/
+#pragma once
+#include <memory>
+#include <vector>
+#include <deque>
+#include "util/thread.h"
+#include "util/interrupt.h"
+#include "util/exception.h"
+#include "util/name_generator.h"
+#include "util/name_set.h"
+#include "kernel/environment.h"
+
+namespace lean {
+/**
+   \brief State of a theorem whose proof is being checked in the background.
+   It is shared by the \c certified_definition returned by \c async_checker::check and the worker checking the proof.
+*/
+class pending_certificate {
+public:
+    enum class status { Pending, Certified, Failed, Cancelled };
+private:
+    mutable mutex              m_mutex;
+    mutable condition_variable m_cv;
+    status                     m_status;
+    std::unique_ptr<exception> m_error;
+    void set(status s, exception const * ex);
+public:
+    pending_certificate():m_status(status::Pending) {}
+    status get_status() const;
+    void set_certified() { set(status::Certified, nullptr); }
+    void set_failed(exception const & ex) { set(status::Failed, &ex); }
+    void set_cancelled() { set(status::Cancelled, nullptr); }
+    /**
+       \brief Block until the proof is checked. Throw the exception produced by the proof checker if it failed,
+       and \c interrupted if the check was cancelled or the current thread was interrupted.
+    */
+    void wait() const;
+};
+
+/**
+   \brief Type checker for theorems that defers the checking of proofs.
+
+   When the environment is proof irrelevant, the definitions that follow a theorem only depend on its type.
+   So, \c check type checks the type of a theorem eagerly, and schedules the proof to be checked by a pool of
+   background threads. The resulting certified definition can be added to the environment right away.
+   Definitions, axioms and variable declarations are checked synchronously.
+
+   \remark The environments containing theorems with pending certificates should only be trusted after
+   \c wait_all returns successfully.
+*/
+class async_checker {
+    struct task {
+        environment                          m_env;
+        definition                           m_definition;
+        name_generator                       m_ngen;
+        name_set                             m_extra_opaque;
+        bool                                 m_memoize;
+        std::shared_ptr<pending_certificate> m_certificate;
+        task(environment const & env, definition const & d, name_generator const & g, name_set const & extra_opaque,
+             bool memoize, std::shared_ptr<pending_certificate> const & c):
+            m_env(env), m_definition(d), m_ngen(g), m_extra_opaque(extra_opaque), m_memoize(memoize), m_certificate(c) {}
+    };
+    unsigned                                           m_num_threads;
+    mutex                                              m_mutex;
+    condition_variable                                 m_todo_cv;
+    condition_variable                                 m_done_cv;
+    std::deque<task>                                   m_todo;
+    unsigned                                           m_num_running;
+    bool                                               m_shutdown;
+    std::vector<std::shared_ptr<pending_certificate>>  m_certificates;
+    std::vector<std::unique_ptr<interruptible_thread>> m_threads;
+    static void check_proof(task const & t);
+    void worker();
+    void start_workers();
+public:
+    /** \brief Create a checker with \c num_threads background threads (0 means one per hardware thread). */
+    async_checker(unsigned num_threads = 0);
+    ~async_checker();
+
+    /**
+       \brief Type check the given definition. If it is a theorem and the environment is proof irrelevant,
+       then only its type is checked before returning, and the returned certified definition is pending.
+       Otherwise, this method behaves like \c lean::check.
+    */
+    certified_definition check(environment const & env, definition const & d, name_generator const & g,
+                               name_set const & extra_opaque = name_set(), bool memoize = true);
+
+    /** \brief Return the number of proofs scheduled but not checked yet. */
+    unsigned num_pending();
+
+    /**
+       \brief Wait for all scheduled proofs to be checked. If some of them failed, then the exception
+       produced for the first one (in the order they were scheduled) is thrown.
+       If the current thread is interrupted, then the remaining proofs are cancelled and \c interrupted is thrown.
+    */
+    void wait_all();
+
+    /** \brief Interrupt the proofs being checked, and drop the ones that were not started yet. */
+    void cancel();
+};
+}
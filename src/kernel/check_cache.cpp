@@ -0,0 +1,133 @@
+/*
+Copyright (c) 2014 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+
+Author: Leonardo de Moura
+*/
+#include <fstream>
+#include <string>
+#include "util/serializer.h"
+#include "util/exception.h"
+#include "util/sstream.h"
+#include "kernel/check_cache.h"
+#include "kernel/for_each_fn.h"
+
+namespace lean {
+static char const * g_check_cache_header = "LeanCheckCache1";
+
+bool check_cache::contains(fingerprint const & k) const {
+    lock_guard<mutex> lock(m_mutex);
+    return m_certified.find(k) != m_certified.end();
+}
+
+void check_cache::insert(fingerprint const & k) {
+    lock_guard<mutex> lock(m_mutex);
+    m_certified.insert(k);
+}
+
+unsigned check_cache::size() const {
+    lock_guard<mutex> lock(m_mutex);
+    return m_certified.size();
+}
+
+static void write_uint64(serializer & s, uint64 v) {
+    s << static_cast<unsigned>(v) << static_cast<unsigned>(v >> 32);
+}
+
+static uint64 read_uint64(deserializer & d) {
+    uint64 low  = d.read_unsigned();
+    uint64 high = d.read_unsigned();
+    return low | (high << 32);
+}
+
+void check_cache::load(std::string const & fname) {
+    std::ifstream in(fname, std::ios_base::binary);
+    if (!in.good())
+        return;
+    deserializer d(in);
+    if (d.read_string() != g_check_cache_header)
+        throw exception(sstream() << "file '" << fname << "' is not a Lean check cache");
+    unsigned n = d.read_unsigned();
+    lock_guard<mutex> lock(m_mutex);
+    for (unsigned i = 0; i < n; i++) {
+        uint64 low  = read_uint64(d);
+        uint64 high = read_uint64(d);
+        if (!in.good())
+            throw_corrupted_file();
+        m_certified.insert(fingerprint(low, high));
+    }
+}
+
+void check_cache::save(std::string const & fname) const {
+    std::ofstream out(fname, std::ios_base::binary);
+    if (!out.good())
+        throw exception(sstream() << "failed to write check cache file '" << fname << "'");
+    serializer s(out);
+    lock_guard<mutex> lock(m_mutex);
+    s << g_check_cache_header << static_cast<unsigned>(m_certified.size());
+    for (fingerprint const & f : m_certified) {
+        write_uint64(s, f.m_low);
+        write_uint64(s, f.m_high);
+    }
+}
+
+/** \brief Store in \c r the global universe levels occurring in the type and value of \c d. */
+static void collect_global_levels(definition const & d, name_set & r) {
+    auto collect_level = [&](level const & l) {
+        if (!has_global(l))
+            return false;
+        if (is_global(l))
+            r.insert(global_id(l));
+        return true;
+    };
+    auto fn = [&](expr const & e, unsigned) {
+        if (is_sort(e)) {
+            for_each(sort_level(e), collect_level);
+        } else if (is_constant(e)) {
+            for (level const & l : const_level_params(e))
+                for_each(l, collect_level);
+        }
+        return true;
+    };
+    for_each(d.get_type(), fn);
+    if (d.is_definition())
+        for_each(d.get_value(), fn);
+}
+
+optional<fingerprint> mk_check_cache_key(environment const & env, definition const & d) {
+    if (env.trust_lvl() == 0)
+        return optional<fingerprint>();
+    optional<name> ext_id = env.norm_ext().get_identity();
+    if (!ext_id)
+        return optional<fingerprint>();
+    name_set deps;
+    fingerprint r = get_fingerprint(d, &deps);
+    r.mix(env.trust_lvl());
+    r.mix(env.proof_irrel());
+    r.mix(env.eta());
+    r.mix(env.impredicative());
+    r.mix(get_fingerprint(*ext_id));
+    // the global universe levels used by d must be declared in env
+    name_set globals;
+    collect_global_levels(d, globals);
+    bool ok = true;
+    globals.for_each([&](name const & n) {
+            if (env.is_global_level(n))
+                r.mix(get_fingerprint(n));
+            else
+                ok = false;
+        });
+    deps.for_each([&](name const & n) {
+            if (auto f = env.get_deep_fingerprint(n))
+                r.mix(*f);
+            else
+                ok = false;
+        });
+    return ok ? optional<fingerprint>(r) : optional<fingerprint>();
+}
+
+static std::shared_ptr<check_cache> g_check_cache;
+
+void set_check_cache(std::shared_ptr<check_cache> const & c) { g_check_cache = c; }
+std::shared_ptr<check_cache> get_check_cache() { return g_check_cache; }
+}
@@ -0,0 +1,46 @@
+/*
+Copyright (c) 2014 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+
+Author: Leonardo de Moura
+*/
+#pragma once
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include "util/thread.h"
+#include "kernel/fingerprint.h"
+#include "kernel/environment.h"
+
+namespace lean {
+/**
+   \brief Persistent cache of definitions that were successfully type checked.
+   The keys are fingerprints of a definition and of the definitions it depends on (directly and indirectly).
+   When the cache is enabled (see \c set_check_cache), the procedure \c check certifies a definition
+   without type checking it if its key is in the cache. This is only done in trusted mode
+   (i.e., when the trust level of the environment is greater than 0).
+*/
+class check_cache {
+    mutable mutex                                     m_mutex;
+    std::unordered_set<fingerprint, fingerprint_hash> m_certified;
+public:
+    bool contains(fingerprint const & k) const;
+    void insert(fingerprint const & k);
+    unsigned size() const;
+    /** \brief Load the cache stored in the given file. Nothing is done if the file does not exist. */
+    void load(std::string const & fname);
+    /** \brief Store the cache in the given file. */
+    void save(std::string const & fname) const;
+};
+
+/**
+   \brief Return the key used to store \c d in the check cache. Return none if \c env is not in trusted mode,
+   its normalizer extension does not provide an identity, one of the global universe levels used by \c d is
+   not declared in \c env, or one of the definitions \c d depends on does not have a deep fingerprint.
+*/
+optional<fingerprint> mk_check_cache_key(environment const & env, definition const & d);
+
+/** \brief Set the check cache used by \c check (nullptr means disabled). */
+void set_check_cache(std::shared_ptr<check_cache> const & c);
+std::shared_ptr<check_cache> get_check_cache();
+}
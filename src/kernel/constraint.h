@@ -93,6 +93,9 @@ constraint updt_level_cnstr(constraint const & c, level const & new_lhs, level c
 /** \brief Printer for debugging purposes */
 std::ostream & operator<<(std::ostream & out, constraint const & c);
 
+/** \brief Functional object for hashing constraints. */
+struct constraint_hash { unsigned operator()(constraint const & c) const { return c.hash(); } };
+
 typedef list<constraint> constraints;
 inline constraints add(constraints const & cs, constraint const & c) { return cons(c, cs); }
 }
@@ -4,12 +4,18 @@ Released under Apache 2.0 license as described in the file LICENSE.
 
 Author: Leonardo de Moura
 */
+#include <algorithm>
+#include <chrono>
 #include "util/interrupt.h"
 #include "util/lbool.h"
+#include "util/step_budget.h"
+#include "util/list.h"
+#include "util/rc.h"
 #include "kernel/converter.h"
 #include "kernel/expr_maps.h"
 #include "kernel/instantiate.h"
 #include "kernel/free_vars.h"
+#include "kernel/abstract.h"
 
 namespace lean {
 bool converter::is_def_eq(expr const & t, expr const & s, context & c) {
@@ -20,6 +26,7 @@ bool converter::is_def_eq(expr const & t, expr const & s, context & c) {
 /** \brief Do nothing converter */
 struct dummy_converter : public converter {
     virtual expr whnf(expr const & e, context &) { return e; }
+    virtual expr normalize(expr const & e, context &) { return e; }
     virtual bool is_def_eq(expr const &, expr const &, context &, delayed_justification &) { return true; }
 };
 
@@ -27,16 +34,108 @@ std::unique_ptr<converter> mk_dummy_converter() {
     return std::unique_ptr<converter>(new dummy_converter());
 }
 
+/**
+   \brief Closures for the abstract machine used to implement \c whnf_core.
+   A closure is a pair (e, env), where env is a list of closures for the free variables of \c e.
+   That is, the free variable \c i is bound to the i-th element of env.
+*/
+class closure {
+    struct cell;
+    cell * m_ptr;
+public:
+    closure(expr const & e, list<closure> const & env, unsigned env_size);
+    closure(closure const & c);
+    closure(closure && c);
+    ~closure();
+    closure & operator=(closure const & c);
+    closure & operator=(closure && c);
+    expr const & get_expr() const;
+    list<closure> const & get_env() const;
+    unsigned get_env_size() const;
+    /** \brief Return the term represented by this closure. The result is cached. */
+    expr read_back() const;
+    /** \brief Return true iff \c read_back was already computed. */
+    bool is_read_back() const;
+    /** \brief Normal form of this closure cached by \c default_converter::normalize. */
+    optional<expr> const & get_normal_form() const;
+    void set_normal_form(expr const & e) const;
+};
+
+typedef list<closure> closure_env;
+
+struct closure::cell {
+    MK_LEAN_RC();
+    expr           m_expr;
+    closure_env    m_env;
+    unsigned       m_env_size;
+    optional<expr> m_value;
+    optional<expr> m_normal_form;
+    cell(expr const & e, closure_env const & env, unsigned sz):m_rc(0), m_expr(e), m_env(env), m_env_size(sz) {}
+    void dealloc() { delete this; }
+};
+
+closure::closure(expr const & e, closure_env const & env, unsigned env_size):m_ptr(new cell(e, env, env_size)) { m_ptr->inc_ref(); }
+closure::closure(closure const & c):m_ptr(c.m_ptr) { if (m_ptr) m_ptr->inc_ref(); }
+closure::closure(closure && c):m_ptr(c.m_ptr) { c.m_ptr = nullptr; }
+closure::~closure() { if (m_ptr) m_ptr->dec_ref(); }
+closure & closure::operator=(closure const & s) { LEAN_COPY_REF(s); }
+closure & closure::operator=(closure && s) { LEAN_MOVE_REF(s); }
+expr const & closure::get_expr() const { return m_ptr->m_expr; }
+closure_env const & closure::get_env() const { return m_ptr->m_env; }
+unsigned closure::get_env_size() const { return m_ptr->m_env_size; }
+
+/** \brief Return the term represented by the closure (e, env) */
+static expr read_back(expr const & e, closure_env const & env, unsigned env_size) {
+    // We only need to read back the closures for the free variables occurring in e.
+    unsigned n = std::min(get_free_var_range(e), env_size);
+    if (n == 0)
+        return e;
+    buffer<expr> vals;
+    for (closure const & c : env) {
+        if (vals.size() == n)
+            break;
+        vals.push_back(c.read_back());
+    }
+    return instantiate(e, n, vals.data());
+}
+
+expr closure::read_back() const {
+    if (!m_ptr->m_value)
+        m_ptr->m_value = ::lean::read_back(m_ptr->m_expr, m_ptr->m_env, m_ptr->m_env_size);
+    return *m_ptr->m_value;
+}
+bool closure::is_read_back() const { return static_cast<bool>(m_ptr->m_value); }
+optional<expr> const & closure::get_normal_form() const { return m_ptr->m_normal_form; }
+void closure::set_normal_form(expr const & e) const { m_ptr->m_normal_form = e; }
+
 struct default_converter : public converter {
     environment           m_env;
     optional<module_idx>  m_module_idx;
     bool                  m_memoize;
+    bool                  m_norm_ext_noop;
     name_set              m_extra_opaque;
-    expr_struct_map<expr> m_whnf_core_cache;
-    expr_struct_map<expr> m_whnf_cache;
+    expr_struct_cache<expr> m_whnf_core_cache;
+    expr_struct_cache<expr> m_whnf_cache;
+    expr_struct_cache<expr> m_normalize_cache;
+    converter_stats       m_stats;
+    unsigned              m_is_def_eq_depth;
 
     default_converter(environment const & env, optional<module_idx> mod_idx, bool memoize, name_set const & extra_opaque):
-        m_env(env), m_module_idx(mod_idx), m_memoize(memoize), m_extra_opaque(extra_opaque) {}
+        m_env(env), m_module_idx(mod_idx), m_memoize(memoize), m_norm_ext_noop(env.norm_ext().is_noop()),
+        m_extra_opaque(extra_opaque), m_is_def_eq_depth(0) {}
+
+    virtual converter_stats get_stats() const {
+        converter_stats r = m_stats;
+        r.m_struct_fallbacks = m_whnf_core_cache.get_num_struct_fallbacks() + m_whnf_cache.get_num_struct_fallbacks() +
+            m_normalize_cache.get_num_struct_fallbacks();
+        return r;
+    }
+    virtual void reset_stats() {
+        m_stats = converter_stats();
+        m_whnf_core_cache.reset_stats();
+        m_whnf_cache.reset_stats();
+        m_normalize_cache.reset_stats();
+    }
 
     class extended_context : public extension_context {
         default_converter & m_conv;
@@ -53,11 +152,17 @@ struct default_converter : public converter {
     optional<expr> expand_macro(expr const & m, context & c) {
         lean_assert(is_macro(m));
         extended_context xctx(*this, c);
-        return macro_def(m).expand(macro_num_args(m), macro_args(m), xctx);
+        optional<expr> r = macro_def(m).expand(macro_num_args(m), macro_args(m), xctx);
+        if (r)
+            m_stats.m_macro_expand++;
+        return r;
     }
 
     /** \brief Apply normalizer extensions to \c e. */
     optional<expr> norm_ext(expr const & e, context & c) {
+        if (m_norm_ext_noop)
+            return none_expr();
+        m_stats.m_norm_ext++;
         extended_context xctx(*this, c);
         return m_env.norm_ext()(e, xctx);
     }
@@ -82,9 +187,204 @@ struct default_converter : public converter {
         }
     }
 
+    /**
+       \brief Environment machine used to implement \c whnf_core and \c normalize.
+       Instead of substituting the arguments in the body of lambda expressions, we keep them
+       in an environment of closures \c env and a stack of arguments \c stack (the last element
+       is the first argument). The closure <tt>(t, env)</tt> applied to \c stack is reduced
+       until it is stuck. If \c delta is true, then non-opaque definitions are unfolded.
+
+       Return true if at least one reduction step was performed.
+    */
+    bool eval(expr & t, closure_env & env, unsigned & env_size, buffer<closure> & stack, bool delta, context & c) {
+        bool reduced = false;
+        while (true) {
+            switch (t.kind()) {
+            case expr_kind::Var:
+                if (var_idx(t) < env_size) {
+                    closure_env const * it = &env;
+                    for (unsigned i = 0; i < var_idx(t); i++)
+                        it = &tail(*it);
+                    closure cl = head(*it);
+                    t        = cl.get_expr();
+                    env      = cl.get_env();
+                    env_size = cl.get_env_size();
+                    continue;
+                }
+                return reduced;
+            case expr_kind::App:
+                stack.push_back(closure(app_arg(t), env, env_size));
+                t = app_fn(t);
+                continue;
+            case expr_kind::Lambda:
+                if (!stack.empty()) {
+                    env = closure_env(stack.back(), env);
+                    env_size++;
+                    stack.pop_back();
+                    t = binder_body(t);
+                    reduced = true;
+                    consume_steps();
+                    check_system("whnf");
+                    continue;
+                }
+                return reduced;
+            case expr_kind::Let:
+                env = closure_env(closure(let_value(t), env, env_size), env);
+                env_size++;
+                t = let_body(t);
+                reduced = true;
+                continue;
+            case expr_kind::Macro:
+                if (auto m = expand_macro(read_back(t, env, env_size), c)) {
+                    t        = *m;
+                    env      = closure_env();
+                    env_size = 0;
+                    reduced  = true;
+                    continue;
+                }
+                return reduced;
+            case expr_kind::Constant:
+                if (delta) {
+                    if (auto d = is_delta_core(t)) {
+                        m_stats.m_delta++;
+                        consume_steps();
+                        t        = instantiate_params(d->get_value(), d->get_params(), const_level_params(t));
+                        env      = closure_env();
+                        env_size = 0;
+                        reduced  = true;
+                        continue;
+                    }
+                }
+                return reduced;
+            case expr_kind::Sort: case expr_kind::Meta: case expr_kind::Local: case expr_kind::Pi:
+                return reduced;
+            }
+        }
+    }
+
+    /**
+       \brief Auxiliary method for \c whnf_core. It reduces applications and let-expressions
+       using the environment machine (without delta-reduction).
+    */
+    expr whnf_core_machine(expr const & e, context & c) {
+        lean_assert(is_app(e) || is_let(e));
+        return whnf_core_machine(e, closure_env(), 0, c);
+    }
+
+    /** \brief Similar to the previous method, but reduces the closure <tt>(e, env)</tt>. */
+    expr whnf_core_machine(expr const & e, closure_env const & e_env, unsigned e_env_size, context & c) {
+        buffer<closure> stack;
+        expr t = e;
+        closure_env env   = e_env;
+        unsigned env_size = e_env_size;
+        if (!eval(t, env, env_size, stack, false, c))
+            return read_back(e, e_env, e_env_size);
+        expr r = read_back(t, env, env_size);
+        if (stack.empty()) {
+            return (is_lambda(r) && m_env.eta()) ? try_eta(r) : r;
+        } else {
+            buffer<expr> args;
+            for (closure const & a : stack)
+                args.push_back(a.read_back());
+            return mk_rev_app(r, args.size(), args.data());
+        }
+    }
+
+    /**
+       \brief Return the normal form of the closure <tt>(t, env)</tt>.
+       The body of binders is evaluated in an environment where the bound variable is
+       associated with a fresh local constant. Then, the local is abstracted.
+
+       \remark The free variables of the result that are not bound by \c env are lowered by \c env_size
+       (as in \c read_back), so they must be lifted when the result is put inside a binder.
+    */
+    expr normalize(expr t, closure_env env, unsigned env_size, context & c) {
+        check_system("normalize");
+        bool use_cache = m_memoize && closed(t);
+        if (use_cache) {
+            if (expr const * r = m_normalize_cache.find(t))
+                return *r;
+        }
+        expr const e = t;
+        buffer<closure> stack;
+        while (true) {
+            eval(t, env, env_size, stack, true, c);
+            if (m_norm_ext_noop)
+                break;
+            buffer<expr> args;
+            for (closure const & a : stack)
+                args.push_back(a.read_back());
+            if (auto new_t = norm_ext(mk_rev_app(read_back(t, env, env_size), args.size(), args.data()), c)) {
+                t        = *new_t;
+                env      = closure_env();
+                env_size = 0;
+                stack.clear();
+            } else {
+                break;
+            }
+        }
+        expr r;
+        switch (t.kind()) {
+        case expr_kind::Lambda: case expr_kind::Pi: {
+            expr d = normalize(binder_domain(t), env, env_size, c);
+            expr l = mk_local(c.mk_fresh_name() + binder_name(t), d);
+            expr b = normalize(binder_body(t), closure_env(closure(l, closure_env(), 0), env), env_size + 1, c);
+            r = mk_binder(t.kind(), binder_name(t), d, abstract_p(lift_free_vars(b, 1), l), binder_info(t));
+            if (is_lambda(r) && stack.empty() && m_env.eta())
+                r = try_eta(r);
+            break;
+        }
+        case expr_kind::Macro: {
+            buffer<expr> margs;
+            for (unsigned i = 0; i < macro_num_args(t); i++)
+                margs.push_back(normalize(macro_arg(t, i), env, env_size, c));
+            r = mk_macro(macro_def(t), margs.size(), margs.data());
+            break;
+        }
+        case expr_kind::Var: case expr_kind::Sort: case expr_kind::Meta: case expr_kind::Local:
+        case expr_kind::Constant:
+            r = read_back(t, env, env_size);
+            break;
+        case expr_kind::App: case expr_kind::Let:
+            lean_unreachable(); // LCOV_EXCL_LINE
+        }
+        if (!stack.empty()) {
+            buffer<expr> args;
+            for (closure const & a : stack)
+                args.push_back(normalize(a, c));
+            r = mk_rev_app(r, args.size(), args.data());
+        }
+        if (use_cache)
+            m_normalize_cache.insert(e, r);
+        return r;
+    }
+
+    /**
+       \brief Return the normal form of the closure \c a. The result is cached in \c a, since the same closure
+       may occur several times in the environments and stacks of the machine. If \c a was already read back
+       (e.g., when normalizer extensions were tried), then the cached term is normalized instead.
+    */
+    expr normalize(closure const & a, context & c) {
+        if (auto nf = a.get_normal_form())
+            return *nf;
+        expr r;
+        if (a.is_read_back())
+            r = normalize(a.read_back(), closure_env(), 0, c);
+        else
+            r = normalize(a.get_expr(), a.get_env(), a.get_env_size(), c);
+        a.set_normal_form(r);
+        return r;
+    }
+
+    /** \brief Return the normal form of \c e. */
+    virtual expr normalize(expr const & e, context & c) {
+        return normalize(e, closure_env(), 0, c);
+    }
+
     /** \brief Weak head normal form core procedure. It does not perform delta reduction nor normalization extensions. */
     expr whnf_core(expr const & e, context & c) {
         check_system("whnf");
+        consume_steps();
 
         // handle easy cases
         switch (e.kind()) {
@@ -95,11 +395,13 @@ struct default_converter : public converter {
             break;
         }
 
+        m_stats.m_whnf_core++;
         // check cache
         if (m_memoize) {
-            auto it = m_whnf_core_cache.find(e);
-            if (it != m_whnf_core_cache.end())
-                return it->second;
+            if (expr const * r = m_whnf_core_cache.find(e)) {
+                m_stats.m_whnf_core_hits++;
+                return *r;
+            }
         }
 
         // do the actual work
@@ -117,37 +419,34 @@ struct default_converter : public converter {
             else
                 r = e;
             break;
-        case expr_kind::Let:
-            r = whnf_core(instantiate(let_body(e), let_value(e)), c);
+        case expr_kind::Let: case expr_kind::App:
+            r = whnf_core_machine(e, c);
             break;
-        case expr_kind::App: {
-            buffer<expr> args;
-            expr const * it = &e;
-            while (is_app(*it)) {
-                args.push_back(app_arg(*it));
-                it = &(app_fn(*it));
-            }
-            expr f = whnf_core(*it, c);
-            if (is_lambda(f)) {
-                unsigned m = 1;
-                unsigned num_args = args.size();
-                while (is_lambda(binder_body(f)) && m < num_args) {
-                    f = binder_body(f);
-                    m++;
-                }
-                lean_assert(m <= num_args);
-                r = whnf_core(mk_rev_app(instantiate(binder_body(f), m, args.data() + (num_args - m)), num_args - m, args.data()), c);
-            } else {
-                r = is_eqp(f, *it) ? e : mk_rev_app(f, args.size(), args.data());
-            }
-            break;
-        }}
+        }
 
         if (m_memoize)
-            m_whnf_core_cache.insert(mk_pair(e, r));
+            m_whnf_core_cache.insert(e, r);
         return r;
     }
 
+    /**
+       \brief Weak head normal form of <tt>instantiate_rev(e, n, s)</tt>.
+       The substitution is delayed: applications and let-expressions are reduced by the environment machine
+       starting at the closure environment for \c s. So, the substitution is only pushed into the subterms
+       that are inspected by the reduction, instead of materializing the whole term first.
+    */
+    expr whnf_core(expr const & e, unsigned n, expr const * s, context & c) {
+        if ((!is_app(e) && !is_let(e)) || closed(e))
+            return whnf_core(instantiate_rev(e, n, s), c);
+        check_system("whnf");
+        consume_steps();
+        m_stats.m_whnf_core++;
+        closure_env env;
+        for (unsigned i = 0; i < n; i++)
+            env = closure_env(closure(s[i], closure_env(), 0), env);
+        return whnf_core_machine(e, env, n, c);
+    }
+
     /**
        \brief Predicate for deciding whether \c d is an opaque definition or not.
 
@@ -181,8 +480,11 @@ struct default_converter : public converter {
     expr unfold_name_core(expr e, unsigned w) {
         if (is_constant(e)) {
             if (auto d = m_env.find(const_name(e))) {
-                if (d->is_definition() && !is_opaque(*d) && d->get_weight() >= w)
+                if (d->is_definition() && !is_opaque(*d) && d->get_weight() >= w) {
+                    m_stats.m_delta++;
+                    consume_steps();
                     return unfold_name_core(instantiate_params(d->get_value(), d->get_params(), const_level_params(e)), w);
+                }
             }
         }
         return e;
@@ -263,11 +565,13 @@ struct default_converter : public converter {
     /** \brief Put expression \c t in weak head normal form */
     virtual expr whnf(expr const & e_prime, context & c) {
         expr e = e_prime;
+        m_stats.m_whnf++;
         // check cache
         if (m_memoize) {
-            auto it = m_whnf_cache.find(e);
-            if (it != m_whnf_cache.end())
-                return it->second;
+            if (expr const * r = m_whnf_cache.find(e)) {
+                m_stats.m_whnf_hits++;
+                return *r;
+            }
         }
 
         expr t = e;
@@ -278,7 +582,7 @@ struct default_converter : public converter {
                 t = *new_t;
             } else {
                 if (m_memoize)
-                    m_whnf_cache.insert(mk_pair(e, t1));
+                    m_whnf_cache.insert(e, t1);
                 return t1;
             }
         }
@@ -297,17 +601,23 @@ struct default_converter : public converter {
         lean_assert(t.kind() == s.kind());
         lean_assert(is_binder(t));
         expr_kind k = t.kind();
+        // The substitution of the bound variables with local constants is delayed,
+        // and it is only pushed into the subterms that we actually need.
         buffer<expr> subst;
         do {
-            expr var_t_type = instantiate(binder_domain(t), subst.size(), subst.data());
-            expr var_s_type = instantiate(binder_domain(s), subst.size(), subst.data());
-            if (!is_def_eq(var_t_type, var_s_type, c, jst))
-                return false;
+            expr var_s_type = instantiate_rev(binder_domain(s), subst.size(), subst.data());
+            if (binder_domain(t) != binder_domain(s)) {
+                expr var_t_type = instantiate_rev(binder_domain(t), subst.size(), subst.data());
+                if (!is_def_eq(var_t_type, var_s_type, c, jst))
+                    return false;
+            }
             subst.push_back(mk_local(c.mk_fresh_name() + binder_name(s), var_s_type));
             t = binder_body(t);
             s = binder_body(s);
         } while (t.kind() == k && s.kind() == k);
-        return is_def_eq(instantiate(t, subst.size(), subst.data()), instantiate(s, subst.size(), subst.data()), c, jst);
+        if (t == s)
+            return true; // the bodies are structurally equal, and they are instantiated with the same locals
+        return is_def_eq(whnf_core(t, subst.size(), subst.data(), c), whnf_core(s, subst.size(), subst.data(), c), c, jst);
     }
 
     /** \brief This is an auxiliary method for is_def_eq. It handles the "easy cases". */
@@ -362,8 +672,37 @@ struct default_converter : public converter {
         }
     }
 
+    /**
+        \brief Auxiliary object for measuring the time spent in (top-level) calls to \c is_def_eq.
+        We use wall-clock time because \c clock() measures the CPU time of the whole process,
+        and converters may be used concurrently by several threads.
+    */
+    class is_def_eq_timer {
+        typedef std::chrono::steady_clock clock;
+        default_converter & m_conv;
+        clock::time_point   m_start;
+    public:
+        is_def_eq_timer(default_converter & conv):m_conv(conv) {
+            if (m_conv.m_is_def_eq_depth == 0) {
+                m_conv.m_stats.m_is_def_eq++;
+                m_start = clock::now();
+            }
+            m_conv.m_is_def_eq_depth++;
+        }
+        ~is_def_eq_timer() {
+            m_conv.m_is_def_eq_depth--;
+            if (m_conv.m_is_def_eq_depth == 0)
+                m_conv.m_stats.m_is_def_eq_time += std::chrono::duration<double>(clock::now() - m_start).count();
+        }
+    };
+
     /** Return true iff t is definitionally equal to s. */
     virtual bool is_def_eq(expr const & t, expr const & s, context & c, delayed_justification & jst) {
+        is_def_eq_timer timer(*this);
+        return is_def_eq_core(t, s, c, jst);
+    }
+
+    bool is_def_eq_core(expr const & t, expr const & s, context & c, delayed_justification & jst) {
         check_system("is_definitionally_equal");
         lbool r = quick_is_def_eq(t, s, c, jst);
         if (r != l_undef) return r == l_true;
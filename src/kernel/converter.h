@@ -17,6 +17,22 @@ public:
     justification get() { if (!m_jst) { m_jst = m_mk(); } return *m_jst; }
 };
 
+/** \brief Performance counters collected by converters. */
+struct converter_stats {
+    unsigned m_whnf_core;       // number of calls to whnf_core
+    unsigned m_whnf_core_hits;  // number of whnf_core cache hits
+    unsigned m_whnf;            // number of calls to whnf
+    unsigned m_whnf_hits;       // number of whnf cache hits
+    unsigned m_delta;           // number of delta-reduction (definition unfolding) steps
+    unsigned m_norm_ext;        // number of normalizer extension invocations
+    unsigned m_macro_expand;    // number of macro expansions
+    unsigned m_is_def_eq;       // number of (top-level) calls to is_def_eq
+    double   m_is_def_eq_time;  // wall-clock time (in seconds) spent in is_def_eq
+    unsigned m_struct_fallbacks; // number of structural equality tests performed by cache lookups
+    converter_stats():m_whnf_core(0), m_whnf_core_hits(0), m_whnf(0), m_whnf_hits(0), m_delta(0),
+                      m_norm_ext(0), m_macro_expand(0), m_is_def_eq(0), m_is_def_eq_time(0.0), m_struct_fallbacks(0) {}
+};
+
 /** \brief Auxiliary exception used to sign that constraints cannot be created when \c m_cnstrs_enabled flag is false. */
 struct add_cnstr_exception {};
 
@@ -33,8 +49,17 @@ public:
     virtual ~converter() {}
 
     virtual expr whnf(expr const & e, context & c) = 0;
+    /**
+       \brief Return the normal form of \c e. Opaque definitions (and the ones in the extra opaque set)
+       are not unfolded.
+    */
+    virtual expr normalize(expr const & e, context & c) = 0;
     virtual bool is_def_eq(expr const & t, expr const & s, context & c, delayed_justification & j) = 0;
     bool is_def_eq(expr const & t, expr const & s, context & c);
+
+    /** \brief Return the performance counters collected by this converter. */
+    virtual converter_stats get_stats() const { return converter_stats(); }
+    virtual void reset_stats() {}
 };
 
 std::unique_ptr<converter> mk_dummy_converter();
@@ -88,6 +88,16 @@ bool definition::use_conv_opt() const { return m_ptr->m_use_conv_opt; }
 
 void definition::write(serializer & s) const { m_ptr->write(s); }
 
+definition definition::update(name const & n, param_names const & params, expr const & t, optional<expr> const & v) const {
+    if (is_definition()) {
+        lean_assert(v);
+        return definition(new cell(n, params, t, m_ptr->m_theorem, *v, m_ptr->m_opaque, m_ptr->m_weight,
+                                   m_ptr->m_module_idx, m_ptr->m_use_conv_opt));
+    } else {
+        return definition(new cell(n, params, t, m_ptr->m_theorem));
+    }
+}
+
 definition mk_definition(name const & n, param_names const & params, expr const & t, expr const & v,
                          bool opaque, unsigned weight, module_idx mod_idx, bool use_conv_opt) {
     return definition(new definition::cell(n, params, t, false, v, opaque, weight, mod_idx, use_conv_opt));
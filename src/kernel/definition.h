@@ -67,6 +67,12 @@ public:
     module_idx get_module_idx() const;
     bool use_conv_opt() const;
 
+    /**
+       \brief Return a copy of this definition with the given name, universe parameters, type and value.
+       The value is ignored if this definition is a postulate.
+    */
+    definition update(name const & n, param_names const & params, expr const & t, optional<expr> const & v) const;
+
     friend definition mk_definition(environment const & env, name const & n, param_names const & params, expr const & t,
                                     expr const & v, bool opaque, module_idx mod_idx, bool use_conv_opt);
     friend definition mk_definition(name const & n, param_names const & params, expr const & t, expr const & v, bool opaque,
@@ -7,8 +7,13 @@ Author: Leonardo de Moura
 #include <utility>
 #include <vector>
 #include <limits>
+#include "util/sstream.h"
+#include "util/list_fn.h"
 #include "kernel/environment.h"
 #include "kernel/kernel_exception.h"
+#include "kernel/for_each_fn.h"
+#include "kernel/check_cache.h"
+#include "kernel/max_sharing.h"
 
 namespace lean {
 /**
@@ -19,6 +24,8 @@ public:
     virtual optional<expr> operator()(expr const &, extension_context &) const {
         return none_expr();
     }
+    virtual optional<name> get_identity() const { return optional<name>("noop"); }
+    virtual bool is_noop() const { return true; }
 };
 
 environment_header::environment_header(unsigned trust_lvl, bool proof_irrel, bool eta, bool impredicative, std::unique_ptr<normalizer_extension const> ext):
@@ -42,8 +49,11 @@ bool environment_id::is_descendant(environment_id const & id) const {
     return false;
 }
 
-environment::environment(header const & h, environment_id const & ancestor, definitions const & d, name_set const & g, extensions const & exts):
-    m_header(h), m_id(environment_id::mk_descendant(ancestor)), m_definitions(d), m_global_levels(g), m_extensions(exts) {}
+environment::environment(header const & h, environment_id const & ancestor, definitions const & d, name_set const & g, extensions const & exts,
+                         dependencies const & deps, dependencies const & rdeps, fingerprints const & fps,
+                         optional<dependencies> const & head_index):
+    m_header(h), m_id(environment_id::mk_descendant(ancestor)), m_definitions(d), m_global_levels(g), m_extensions(exts),
+    m_dependencies(deps), m_dependents(rdeps), m_fingerprints(fps), m_head_index(head_index) {}
 
 environment::environment(unsigned trust_lvl, bool proof_irrel, bool eta, bool impredicative):
     environment(trust_lvl, proof_irrel, eta, impredicative, std::unique_ptr<normalizer_extension>(new noop_normalizer_extension()))
@@ -72,20 +82,100 @@ definition environment::get(name const & n) const {
     throw_kernel_exception(env, "invalid declaration, it was checked/certified in an incompatible environment");
 }
 
+/** \brief Return the constants occurring in the type and value of \c d. */
+static name_set collect_dependencies(definition const & d) {
+    name_set r;
+    auto fn = [&](expr const & e, unsigned) {
+        if (is_constant(e)) {
+            r.insert(const_name(e));
+            return false;
+        }
+        return true;
+    };
+    for_each(d.get_type(), fn);
+    if (d.is_definition())
+        for_each(d.get_value(), fn);
+    return r;
+}
+
+optional<name> get_conclusion_head(expr const & type) {
+    expr const * it = &type;
+    while (is_pi(*it))
+        it = &binder_body(*it);
+    while (is_app(*it))
+        it = &app_fn(*it);
+    if (is_constant(*it))
+        return optional<name>(const_name(*it));
+    else
+        return optional<name>();
+}
+
+/** \brief Add/remove \c d to/from the set of definitions associated with the head of its type in \c idx. */
+template<bool Insert>
+static void update_head_index(rb_map<name, name_set, name_quick_cmp> & idx, definition const & d) {
+    if (auto h = get_conclusion_head(d.get_type())) {
+        name_set const * s = idx.find(*h);
+        if (Insert)
+            idx.insert(*h, insert(s ? *s : name_set(), d.get_name()));
+        else if (s)
+            idx.insert(*h, erase(*s, d.get_name()));
+    }
+}
+
+/** \brief Return a new environment where \c d is stored (and its dependencies are recorded). */
+environment environment::update_definition(definition const & d) const {
+    name const & n = d.get_name();
+    name_set ds;
+    fingerprints fps = m_fingerprints;
+    if (get_check_cache()) {
+        fingerprint f = get_fingerprint(d, &ds);
+        bool ok = true;
+        ds.for_each([&](name const & c) {
+                if (fingerprint const * fc = m_fingerprints.find(c))
+                    f.mix(*fc);
+                else
+                    ok = false;
+            });
+        if (ok)
+            fps.insert(n, f);
+        else
+            fps.erase(n);
+    } else {
+        ds = collect_dependencies(d);
+        fps.erase(n);
+    }
+    dependencies rdeps = m_dependents;
+    ds.for_each([&](name const & c) {
+            name_set const * s = rdeps.find(c);
+            rdeps.insert(c, insert(s ? *s : name_set(), n));
+        });
+    optional<dependencies> idx = m_head_index;
+    if (idx)
+        update_head_index<true>(*idx, d);
+    return environment(m_header, m_id, insert(m_definitions, n, d), m_global_levels, m_extensions,
+                       insert(m_dependencies, n, ds), rdeps, fps, idx);
+}
+
+optional<fingerprint> environment::get_deep_fingerprint(name const & n) const {
+    fingerprint const * f = m_fingerprints.find(n);
+    return f ? optional<fingerprint>(*f) : optional<fingerprint>();
+}
+
 environment environment::add(certified_definition const & d) const {
     if (!m_id.is_descendant(d.get_id()))
         throw_incompatible_environment(*this);
     name const & n = d.get_definition().get_name();
     if (find(n))
         throw_already_declared(*this, n);
-    return environment(m_header, m_id, insert(m_definitions, n, d.get_definition()), m_global_levels, m_extensions);
+    return update_definition(d.get_definition());
 }
 
 environment environment::add_global_level(name const & n) const {
     if (m_global_levels.contains(n))
         throw_kernel_exception(*this,
                                "invalid global universe level declaration, environment already contains a universe level with the given name");
-    return environment(m_header, m_id, m_definitions, insert(m_global_levels, n), m_extensions);
+    return environment(m_header, m_id, m_definitions, insert(m_global_levels, n), m_extensions, m_dependencies, m_dependents, m_fingerprints,
+                       m_head_index);
 }
 
 bool environment::is_global_level(name const & n) const {
@@ -105,11 +195,163 @@ environment environment::replace(certified_definition const & t) const {
         throw_kernel_exception(*this, "invalid replacement of axiom with theorem, the new declaration is not a theorem");
     if (ax->get_type() != t.get_definition().get_type())
         throw_kernel_exception(*this, "invalid replacement of axiom with theorem, the 'replace' operation can only be used when the axiom and theorem have the same type");
-    return environment(m_header, m_id, insert(m_definitions, n, t.get_definition()), m_global_levels, m_extensions);
+    return update_definition(t.get_definition());
 }
 
 environment environment::forget() const {
-    return environment(m_header, environment_id(), m_definitions, m_global_levels, m_extensions);
+    return environment(m_header, environment_id(), m_definitions, m_global_levels, m_extensions, m_dependencies, m_dependents, m_fingerprints,
+                       m_head_index);
+}
+
+name_set environment::get_dependencies(name const & n) const {
+    name_set const * s = m_dependencies.find(n);
+    return s ? *s : name_set();
+}
+
+name_set environment::get_dependents(name const & n) const {
+    name_set const * s = m_dependents.find(n);
+    return s ? *s : name_set();
+}
+
+void environment::get_transitive_dependents(unsigned num, name const * ns, buffer<name> & r) const {
+    // The result is the reverse postorder of a depth-first traversal of the m_dependents graph.
+    name_set visited;
+    buffer<std::pair<name, bool>> todo; // the flag is true if the dependents of the given name were already visited
+    buffer<name> postorder;
+    unsigned i = num;
+    while (i > 0) {
+        --i;
+        todo.emplace_back(ns[i], false);
+    }
+    while (!todo.empty()) {
+        auto p = todo.back();
+        todo.pop_back();
+        if (p.second) {
+            postorder.push_back(p.first);
+        } else if (!visited.contains(p.first)) {
+            visited.insert(p.first);
+            todo.emplace_back(p.first, true);
+            if (name_set const * s = m_dependents.find(p.first)) {
+                s->for_each([&](name const & d) {
+                        if (!visited.contains(d))
+                            todo.emplace_back(d, false);
+                    });
+            }
+        }
+    }
+    i = postorder.size();
+    while (i > 0) {
+        --i;
+        r.push_back(postorder[i]);
+    }
+}
+
+environment environment::remove(name_set const & ns) const {
+    definitions  ds    = m_definitions;
+    dependencies deps  = m_dependencies;
+    dependencies rdeps = m_dependents;
+    fingerprints fps   = m_fingerprints;
+    optional<dependencies> idx = m_head_index;
+    ns.for_each([&](name const & n) {
+            if (!find(n))
+                throw_unknown_declaration(*this, n);
+            if (name_set const * s = m_dependents.find(n)) {
+                s->for_each([&](name const & d) {
+                        if (!ns.contains(d))
+                            throw_kernel_exception(*this, sstream() << "failed to remove '" << n << "', '" << d << "' depends on it");
+                    });
+            }
+            if (idx)
+                update_head_index<false>(*idx, get(n));
+            ds.erase(n);
+            deps.erase(n);
+            rdeps.erase(n);
+            fps.erase(n);
+        });
+    ns.for_each([&](name const & n) {
+            get_dependencies(n).for_each([&](name const & c) {
+                    if (name_set const * s = rdeps.find(c))
+                        rdeps.insert(c, erase(*s, n));
+                });
+        });
+    return environment(m_header, environment_id(), ds, m_global_levels, m_extensions, deps, rdeps, fps, idx);
+}
+
+environment environment::enable_head_index() const {
+    if (m_head_index)
+        return *this;
+    dependencies idx;
+    m_definitions.for_each([&](name const &, definition const & d) { update_head_index<true>(idx, d); });
+    return environment(m_header, m_id, m_definitions, m_global_levels, m_extensions, m_dependencies, m_dependents, m_fingerprints,
+                       optional<dependencies>(idx));
+}
+
+name_set environment::get_definitions_with_head(name const & c) const {
+    if (!m_head_index)
+        throw_kernel_exception(*this, "environment does not maintain the head symbol index, it must be enabled using enable_head_index");
+    name_set const * s = m_head_index->find(c);
+    return s ? *s : name_set();
+}
+
+environment environment::compact(compact_report & r, unsigned num_threads) const {
+    buffer<definition> ds;
+    buffer<expr> es;
+    m_definitions.for_each([&](name const &, definition const & d) {
+            ds.push_back(d);
+            es.push_back(d.get_type());
+            if (d.is_definition())
+                es.push_back(d.get_value());
+        });
+    sharing_table t;
+    buffer<expr> new_es;
+    sharing_stats stats = max_sharing(t, es.size(), es.data(), new_es, num_threads);
+    auto share_names = [&](list<name> const & ns) {
+        return map_reuse(ns, [&](name const & n) { return t.share(n); }, name::ptr_eq());
+    };
+    auto share_name_set = [&](name_set const & s) {
+        name_set new_s;
+        s.for_each([&](name const & n) { new_s.insert(t.share(n)); });
+        return new_s;
+    };
+    auto share_deps = [&](dependencies const & deps) {
+        dependencies new_deps;
+        deps.for_each([&](name const & n, name_set const & s) { new_deps.insert(t.share(n), share_name_set(s)); });
+        return new_deps;
+    };
+    definitions new_ds;
+    fingerprints new_fps;
+    unsigned i = 0;
+    for (definition const & d : ds) {
+        expr new_type = new_es[i++];
+        optional<expr> new_value;
+        if (d.is_definition())
+            new_value = new_es[i++];
+        name n = t.share(d.get_name());
+        new_ds.insert(n, d.update(n, share_names(d.get_params()), new_type, new_value));
+    }
+    m_fingerprints.for_each([&](name const & n, fingerprint const & fp) { new_fps.insert(t.share(n), fp); });
+    optional<dependencies> new_head_index;
+    if (m_head_index)
+        new_head_index = share_deps(*m_head_index);
+    environment new_env(m_header, m_id, new_ds, share_name_set(m_global_levels), m_extensions, share_deps(m_dependencies),
+                        share_deps(m_dependents), new_fps, new_head_index);
+    r.m_num_definitions  = ds.size();
+    r.m_num_cells_before = stats.m_num_cells_before;
+    r.m_num_cells_after  = stats.m_num_cells_after;
+    r.m_size_before      = stats.m_size_before;
+    r.m_size_after       = stats.m_size_after;
+    r.m_num_names        = t.get_num_names();
+    r.m_num_levels       = t.get_num_levels();
+    return new_env;
+}
+
+std::ostream & operator<<(std::ostream & out, compact_report const & r) {
+    out << "definitions: " << r.m_num_definitions << "\n";
+    out << "expression cells: " << r.m_num_cells_before << " => " << r.m_num_cells_after << "\n";
+    out << "expression memory (bytes): " << r.m_size_before << " => " << r.m_size_after << "\n";
+    out << "distinct names: " << r.m_num_names << "\n";
+    out << "distinct levels: " << r.m_num_levels << "\n";
+    return out;
 }
 
 class extension_manager {
@@ -162,6 +404,6 @@ environment environment::update(unsigned id, std::shared_ptr<environment_extensi
     if (id >= new_exts->size())
         new_exts->resize(id+1);
     (*new_exts)[id] = ext;
-    return environment(m_header, m_id, m_definitions, m_global_levels, new_exts);
+    return environment(m_header, m_id, m_definitions, m_global_levels, new_exts, m_dependencies, m_dependents, m_fingerprints, m_head_index);
 }
 }
@@ -12,10 +12,12 @@ Author: Leonardo de Moura
 #include "util/optional.h"
 #include "util/list.h"
 #include "util/rb_map.h"
+#include "util/buffer.h"
 #include "util/name_set.h"
 #include "kernel/expr.h"
 #include "kernel/constraint.h"
 #include "kernel/definition.h"
+#include "kernel/fingerprint.h"
 
 namespace lean {
 class type_checker;
@@ -32,6 +34,14 @@ class normalizer_extension {
 public:
     virtual ~normalizer_extension() {}
     virtual optional<expr> operator()(expr const & e, extension_context & ctx) const = 0;
+    /**
+       \brief Return a name that identifies this extension (and its behavior) across executions.
+       It is used to make sure definitions certified by the check cache (see \c check_cache) were checked
+       using the same extension. The default implementation returns none, and the check cache is not used.
+    */
+    virtual optional<name> get_identity() const { return optional<name>(); }
+    /** \brief Return true if this extension never reduces an expression. Then, the kernel does not invoke it. */
+    virtual bool is_noop() const { return false; }
 };
 
 /**
@@ -93,18 +103,41 @@ public:
    3- By attaching additional data as environment::extensions. The additional data can be added
       at any time. They contain information used by the automation (e.g., rewriting sets, unification hints, etc).
 */
+/** \brief Memory report produced by \c environment::compact. */
+struct compact_report {
+    unsigned m_num_definitions;
+    unsigned m_num_cells_before; //!< number of expression cells used by the types and values of the definitions
+    unsigned m_num_cells_after;
+    size_t   m_size_before;      //!< memory (in bytes) used by these cells
+    size_t   m_size_after;
+    unsigned m_num_names;        //!< number of distinct names in the definitions and dependency tables
+    unsigned m_num_levels;       //!< number of distinct universe levels in the definitions
+    compact_report():m_num_definitions(0), m_num_cells_before(0), m_num_cells_after(0), m_size_before(0), m_size_after(0),
+                     m_num_names(0), m_num_levels(0) {}
+};
+std::ostream & operator<<(std::ostream & out, compact_report const & r);
+
 class environment {
     typedef std::shared_ptr<environment_header const>     header;
     typedef rb_map<name, definition, name_quick_cmp>      definitions;
     typedef std::shared_ptr<environment_extensions const> extensions;
+    typedef rb_map<name, name_set, name_quick_cmp>        dependencies;
+    typedef rb_map<name, fingerprint, name_quick_cmp>     fingerprints;
 
     header         m_header;
     environment_id m_id;
     definitions    m_definitions;
     name_set       m_global_levels;
     extensions     m_extensions;
+    dependencies   m_dependencies; //!< constants occurring in the type and value of each definition
+    dependencies   m_dependents;   //!< reverse of m_dependencies
+    fingerprints   m_fingerprints; //!< deep fingerprints, they are only recorded when the check cache is enabled
+    optional<dependencies> m_head_index; //!< head constant of the conclusion of a type -> definitions (see enable_head_index)
 
-    environment(header const & h, environment_id const & id, definitions const & d, name_set const & global_levels, extensions const & ext);
+    environment(header const & h, environment_id const & id, definitions const & d, name_set const & global_levels, extensions const & ext,
+                dependencies const & deps, dependencies const & rdeps, fingerprints const & fps,
+                optional<dependencies> const & head_index);
+    environment update_definition(definition const & d) const;
 
 public:
     environment(unsigned trust_lvl = 0, bool proof_irrel = true, bool eta = true, bool impredicative = true);
@@ -163,6 +196,66 @@ public:
     */
     environment replace(certified_definition const & t) const;
 
+    /**
+       \brief Return the fingerprint of the definition named \c n combined with the fingerprints of the definitions
+       it depends on (directly or indirectly). The deep fingerprints are only recorded when the check cache is enabled
+       (see \c set_check_cache).
+    */
+    optional<fingerprint> get_deep_fingerprint(name const & n) const;
+
+    /** \brief Return the constants occurring in the type and value of the definition named \c n. */
+    name_set get_dependencies(name const & n) const;
+
+    /** \brief Return the definitions whose type or value contain the constant \c n. */
+    name_set get_dependents(name const & n) const;
+
+    /**
+       \brief Store in \c r the definitions \c ns[0], ..., \c ns[num-1], and all definitions that depend on them
+       (directly or indirectly). The result is topologically sorted, i.e., every definition occurs after
+       its dependencies in \c r.
+    */
+    void get_transitive_dependents(unsigned num, name const * ns, buffer<name> & r) const;
+
+    /**
+       \brief Remove the definitions in \c ns from this environment.
+       This method throws an exception if one of them is not in the environment, or
+       another definition that is not in \c ns depends on it.
+
+       \remark Since the certified definitions produced for this environment and its ancestors may
+       depend on the removed definitions, the result is not a descendant of any environment
+       (see \c forget).
+    */
+    environment remove(name_set const & ns) const;
+
+    /**
+       \brief Return a new environment that maintains an index from the head constant of the conclusion
+       of the type of each definition (see \c get_conclusion_head) to the definitions.
+       The index is built once for the definitions in this environment, and then it is updated
+       incrementally by \c add, \c replace and \c remove.
+    */
+    environment enable_head_index() const;
+
+    /** \brief Return true iff the environment maintains the head symbol index. */
+    bool has_head_index() const { return static_cast<bool>(m_head_index); }
+
+    /**
+       \brief Return the definitions whose type is of the form <tt>Pi (x_1 : A_1) ... (x_n : A_n), c b_1 ... b_k</tt>.
+       This method throws an exception if the head symbol index is not enabled.
+    */
+    name_set get_definitions_with_head(name const & c) const;
+
+    /**
+       \brief Return an equivalent environment where the types and values of all definitions, and the names and
+       universe levels occurring in them and in the dependency tables, are rebuilt using a single sharing table
+       (see \c sharing_table). So, identical sub-expressions of different definitions are represented by the same cell.
+       Binder names and \c binder_info are preserved, sub-expressions that only differ on them are not shared.
+       The definitions are processed by \c num_threads threads (0 means one per hardware thread), and
+       the memory used before and after the compaction is stored in \c r.
+
+       \remark The result is a descendant of this environment.
+    */
+    environment compact(compact_report & r, unsigned num_threads = 0) const;
+
     /**
        \brief Register an environment extension. Every environment
        object may contain this extension. The argument \c initial is
@@ -190,7 +283,13 @@ public:
     environment forget() const;
 };
 
+/**
+   \brief Return the constant \c c if \c type is of the form <tt>Pi (x_1 : A_1) ... (x_n : A_n), c b_1 ... b_k</tt>.
+*/
+optional<name> get_conclusion_head(expr const & type);
+
 class name_generator;
+class pending_certificate;
 
 /**
    \brief A certified definition is one that has been type checked.
@@ -198,12 +297,20 @@ class name_generator;
 */
 class certified_definition {
     friend certified_definition check(environment const & env, definition const & d, name_generator const & g, name_set const & extra_opaque, bool memoize);
-    environment_id m_id;
-    definition     m_definition;
+    friend class async_checker;
+    environment_id                       m_id;
+    definition                           m_definition;
+    std::shared_ptr<pending_certificate> m_pending; // not nullptr if the proof is checked in the background
     certified_definition(environment_id const & id, definition const & d):m_id(id), m_definition(d) {}
+    certified_definition(environment_id const & id, definition const & d, std::shared_ptr<pending_certificate> const & p):
+        m_id(id), m_definition(d), m_pending(p) {}
 public:
     /** \brief Return the id of the environment that was used to type check this definition. */
     environment_id const & get_id() const { return m_id; }
     definition const & get_definition() const { return m_definition; }
+    /** \brief Return true iff the proof of this theorem is still being checked in the background (see \c async_checker). */
+    bool is_pending() const;
+    /** \brief Wait for the proof of this theorem to be checked, and throw an exception if it is not type correct. */
+    void wait() const;
 };
 }
@@ -10,9 +10,13 @@ Author: Leonardo de Moura
 #include <string>
 #include <algorithm>
 #include <limits>
+#include <unordered_map>
+#include <utility>
+#include <new>
 #include "util/list_fn.h"
 #include "util/hash.h"
 #include "util/buffer.h"
+#include "util/thread.h"
 #include "util/object_serializer.h"
 #include "kernel/expr.h"
 #include "kernel/expr_eq_fn.h"
@@ -30,24 +34,54 @@ unsigned hash_levels(levels const & ls) {
     return r;
 }
 
-expr_cell::expr_cell(expr_kind k, unsigned h, bool has_mv, bool has_local, bool has_param_univ):
+static unsigned get_mv_fingerprint(level const & l) {
+    if (!has_meta(l))
+        return 0;
+    unsigned r = 0;
+    for_each(l, [&](level const & l) {
+            if (!has_meta(l))
+                return false;
+            if (is_meta(l))
+                r |= mk_mv_fingerprint(meta_id(l));
+            return true;
+        });
+    return r;
+}
+
+static unsigned get_mv_fingerprint(levels const & ls) {
+    unsigned r = 0;
+    for (auto const & l : ls)
+        r |= get_mv_fingerprint(l);
+    return r;
+}
+
+static_assert(sizeof(expr_app) <= LEAN_MEMORY_POOL_MAX_OBJECT_SIZE &&
+              sizeof(expr_binder) <= LEAN_MEMORY_POOL_MAX_OBJECT_SIZE &&
+              sizeof(expr_let) <= LEAN_MEMORY_POOL_MAX_OBJECT_SIZE &&
+              sizeof(expr_macro) <= LEAN_MEMORY_POOL_MAX_OBJECT_SIZE &&
+              sizeof(expr_mlocal) <= LEAN_MEMORY_POOL_MAX_OBJECT_SIZE,
+              "expression cells must fit in the memory pool");
+static_assert(LEAN_MAX_SMALL_FIELD < (1u << 12), "LEAN_MAX_SMALL_FIELD does not fit in the depth and free variable range fields");
+
+static unsigned saturate(unsigned v) {
+    return v < LEAN_MAX_SMALL_FIELD ? v : LEAN_MAX_SMALL_FIELD;
+}
+
+expr_cell::expr_cell(expr_kind k, unsigned h, bool has_mv, bool has_local, bool has_param_univ, unsigned d, unsigned fv_range):
     m_flags(0),
     m_kind(static_cast<unsigned>(k)),
     m_has_mv(has_mv),
     m_has_local(has_local),
     m_has_param_univ(has_param_univ),
+    m_name_fingerprint(0),
+    m_depth(saturate(d)),
+    m_free_var_range(saturate(fv_range)),
+    m_mv_fingerprint(0),
     m_hash(h),
-    m_tag(nulltag),
     m_rc(0) {
-    // m_hash_alloc does not need to be a unique identifier.
-    // We want diverse hash codes because given expr_cell * c1 and expr_cell * c2,
-    // if c1 != c2, then there is high probability c1->m_hash_alloc != c2->m_hash_alloc.
-    // Remark: using pointer address as a hash code is not a good idea.
-    //    - each execution run will behave differently.
-    //    - the hash is not diverse enough
-    static LEAN_THREAD_LOCAL unsigned g_hash_alloc_counter = 0;
-    m_hash_alloc = g_hash_alloc_counter;
-    g_hash_alloc_counter++;
+    // Remark: hash_alloc is derived from the memory pool slot used to store the cell.
+    // Using the pool slot (instead of the pointer address) guarantees that each execution run behaves
+    // in the same way, and the hash codes are diverse enough.
 }
 
 void expr_cell::dec_ref(expr & e, buffer<expr_cell*> & todelete) {
@@ -78,8 +112,69 @@ void expr_cell::set_is_arrow(bool flag) {
     lean_assert(is_arrow() && *is_arrow() == flag);
 }
 
+/**
+   \brief Side table for storing expression tags.
+   The table is split in buckets protected by different mutexes to reduce contention.
+*/
+class tag_table {
+    static constexpr unsigned num_buckets = 32;
+    struct bucket {
+        mutex                                          m_mutex;
+        std::unordered_map<expr_cell const *, tag>     m_map;
+    };
+    bucket m_buckets[num_buckets]; // NOLINT
+    bucket & get_bucket(expr_cell const * c) {
+        return m_buckets[(reinterpret_cast<uintptr_t>(c) >> 3) % num_buckets];
+    }
+public:
+    void set(expr_cell const * c, tag t) {
+        bucket & b = get_bucket(c);
+        lock_guard<mutex> lock(b.m_mutex);
+        if (t == nulltag)
+            b.m_map.erase(c);
+        else
+            b.m_map[c] = t;
+    }
+    tag get(expr_cell const * c) {
+        bucket & b = get_bucket(c);
+        lock_guard<mutex> lock(b.m_mutex);
+        auto it = b.m_map.find(c);
+        return it == b.m_map.end() ? nulltag : it->second;
+    }
+    void erase(expr_cell const * c) { set(c, nulltag); }
+    unsigned size() {
+        unsigned r = 0;
+        for (bucket & b : m_buckets) {
+            lock_guard<mutex> lock(b.m_mutex);
+            r += b.m_map.size();
+        }
+        return r;
+    }
+};
+
+// Remark: the tag table is never deleted because expressions may be deleted after
+// the destructors of static objects are executed.
+static tag_table & get_tag_table() {
+    static tag_table * g_tag_table = new tag_table();
+    return *g_tag_table;
+}
+
 void expr_cell::set_tag(tag t) {
-    m_tag = t;
+    if (t == nulltag && (m_flags & 4) == 0)
+        return;
+    get_tag_table().set(this, t);
+    // Remark: the flag must only be set after the table is updated.
+    m_flags |= 4;
+}
+
+tag expr_cell::get_tag() const {
+    if ((m_flags & 4) == 0)
+        return nulltag;
+    return get_tag_table().get(this);
+}
+
+unsigned get_num_tagged_exprs() {
+    return get_tag_table().size();
 }
 
 bool is_meta(expr const & e) {
@@ -92,8 +187,9 @@ bool is_meta(expr const & e) {
 
 // Expr variables
 expr_var::expr_var(unsigned idx):
-    expr_cell(expr_kind::Var, idx, false, false, false),
+    expr_cell(expr_kind::Var, idx, false, false, false, 1, idx + 1),
     m_vidx(idx) {
+    set_hash64(::lean::hash64(static_cast<uint64>(expr_kind::Var), idx));
     if (idx == std::numeric_limits<unsigned>::max())
         throw exception("invalid free variable index, de Bruijn index is too big");
 }
@@ -102,13 +198,22 @@ expr_var::expr_var(unsigned idx):
 expr_const::expr_const(name const & n, levels const & ls):
     expr_cell(expr_kind::Constant, ::lean::hash(n.hash(), hash_levels(ls)), has_meta(ls), false, has_param(ls)),
     m_name(n),
-    m_levels(ls) {}
+    m_levels(ls) {
+    set_hash64(::lean::hash64(::lean::hash64(static_cast<uint64>(expr_kind::Constant), n.hash()), hash_levels(ls)));
+    m_mv_fingerprint = get_mv_fingerprint(ls);
+}
 
 // Expr metavariables and local variables
 expr_mlocal::expr_mlocal(bool is_meta, name const & n, expr const & t):
-    expr_cell(is_meta ? expr_kind::Meta : expr_kind::Local, n.hash(), is_meta || t.has_metavar(), !is_meta || t.has_local(), t.has_param_univ()),
+    expr_cell(is_meta ? expr_kind::Meta : expr_kind::Local, n.hash(), is_meta || t.has_metavar(), !is_meta || t.has_local(), t.has_param_univ(),
+              1, get_free_var_range(t)),
     m_name(n),
-    m_type(t) {}
+    m_type(t) {
+    set_hash64(::lean::hash64(::lean::hash64(static_cast<uint64>(kind()), n.hash()), t.hash64()));
+    m_mv_fingerprint = get_mv_fingerprint(t);
+    if (is_meta)
+        m_mv_fingerprint |= mk_mv_fingerprint(n);
+}
 void expr_mlocal::dealloc(buffer<expr_cell*> & todelete) {
     dec_ref(m_type, todelete);
     delete(this);
@@ -116,9 +221,7 @@ void expr_mlocal::dealloc(buffer<expr_cell*> & todelete) {
 
 // Composite expressions
 expr_composite::expr_composite(expr_kind k, unsigned h, bool has_mv, bool has_local, bool has_param_univ, unsigned d, unsigned fv_range):
-    expr_cell(k, h, has_mv, has_local, has_param_univ),
-    m_depth(d),
-    m_free_var_range(fv_range) {}
+    expr_cell(k, h, has_mv, has_local, has_param_univ, d, fv_range) {}
 
 // Expr applications
 expr_app::expr_app(expr const & fn, expr const & arg):
@@ -128,7 +231,11 @@ expr_app::expr_app(expr const & fn, expr const & arg):
                    fn.has_param_univ() || arg.has_param_univ(),
                    std::max(get_depth(fn), get_depth(arg)) + 1,
                    std::max(get_free_var_range(fn), get_free_var_range(arg))),
-    m_fn(fn), m_arg(arg) {}
+    m_fn(fn), m_arg(arg) {
+    set_hash64(::lean::hash64(::lean::hash64(static_cast<uint64>(expr_kind::App), fn.hash64()), arg.hash64()));
+    m_mv_fingerprint = get_mv_fingerprint(fn) | get_mv_fingerprint(arg);
+    m_name_fingerprint = get_name_fingerprint(fn) | get_name_fingerprint(arg);
+}
 void expr_app::dealloc(buffer<expr_cell*> & todelete) {
     dec_ref(m_fn, todelete);
     dec_ref(m_arg, todelete);
@@ -145,11 +252,15 @@ expr_binder::expr_binder(expr_kind k, name const & n, expr const & t, expr const
                    t.has_param_univ() || b.has_param_univ(),
                    std::max(get_depth(t), get_depth(b)) + 1,
                    std::max(get_free_var_range(t), dec(get_free_var_range(b)))),
+    m_info(i),
     m_name(n),
     m_domain(t),
-    m_body(b),
-    m_info(i) {
+    m_body(b) {
     lean_assert(k == expr_kind::Lambda || k == expr_kind::Pi);
+    // Remark: binder names and binder information are ignored by structural equality.
+    set_hash64(::lean::hash64(::lean::hash64(static_cast<uint64>(k), t.hash64()), b.hash64()));
+    m_mv_fingerprint = get_mv_fingerprint(t) | get_mv_fingerprint(b);
+    m_name_fingerprint = get_name_fingerprint(t) | get_name_fingerprint(b);
 }
 void expr_binder::dealloc(buffer<expr_cell*> & todelete) {
     dec_ref(m_body, todelete);
@@ -161,6 +272,8 @@ void expr_binder::dealloc(buffer<expr_cell*> & todelete) {
 expr_sort::expr_sort(level const & l):
     expr_cell(expr_kind::Sort, ::lean::hash(l), has_meta(l), false, has_param(l)),
     m_level(l) {
+    set_hash64(::lean::hash64(static_cast<uint64>(expr_kind::Sort), ::lean::hash(l)));
+    m_mv_fingerprint = get_mv_fingerprint(l);
 }
 expr_sort::~expr_sort() {}
 
@@ -176,6 +289,9 @@ expr_let::expr_let(name const & n, expr const & t, expr const & v, expr const &
     m_type(t),
     m_value(v),
     m_body(b) {
+    set_hash64(::lean::hash64(::lean::hash64(::lean::hash64(static_cast<uint64>(expr_kind::Let), t.hash64()), v.hash64()), b.hash64()));
+    m_mv_fingerprint = get_mv_fingerprint(t) | get_mv_fingerprint(v) | get_mv_fingerprint(b);
+    m_name_fingerprint = get_name_fingerprint(t) | get_name_fingerprint(v) | get_name_fingerprint(b);
 }
 void expr_let::dealloc(buffer<expr_cell*> & todelete) {
     dec_ref(m_body, todelete);
@@ -260,8 +376,14 @@ expr_macro::expr_macro(macro_definition const & m, unsigned num, expr const * ar
     m_definition(m),
     m_num_args(num) {
     m_args = new expr[num];
-    for (unsigned i = 0; i < m_num_args; i++)
+    uint64 h = ::lean::hash64(static_cast<uint64>(expr_kind::Macro), m.hash());
+    for (unsigned i = 0; i < m_num_args; i++) {
         m_args[i] = args[i];
+        m_mv_fingerprint |= get_mv_fingerprint(args[i]);
+        m_name_fingerprint |= get_name_fingerprint(args[i]);
+        h = ::lean::hash64(h, args[i].hash64());
+    }
+    set_hash64(h);
 }
 void expr_macro::dealloc(buffer<expr_cell*> & todelete) {
     for (unsigned i = 0; i < m_num_args; i++) dec_ref(m_args[i], todelete);
@@ -279,6 +401,8 @@ void expr_cell::dealloc() {
             expr_cell * it = todo.back();
             todo.pop_back();
             lean_assert(it->get_rc() == 0);
+            if (it->m_flags & 4)
+                get_tag_table().erase(it);
             switch (it->kind()) {
             case expr_kind::Var:        delete static_cast<expr_var*>(it); break;
             case expr_kind::Macro:      static_cast<expr_macro*>(it)->dealloc(todo); break;
@@ -352,34 +476,68 @@ expr mk_Bool() { return Bool; }
 expr mk_Type() { return Type; }
 
 unsigned get_depth(expr const & e) {
-    switch (e.kind()) {
-    case expr_kind::Var:  case expr_kind::Constant: case expr_kind::Sort:
-    case expr_kind::Meta: case expr_kind::Local:
-        return 1;
-    case expr_kind::Lambda: case expr_kind::Pi:  case expr_kind::Macro:
-    case expr_kind::App:    case expr_kind::Let:
-        return static_cast<expr_composite*>(e.raw())->m_depth;
-    }
-    lean_unreachable(); // LCOV_EXCL_LINE
+    return e.raw()->m_depth;
 }
 
-unsigned get_free_var_range(expr const & e) {
-    switch (e.kind()) {
-    case expr_kind::Var:
-        return var_idx(e) + 1;
-    case expr_kind::Constant: case expr_kind::Sort:
-        return 0;
-    case expr_kind::Meta: case expr_kind::Local:
-        return get_free_var_range(mlocal_type(e));
-    case expr_kind::Lambda: case expr_kind::Pi:
-    case expr_kind::App:    case expr_kind::Let:
-    case expr_kind::Macro:
-        return static_cast<expr_composite*>(e.raw())->m_free_var_range;
+/**
+   \brief Functional object for computing the free variable range of expressions containing
+   free variables with big de Bruijn indices (i.e., the m_free_var_range field is saturated).
+*/
+class free_var_range_fn {
+    std::unordered_map<expr_cell *, unsigned> m_cache;
+
+    unsigned apply(expr const & e) {
+        unsigned r = e.raw()->m_free_var_range;
+        if (r < LEAN_MAX_SMALL_FIELD)
+            return r;
+        bool shared = is_shared(e);
+        if (shared) {
+            auto it = m_cache.find(e.raw());
+            if (it != m_cache.end())
+                return it->second;
+        }
+        switch (e.kind()) {
+        case expr_kind::Var:
+            r = var_idx(e) + 1;
+            break;
+        case expr_kind::Constant: case expr_kind::Sort:
+            lean_unreachable(); // LCOV_EXCL_LINE
+        case expr_kind::Meta: case expr_kind::Local:
+            r = apply(mlocal_type(e));
+            break;
+        case expr_kind::App:
+            r = std::max(apply(app_fn(e)), apply(app_arg(e)));
+            break;
+        case expr_kind::Lambda: case expr_kind::Pi:
+            r = std::max(apply(binder_domain(e)), dec(apply(binder_body(e))));
+            break;
+        case expr_kind::Let:
+            r = std::max({apply(let_type(e)), dec(apply(let_value(e))), dec(apply(let_body(e)))});
+            break;
+        case expr_kind::Macro:
+            r = 0;
+            for (unsigned i = 0; i < macro_num_args(e); i++)
+                r = std::max(r, apply(macro_arg(e, i)));
+            break;
+        }
+        if (shared)
+            m_cache.insert(mk_pair(e.raw(), r));
+        return r;
     }
-    lean_unreachable(); // LCOV_EXCL_LINE
+public:
+    unsigned operator()(expr const & e) { return apply(e); }
+};
+
+unsigned get_free_var_range(expr const & e) {
+    unsigned r = e.raw()->m_free_var_range;
+    if (r < LEAN_MAX_SMALL_FIELD)
+        return r;
+    else
+        return free_var_range_fn()(e);
 }
 
 bool operator==(expr const & a, expr const & b) { return expr_eq_fn()(a, b); }
+bool is_bi_equal(expr const & a, expr const & b) { return expr_eq_fn(true)(a, b); }
 
 static expr copy_tag(expr const & e, expr && new_e) {
     tag t = e.get_tag();
@@ -455,6 +613,105 @@ expr update_macro(expr const & e, unsigned num, expr const * args) {
     return copy_tag(e, mk_macro(to_macro(e)->m_definition, num, args));
 }
 
+template<typename T, typename... Args>
+void expr_cell::reinit(expr_cell * c, Args const &... args) {
+    lean_assert(c->get_rc() == 1);
+    // Remark: the tag of the cell is stored in the tag side table, and it is preserved.
+    unsigned char tag_flag = c->m_flags & 4;
+    static_cast<T*>(c)->~T();
+    ::new (c) T(args...);
+    c->m_flags = tag_flag;
+    c->inc_ref();
+}
+
+void expr_cell::take_children(expr & e, buffer<expr> & r) {
+    lean_assert(!is_shared(e));
+    switch (e.kind()) {
+    case expr_kind::App: {
+        expr_app * c = static_cast<expr_app*>(e.raw());
+        r.push_back(std::move(c->m_fn));
+        r.push_back(std::move(c->m_arg));
+        break;
+    }
+    case expr_kind::Lambda: case expr_kind::Pi: {
+        expr_binder * c = static_cast<expr_binder*>(e.raw());
+        r.push_back(std::move(c->m_domain));
+        r.push_back(std::move(c->m_body));
+        break;
+    }
+    case expr_kind::Let: {
+        expr_let * c = static_cast<expr_let*>(e.raw());
+        r.push_back(std::move(c->m_type));
+        r.push_back(std::move(c->m_value));
+        r.push_back(std::move(c->m_body));
+        break;
+    }
+    case expr_kind::Macro: {
+        expr_macro * c = static_cast<expr_macro*>(e.raw());
+        for (unsigned i = 0; i < c->m_num_args; i++)
+            r.push_back(std::move(c->m_args[i]));
+        break;
+    }
+    default:
+        lean_unreachable(); // LCOV_EXCL_LINE
+    }
+}
+
+// Remark: in the following procedures, the new children are copied before the cell is reinitialized
+// because they may be subterms of \c e.
+
+expr update_app(expr && e, expr const & new_fn, expr const & new_arg) {
+    if (is_eqp(app_fn(e), new_fn) && is_eqp(app_arg(e), new_arg))
+        return std::move(e);
+    if (is_shared(e))
+        return update_app(static_cast<expr const &>(e), new_fn, new_arg);
+    expr fn(new_fn), arg(new_arg);
+    expr_cell::reinit<expr_app>(e.raw(), fn, arg);
+    return std::move(e);
+}
+
+expr update_binder(expr && e, expr const & new_domain, expr const & new_body) {
+    if (is_eqp(binder_domain(e), new_domain) && is_eqp(binder_body(e), new_body))
+        return std::move(e);
+    if (is_shared(e))
+        return update_binder(static_cast<expr const &>(e), new_domain, new_body);
+    expr d(new_domain), b(new_body);
+    name n(binder_name(e));
+    expr_binder_info i(binder_info(e));
+    expr_cell::reinit<expr_binder>(e.raw(), e.kind(), n, d, b, i);
+    return std::move(e);
+}
+
+expr update_let(expr && e, expr const & new_type, expr const & new_val, expr const & new_body) {
+    if (is_eqp(let_type(e), new_type) && is_eqp(let_value(e), new_val) && is_eqp(let_body(e), new_body))
+        return std::move(e);
+    if (is_shared(e))
+        return update_let(static_cast<expr const &>(e), new_type, new_val, new_body);
+    expr t(new_type), v(new_val), b(new_body);
+    name n(let_name(e));
+    expr_cell::reinit<expr_let>(e.raw(), n, t, v, b);
+    return std::move(e);
+}
+
+expr update_macro(expr && e, unsigned num, expr const * args) {
+    if (is_shared(e))
+        return update_macro(static_cast<expr const &>(e), num, args);
+    if (num == macro_num_args(e)) {
+        unsigned i = 0;
+        for (i = 0; i < num; i++) {
+            if (!is_eqp(macro_arg(e, i), args[i]))
+                break;
+        }
+        if (i == num)
+            return std::move(e);
+    }
+    buffer<expr> new_args;
+    new_args.append(num, args);
+    macro_definition d(macro_def(e));
+    expr_cell::reinit<expr_macro>(e.raw(), d, num, new_args.data());
+    return std::move(e);
+}
+
 bool is_atomic(expr const & e) {
     switch (e.kind()) {
     case expr_kind::Constant: case expr_kind::Sort:
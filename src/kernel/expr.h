@@ -16,6 +16,7 @@ Author: Leonardo de Moura
 #include "util/rc.h"
 #include "util/name.h"
 #include "util/hash.h"
+#include "util/memory_pool.h"
 #include "util/buffer.h"
 #include "util/list_fn.h"
 #include "util/optional.h"
@@ -24,9 +25,16 @@ Author: Leonardo de Moura
 #include "kernel/level.h"
 #include "kernel/extension_context.h"
 
+// Maximal value of the (saturated) depth and free variable range fields of expression cells.
+#ifndef LEAN_MAX_SMALL_FIELD
+#define LEAN_MAX_SMALL_FIELD 4095
+#endif
+
 namespace lean {
 // Tags are used by frontends to mark expressions. They are automatically propagated by
 // procedures such as update_app, update_binder, etc.
+// Remark: tags are not stored in the expression cells, they are stored in a (thread safe) side table
+// that is only populated when set_tag is used.
 typedef unsigned tag;
 constexpr tag nulltag = std::numeric_limits<unsigned>::max();
 class expr;
@@ -49,15 +57,26 @@ class expr_cell {
 protected:
     // The bits of the following field mean:
     //    0-1  - term is an arrow (0 - not initialized, 1 - is arrow, 2 - is not arrow)
+    //    2    - term may have a tag in the tag side table
     // Remark: we use atomic_uchar because these flags are computed lazily (i.e., after the expression is created)
     atomic_uchar       m_flags;
-    unsigned           m_kind:8;
-    unsigned           m_has_mv:1;         // term contains metavariables
-    unsigned           m_has_local:1;      // term contains local constants
-    unsigned           m_has_param_univ:1; // term constains parametric universe levels
+    unsigned char      m_kind:5;
+    unsigned char      m_has_mv:1;         // term contains metavariables
+    unsigned char      m_has_local:1;      // term contains local constants
+    unsigned char      m_has_param_univ:1; // term constains parametric universe levels
+    // Bloom filter for the names of the constants and local constants occurring in the term.
+    // It is only set in composite cells, see get_name_fingerprint.
+    unsigned short     m_name_fingerprint;
+    // The following two fields are saturated at LEAN_MAX_SMALL_FIELD, see get_depth and get_free_var_range.
+    unsigned           m_depth:12;
+    unsigned           m_free_var_range:12;
+    // Bloom filter for the names of the (universe) metavariables occurring in the term.
+    // Terms usually contain much fewer metavariables than constants, so it is smaller than m_name_fingerprint.
+    unsigned           m_mv_fingerprint:8;
     unsigned           m_hash;             // hash based on the structure of the expression (this is a good hash for structural equality)
-    unsigned           m_hash_alloc;       // hash based on 'time' of allocation (this is a good hash for pointer-based equality)
-    atomic_uint        m_tag;
+#if defined(LEAN_EXPR_HASH64)
+    uint64             m_hash64;           // 64-bit version of m_hash with stronger mixing, see hash64()
+#endif
     MK_LEAN_RC(); // Declare m_rc counter
     void dealloc();
 
@@ -66,17 +85,49 @@ protected:
     friend bool is_arrow(expr const & e);
 
      static void dec_ref(expr & c, buffer<expr_cell*> & todelete);
+#if defined(LEAN_EXPR_HASH64)
+    void set_hash64(uint64 h) { m_hash64 = h; }
+#else
+    void set_hash64(uint64 ) {}
+#endif
 public:
-    expr_cell(expr_kind k, unsigned h, bool has_mv, bool has_local, bool has_param_univ);
+    expr_cell(expr_kind k, unsigned h, bool has_mv, bool has_local, bool has_param_univ, unsigned d = 1, unsigned fv_range = 0);
+    // Expression cells are allocated in the memory pool
+    static void * operator new(size_t sz) { return pool_alloc(sz); }
+    static void operator delete(void * p, size_t sz) { pool_dealloc(p, sz); }
     expr_kind kind() const { return static_cast<expr_kind>(m_kind); }
     unsigned  hash() const { return m_hash; }
-    unsigned  hash_alloc() const { return m_hash_alloc; }
+    /**
+       \brief Hash code based on the memory slot used to store this cell (this is a good hash for pointer-based equality).
+       Remark: the hash code of a cell is not stored in the cell itself, it is derived from its pool slot.
+    */
+    unsigned  hash_alloc() const { return get_pool_slot(this); }
+    /**
+       \brief Return a hash code based on the structure of the expression.
+       When Lean is compiled with LEAN_EXPR_HASH64 (cmake option HASH64), it is a 64-bit hash code that also takes
+       into account the kind of each subexpression and the position of the arguments of binders and let-expressions.
+       Otherwise, it is just \c hash().
+    */
+#if defined(LEAN_EXPR_HASH64)
+    uint64    hash64() const { return m_hash64; }
+#else
+    uint64    hash64() const { return m_hash; }
+#endif
     bool has_metavar() const { return m_has_mv; }
     bool has_local() const { return m_has_local; }
     bool has_param_univ() const { return m_has_param_univ; }
+    unsigned mv_fingerprint() const { return m_mv_fingerprint; }
+    friend unsigned get_depth(expr const & e);
+    friend unsigned get_free_var_range(expr const & e);
+    friend class free_var_range_fn;
     void set_tag(tag t);
-    tag get_tag() const { return m_tag; }
+    tag get_tag() const;
+    // Auxiliary methods for reusing uniquely referenced cells, see update_app(expr && e, ...)
+    template<typename T, typename... Args> static void reinit(expr_cell * c, Args const &... args);
+    static void take_children(expr & e, buffer<expr> & r);
 };
+/** \brief Return the number of expressions that have entries in the tag side table. */
+unsigned get_num_tagged_exprs();
 
 class macro_definition;
 class expr_binder_info;
@@ -113,6 +164,7 @@ public:
     expr_kind kind() const { return m_ptr->kind(); }
     unsigned  hash() const { return m_ptr ? m_ptr->hash() : 23; }
     unsigned  hash_alloc() const { return m_ptr ? m_ptr->hash_alloc() : 23; }
+    uint64    hash64() const { return m_ptr ? m_ptr->hash64() : 23; }
     bool has_metavar() const { return m_ptr->has_metavar(); }
     bool has_local() const { return m_ptr->has_local(); }
     bool has_param_univ() const { return m_ptr->has_param_univ(); }
@@ -152,6 +204,11 @@ public:
 // Structural equality
        bool operator==(expr const & a, expr const & b);
 inline bool operator!=(expr const & a, expr const & b) { return !operator==(a, b); }
+/**
+   \brief Similar to ==, but binder names (of lambdas, pis and lets) and \c binder_info are also compared.
+   Structural equality ignores them because they are irrelevant for the kernel, but they are used by the elaborator.
+*/
+bool is_bi_equal(expr const & a, expr const & b);
 // =======================================
 
 SPECIALIZE_OPTIONAL_FOR_SMART_PTR(expr)
@@ -196,12 +253,9 @@ public:
 
 /** \brief Composite expressions */
 class expr_composite : public expr_cell {
-    unsigned m_depth;
-    unsigned m_free_var_range;
-    friend unsigned get_depth(expr const & e);
-    friend unsigned get_free_var_range(expr const & e);
 public:
     expr_composite(expr_kind k, unsigned h, bool has_mv, bool has_local, bool has_param_univ, unsigned d, unsigned fv_range);
+    unsigned name_fingerprint() const { return m_name_fingerprint; }
 };
 
 /** \brief Applications */
@@ -228,13 +282,17 @@ public:
     bool is_implicit() const { return m_implicit; }
     bool is_cast() const { return m_cast; }
 };
+inline bool operator==(expr_binder_info const & i1, expr_binder_info const & i2) {
+    return i1.is_implicit() == i2.is_implicit() && i1.is_cast() == i2.is_cast();
+}
+inline bool operator!=(expr_binder_info const & i1, expr_binder_info const & i2) { return !(i1 == i2); }
 
 /** \brief Super class for lambda and pi */
 class expr_binder : public expr_composite {
+    expr_binder_info m_info; // it is the first field to fill the padding after the header
     name             m_name;
     expr             m_domain;
     expr             m_body;
-    expr_binder_info m_info;
     friend class expr_cell;
     void dealloc(buffer<expr_cell*> & todelete);
 public:
@@ -543,6 +601,48 @@ inline bool is_constant(expr const & e, name const & n) { return is_constant(e)
 inline bool has_metavar(expr const & e) { return e.has_metavar(); }
 inline bool has_local(expr const & e) { return e.has_local(); }
 inline bool has_param_univ(expr const & e) { return e.has_param_univ(); }
+/**
+   \brief Return a number in <tt>[0, 2^log_sz)</tt> for the bloom filter bit of a name with hash code \c h.
+   The low bits of name hash codes are not well distributed (e.g., names with numeric suffixes produced by name
+   generators only use half of them), so \c h is mixed before taking the high bits.
+*/
+inline unsigned fingerprint_bit(unsigned h, unsigned log_sz) { return static_cast<unsigned>(hash64(h, 0) >> (64 - log_sz)); }
+/** \brief Return the bloom filter bit used to represent the metavariable (or universe metavariable) \c n. */
+inline unsigned mk_mv_fingerprint(name const & n) { return 1u << fingerprint_bit(n.hash(), 3); }
+/**
+   \brief Return a bloom filter for the names of the metavariables (and universe metavariables) occurring in \c e.
+   If <tt>(get_mv_fingerprint(e) & mk_mv_fingerprint(m)) == 0</tt>, then \c m does not occur in \c e.
+*/
+inline unsigned get_mv_fingerprint(expr const & e) { return e.raw()->mv_fingerprint(); }
+/** \brief Return the bloom filter bit used to represent the constant (or local constant) \c n. */
+inline unsigned mk_name_fingerprint(name const & n) { return 1u << fingerprint_bit(n.hash(), 4); }
+/**
+   \brief Return a bloom filter for the names of the constants and local constants occurring in \c e.
+   If <tt>(get_name_fingerprint(e) & mk_name_fingerprint(c)) == 0</tt>, then \c c does not occur in \c e.
+   Moreover, if \c s is a subterm of \c e, then the bits of <tt>get_name_fingerprint(s)</tt> are set in
+   <tt>get_name_fingerprint(e)</tt>.
+*/
+inline unsigned get_name_fingerprint(expr const & e) {
+    switch (e.kind()) {
+    case expr_kind::Var: case expr_kind::Sort:
+        return 0;
+    case expr_kind::Constant:
+        return mk_name_fingerprint(const_name(e));
+    case expr_kind::Meta:
+        return get_name_fingerprint(mlocal_type(e));
+    case expr_kind::Local:
+        return mk_name_fingerprint(mlocal_name(e)) | get_name_fingerprint(mlocal_type(e));
+    case expr_kind::App: case expr_kind::Lambda: case expr_kind::Pi: case expr_kind::Let: case expr_kind::Macro:
+        return static_cast<expr_composite const *>(e.raw())->name_fingerprint();
+    }
+    lean_unreachable(); // LCOV_EXCL_LINE
+}
+/** \brief Return false if \c s cannot be a subterm of \c e (based on their name fingerprints). */
+inline bool may_occur(expr const & s, expr const & e) { return (get_name_fingerprint(s) & ~get_name_fingerprint(e)) == 0; }
+/**
+   \brief Return the depth of the given expression.
+   \remark The result is saturated at LEAN_MAX_SMALL_FIELD.
+*/
 unsigned get_depth(expr const & e);
 /**
    \brief Return \c R s.t. the de Bruijn index of all free variables
@@ -573,6 +673,21 @@ typedef std::pair<expr_cell*, unsigned> expr_cell_offset;
 // Auxiliary functionals
 /** \brief Functional object for hashing kernel expressions. */
 struct expr_hash { unsigned operator()(expr const & e) const { return e.hash(); } };
+/** \brief Functional object for hashing kernel expressions using \c hash64 (see expr_cell::hash64). */
+struct expr_hash64 { size_t operator()(expr const & e) const { return e.hash64(); } };
+/** \brief Functional object for hashing kernel expressions, compatible with \c is_bi_equal (see expr_bi_eq). */
+struct expr_bi_hash64 {
+    size_t operator()(expr const & e) const {
+        if (is_binder(e))
+            return hash64(e.hash64(), (binder_name(e).hash() << 2) + (binder_info(e).is_implicit() << 1) + binder_info(e).is_cast());
+        else if (is_let(e))
+            return hash64(e.hash64(), let_name(e).hash());
+        else
+            return e.hash64();
+    }
+};
+/** \brief Functional object for comparing kernel expressions using \c is_bi_equal. */
+struct expr_bi_eq { bool operator()(expr const & e1, expr const & e2) const { return is_bi_equal(e1, e2); } };
 /**
     \brief Functional object for hashing (based on allocation time) kernel expressions.
 
@@ -612,6 +727,23 @@ expr update_mlocal(expr const & e, expr const & new_type);
 expr update_sort(expr const & e, level const & new_level);
 expr update_constant(expr const & e, levels const & new_levels);
 expr update_macro(expr const & e, unsigned num, expr const * args);
+/**
+   \brief The following update procedures reuse the cell of \c e (in place) when \c e is not shared,
+   i.e., the caller owns the only reference to it. Hash codes, flags and other cached information
+   are recomputed, and the tag of \c e is preserved.
+*/
+expr update_app(expr && e, expr const & new_fn, expr const & new_arg);
+expr update_binder(expr && e, expr const & new_domain, expr const & new_body);
+expr update_let(expr && e, expr const & new_type, expr const & new_val, expr const & new_body);
+expr update_macro(expr && e, unsigned num, expr const * args);
+/**
+   \brief Move the children of the composite expression \c e (application, binder, let or macro) to the end of \c r.
+
+   \pre !is_shared(e)
+   \remark After this call, \c e must only be destroyed or used as the first argument of
+   one of the rvalue update procedures above.
+*/
+inline void take_children(expr & e, buffer<expr> & r) { expr_cell::take_children(e, r); }
 // =======================================
 
 // =======================================
@@ -10,7 +10,7 @@ namespace lean {
 bool expr_eq_fn::apply(expr const & a, expr const & b) {
     check_system("expression equality test");
     if (is_eqp(a, b))          return true;
-    if (a.hash() != b.hash())  return false;
+    if (a.hash64() != b.hash64()) return false;
     if (a.kind() != b.kind())  return false;
     if (is_var(a))             return var_idx(a) == var_idx(b);
     if (is_shared(a) && is_shared(b)) {
@@ -37,6 +37,8 @@ bool expr_eq_fn::apply(expr const & a, expr const & b) {
             apply(app_fn(a), app_fn(b)) &&
             apply(app_arg(a), app_arg(b));
     case expr_kind::Lambda: case expr_kind::Pi:
+        if (m_compare_binders && (binder_name(a) != binder_name(b) || binder_info(a) != binder_info(b)))
+            return false;
         return
             apply(binder_domain(a), binder_domain(b)) &&
             apply(binder_body(a), binder_body(b));
@@ -51,6 +53,8 @@ bool expr_eq_fn::apply(expr const & a, expr const & b) {
         }
         return true;
     case expr_kind::Let:
+        if (m_compare_binders && let_name(a) != let_name(b))
+            return false;
         return
             apply(let_type(a), let_type(b)) &&
             apply(let_value(a), let_value(b)) &&
@@ -13,11 +13,15 @@ Author: Leonardo de Moura
 namespace lean {
 /**
    \brief Functional object for comparing expressions.
+
+   If \c compare_binders is true, then binder names and \c binder_info are also compared (see \c is_bi_equal).
 */
 class expr_eq_fn {
+    bool                                m_compare_binders;
     std::unique_ptr<expr_cell_pair_set> m_eq_visited;
     bool apply(expr const & a, expr const & b);
 public:
+    expr_eq_fn(bool compare_binders = false):m_compare_binders(compare_binders) {}
     bool operator()(expr const & a, expr const & b) { return apply(a, b); }
     void clear() { m_eq_visited.reset(); }
 };
@@ -7,6 +7,7 @@ Author: Leonardo de Moura
 #pragma once
 #include <unordered_map>
 #include <functional>
+#include <utility>
 #include "kernel/expr.h"
 
 namespace lean {
@@ -25,5 +26,53 @@ using expr_cell_offset_map = typename std::unordered_map<expr_cell_offset, T, ex
 
 // Maps based on structural equality. That is, two keys are equal iff they are structurally equal
 template<typename T>
-using expr_struct_map = typename std::unordered_map<expr, T, expr_hash, std::equal_to<expr>>;
+using expr_struct_map = typename std::unordered_map<expr, T, expr_hash64, std::equal_to<expr>>;
+
+/**
+   \brief Map based on structural equality optimized for caching.
+   Lookups are performed in two levels. The first one is based on pointer equality.
+   The second one stores the full hash code of each key, and a structural equality test
+   is only performed when the hash codes match. Keys found in the second level are added
+   to the first one.
+*/
+template<typename T>
+class expr_struct_cache {
+    typedef std::unordered_multimap<uint64, std::pair<expr, T>> struct_map;
+    expr_map<T *>  m_ptr_map;
+    struct_map     m_struct_map;
+    unsigned       m_struct_fallbacks; // number of structural equality tests performed
+public:
+    expr_struct_cache():m_struct_fallbacks(0) {}
+
+    /** \brief Return a pointer to the value associated with \c e, or nullptr if there is none. */
+    T * find(expr const & e) {
+        auto it1 = m_ptr_map.find(e);
+        if (it1 != m_ptr_map.end())
+            return it1->second;
+        auto r = m_struct_map.equal_range(e.hash64());
+        for (auto it2 = r.first; it2 != r.second; ++it2) {
+            m_struct_fallbacks++;
+            if (it2->second.first == e) {
+                m_ptr_map.insert(mk_pair(e, &(it2->second.second)));
+                return &(it2->second.second);
+            }
+        }
+        return nullptr;
+    }
+
+    /** \brief Associate \c v with \c e. Nothing is done if \c e (the pointer) is already a key. */
+    void insert(expr const & e, T const & v) {
+        if (m_ptr_map.find(e) != m_ptr_map.end())
+            return;
+        auto it = m_struct_map.insert(mk_pair(e.hash64(), mk_pair(e, v)));
+        m_ptr_map.insert(mk_pair(e, &(it->second.second)));
+    }
+
+    void clear() { m_ptr_map.clear(); m_struct_map.clear(); }
+    unsigned size() const { return m_struct_map.size(); }
+    bool empty() const { return m_struct_map.empty(); }
+    /** \brief Return the number of structural equality tests performed (i.e., lookups that could not be solved using pointer equality). */
+    unsigned get_num_struct_fallbacks() const { return m_struct_fallbacks; }
+    void reset_stats() { m_struct_fallbacks = 0; }
+};
 };
@@ -13,11 +13,14 @@ class find_fn {
     template<typename P>
     struct pred_fn {
         optional<expr> & m_result;
+        unsigned         m_fingerprint;
         P                m_p;
-        pred_fn(optional<expr> & result, P const & p):m_result(result), m_p(p) {}
+        pred_fn(optional<expr> & result, unsigned fingerprint, P const & p):m_result(result), m_fingerprint(fingerprint), m_p(p) {}
         bool operator()(expr const & e, unsigned offset) {
             if (m_result) {
                 return false; // already found result, stop the search
+            } else if ((m_fingerprint & ~get_name_fingerprint(e)) != 0) {
+                return false; // skip: e does not contain the names in m_fingerprint
             } else if (m_p(e, offset)) {
                 m_result = e;
                 return false; // stop the search
@@ -29,7 +32,8 @@ class find_fn {
     optional<expr> m_result;
     for_each_fn    m_proc;
 public:
-    template<typename P> find_fn(P const & p):m_proc(pred_fn<P>(m_result, p)) {}
+    template<typename P> find_fn(P const & p):m_proc(pred_fn<P>(m_result, 0, p)) {}
+    template<typename P> find_fn(unsigned fingerprint, P const & p):m_proc(pred_fn<P>(m_result, fingerprint, p)) {}
     optional<expr> operator()(expr const & e) { m_proc(e); return m_result; }
 };
 
@@ -39,4 +43,13 @@ public:
 template<typename P> optional<expr> find(expr const & e, P p) {
     return find_fn(p)(e);
 }
+
+/**
+   \brief Similar to the previous procedure, but only the subexpressions \c s of \c e s.t. all bits of \c fingerprint
+   are set in <tt>get_name_fingerprint(s)</tt> are considered. That is, the predicate \c p only holds for expressions
+   containing the constants (and local constants) represented by \c fingerprint (see mk_name_fingerprint).
+*/
+template<typename P> optional<expr> find(expr const & e, unsigned fingerprint, P p) {
+    return find_fn(fingerprint, p)(e);
+}
 }
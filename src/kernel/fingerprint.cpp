@@ -0,0 +1,203 @@
+/*
+Copyright (c) 2014 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+
+Author: Leonardo de Moura
+*/
+#include <unordered_map>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include "util/interrupt.h"
+#include "util/serializer.h"
+#include "kernel/fingerprint.h"
+
+namespace lean {
+/** \brief Finalizer used in SplitMix64, it is a bijection with good avalanche properties. */
+static uint64 mix64(uint64 h) {
+    h ^= h >> 30; h *= 0xbf58476d1ce4e5b9ull;
+    h ^= h >> 27; h *= 0x94d049bb133111ebull;
+    h ^= h >> 31;
+    return h;
+}
+
+void fingerprint::mix(uint64 v) {
+    // The two halves are updated using different functions
+    m_low  = mix64(m_low ^ v);
+    m_high = mix64(m_high + v * 0x9e3779b97f4a7c15ull + ((m_low << 17) | (m_low >> 47)));
+}
+
+static void mix_string(fingerprint & r, char const * s, uint64 len) {
+    r.mix(len);
+    while (len >= 8) {
+        uint64 v;
+        memcpy(&v, s, 8);
+        r.mix(v);
+        s += 8; len -= 8;
+    }
+    uint64 v = 0;
+    memcpy(&v, s, len);
+    r.mix(v);
+}
+
+static void mix_string(fingerprint & r, char const * s) {
+    mix_string(r, s, strlen(s));
+}
+
+static void mix_name(fingerprint & r, name const & n) {
+    if (n.is_anonymous()) {
+        r.mix(1);
+    } else {
+        if (n.is_atomic())
+            r.mix(4); // empty prefix
+        else
+            mix_name(r, n.get_prefix());
+        if (n.is_string()) {
+            r.mix(2);
+            mix_string(r, n.get_string());
+        } else {
+            r.mix(3);
+            r.mix(n.get_numeral());
+        }
+    }
+}
+
+fingerprint get_fingerprint(name const & n) {
+    fingerprint r;
+    mix_name(r, n);
+    return r;
+}
+
+static void mix_level(fingerprint & r, level const & l) {
+    r.mix(static_cast<uint64>(kind(l)));
+    switch (kind(l)) {
+    case level_kind::Zero:
+        break;
+    case level_kind::Succ:
+        mix_level(r, succ_of(l));
+        break;
+    case level_kind::Max:
+        mix_level(r, max_lhs(l));
+        mix_level(r, max_rhs(l));
+        break;
+    case level_kind::IMax:
+        mix_level(r, imax_lhs(l));
+        mix_level(r, imax_rhs(l));
+        break;
+    case level_kind::Param:
+        mix_name(r, param_id(l));
+        break;
+    case level_kind::Global:
+        mix_name(r, global_id(l));
+        break;
+    case level_kind::Meta:
+        mix_name(r, meta_id(l));
+        break;
+    }
+}
+
+/**
+   \brief Mix the name, trust level and data of the given macro definition.
+   We use the serialized data because \c macro_definition::hash is not a fingerprint,
+   i.e., different macro definitions with the same name may have the same hash code.
+*/
+static void mix_macro_definition(fingerprint & r, macro_definition const & m) {
+    mix_name(r, m.get_name());
+    r.mix(m.trust_level());
+    std::ostringstream out;
+    serializer s(out);
+    m.write(s);
+    std::string data = out.str();
+    mix_string(r, data.data(), data.size());
+}
+
+/** \brief Functional object for computing fingerprints. The fingerprints of shared subexpressions are cached. */
+class fingerprint_fn {
+    std::unordered_map<expr_cell *, fingerprint> m_cache;
+    name_set *                                   m_deps;
+
+    fingerprint visit(expr const & e) {
+        check_system("fingerprint");
+        bool shared = is_shared(e);
+        if (shared) {
+            auto it = m_cache.find(e.raw());
+            if (it != m_cache.end())
+                return it->second;
+        }
+        fingerprint r;
+        r.mix(static_cast<uint64>(e.kind()));
+        switch (e.kind()) {
+        case expr_kind::Var:
+            r.mix(var_idx(e));
+            break;
+        case expr_kind::Sort:
+            mix_level(r, sort_level(e));
+            break;
+        case expr_kind::Constant:
+            if (m_deps)
+                m_deps->insert(const_name(e));
+            mix_name(r, const_name(e));
+            for (level const & l : const_level_params(e))
+                mix_level(r, l);
+            break;
+        case expr_kind::Meta: case expr_kind::Local:
+            mix_name(r, mlocal_name(e));
+            r.mix(visit(mlocal_type(e)));
+            break;
+        case expr_kind::App:
+            r.mix(visit(app_fn(e)));
+            r.mix(visit(app_arg(e)));
+            break;
+        case expr_kind::Lambda: case expr_kind::Pi:
+            r.mix(binder_info(e).is_implicit());
+            r.mix(binder_info(e).is_cast());
+            r.mix(visit(binder_domain(e)));
+            r.mix(visit(binder_body(e)));
+            break;
+        case expr_kind::Let:
+            r.mix(visit(let_type(e)));
+            r.mix(visit(let_value(e)));
+            r.mix(visit(let_body(e)));
+            break;
+        case expr_kind::Macro:
+            mix_macro_definition(r, macro_def(e));
+            r.mix(macro_num_args(e));
+            for (unsigned i = 0; i < macro_num_args(e); i++)
+                r.mix(visit(macro_arg(e, i)));
+            break;
+        }
+        if (shared)
+            m_cache.insert(mk_pair(e.raw(), r));
+        return r;
+    }
+
+public:
+    fingerprint_fn(name_set * deps = nullptr):m_deps(deps) {}
+    fingerprint operator()(expr const & e) { return visit(e); }
+};
+
+fingerprint get_fingerprint(expr const & e) {
+    return fingerprint_fn()(e);
+}
+
+fingerprint get_fingerprint(definition const & d, name_set * deps) {
+    fingerprint_fn fn(deps);
+    fingerprint r;
+    mix_name(r, d.get_name());
+    r.mix(length(d.get_params()));
+    for (name const & p : d.get_params())
+        mix_name(r, p);
+    r.mix(d.is_definition());
+    r.mix(d.is_theorem());
+    r.mix(d.is_axiom());
+    r.mix(fn(d.get_type()));
+    if (d.is_definition()) {
+        r.mix(d.is_opaque());
+        r.mix(d.get_weight());
+        r.mix(d.get_module_idx());
+        r.mix(d.use_conv_opt());
+        r.mix(fn(d.get_value()));
+    }
+    return r;
+}
+}
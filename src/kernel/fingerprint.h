@@ -0,0 +1,44 @@
+/*
+Copyright (c) 2014 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+
+Author: Leonardo de Moura
+*/
+#pragma once
+#include "util/int64.h"
+#include "util/name_set.h"
+#include "kernel/expr.h"
+#include "kernel/definition.h"
+
+namespace lean {
+/**
+   \brief 128-bit structural fingerprint. Unlike \c hash_alloc, fingerprints only depend
+   on the structure of the objects. So, they are stable across executions and processes.
+*/
+struct fingerprint {
+    uint64 m_low;
+    uint64 m_high;
+    fingerprint(uint64 low = 0, uint64 high = 0):m_low(low), m_high(high) {}
+    /** \brief Update this fingerprint with the given value (the result depends on the order of the updates). */
+    void mix(uint64 v);
+    void mix(fingerprint const & f) { mix(f.m_low); mix(f.m_high); }
+    unsigned hash() const { return static_cast<unsigned>(m_low); }
+    friend bool operator==(fingerprint const & f1, fingerprint const & f2) { return f1.m_low == f2.m_low && f1.m_high == f2.m_high; }
+    friend bool operator!=(fingerprint const & f1, fingerprint const & f2) { return !(f1 == f2); }
+};
+
+struct fingerprint_hash { unsigned operator()(fingerprint const & f) const { return f.hash(); } };
+
+/** \brief Return the fingerprint of the given name. */
+fingerprint get_fingerprint(name const & n);
+/**
+   \brief Return the fingerprint of the given expression. The names of bound variables are ignored.
+   Macros are identified by their name, trust level and serialized data (see \c macro_definition::write).
+*/
+fingerprint get_fingerprint(expr const & e);
+/**
+   \brief Return the fingerprint of the given definition. It covers the name, universe parameters, type, value and flags.
+   If \c deps is not nullptr, then the constants occurring in the type and value are stored in it.
+*/
+fingerprint get_fingerprint(definition const & d, name_set * deps = nullptr);
+}
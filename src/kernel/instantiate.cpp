@@ -6,39 +6,110 @@ Author: Leonardo de Moura
 */
 #include <algorithm>
 #include <limits>
+#include <utility>
+#include <unordered_map>
+#include "util/int64.h"
+#include "util/buffer.h"
 #include "kernel/free_vars.h"
 #include "kernel/replace_fn.h"
 #include "kernel/instantiate.h"
 
 namespace lean {
-expr instantiate(expr const & a, unsigned s, unsigned n, expr const * subst) {
-    if (s >= get_free_var_range(a) || n == 0)
-        return a;
-    return replace(a, [=](expr const & m, unsigned offset) -> optional<expr> {
-            unsigned s1 = s + offset;
-            if (s1 < s)
-                return some_expr(m); // overflow, vidx can't be >= max unsigned
-            if (s1 >= get_free_var_range(m))
-                return some_expr(m); // expression m does not contain free variables with idx >= s1
-            if (is_var(m)) {
-                unsigned vidx = var_idx(m);
-                if (vidx >= s1) {
-                    unsigned h = s1 + n;
-                    if (h < s1 /* overflow, h is bigger than any vidx */ || vidx < h) {
-                        return some_expr(lift_free_vars(subst[vidx - s1], offset));
-                    } else {
-                        return some_expr(mk_var(vidx - n));
-                    }
+/**
+   \brief Functional object for replacing the free variables with indices s, ..., s+n-1 with
+   subst[0], ..., subst[n-1] (or subst[n-1], ..., subst[0] when \c rev is true).
+
+   A substitution term that replaces a free variable under \c k binders must be lifted by \c k.
+   The lifted copies are cached by (substitution index, k), since the same variable usually occurs
+   many times at the same binder depth. Closed substitution terms are never lifted.
+
+   When \c beta is true, the applications whose head is an instantiated free variable are beta reduced
+   when the substitution term is a lambda. That is, no intermediate beta-redex is created.
+*/
+class instantiate_fn {
+    unsigned                          m_s;
+    unsigned                          m_n;
+    expr const *                      m_subst;
+    bool                              m_rev;
+    bool                              m_beta;
+    std::unordered_map<uint64, expr>  m_lifted;
+
+    expr const & get_subst(unsigned i) const { return m_rev ? m_subst[m_n - i - 1] : m_subst[i]; }
+
+    /** \brief Return lift_free_vars(get_subst(i), offset) */
+    expr lift(unsigned i, unsigned offset) {
+        expr const & s = get_subst(i);
+        if (offset == 0 || closed(s))
+            return s;
+        uint64 key = (static_cast<uint64>(i) << 32) | offset;
+        auto it = m_lifted.find(key);
+        if (it != m_lifted.end())
+            return it->second;
+        expr r = lift_free_vars(s, offset);
+        m_lifted.insert(mk_pair(key, r));
+        return r;
+    }
+
+    /** \brief Return true iff the free variable with index \c vidx is instantiated at the given \c offset. */
+    bool is_instantiated(unsigned vidx, unsigned offset) const {
+        unsigned s1 = m_s + offset;
+        unsigned h  = s1 + m_n;
+        return vidx >= s1 && (h < s1 /* overflow, h is bigger than any vidx */ || vidx < h);
+    }
+
+    optional<expr> visit(expr const & m, unsigned offset) {
+        unsigned s1 = m_s + offset;
+        if (s1 < m_s)
+            return some_expr(m); // overflow, vidx can't be >= max unsigned
+        if (s1 >= get_free_var_range(m))
+            return some_expr(m); // expression m does not contain free variables with idx >= s1
+        if (is_var(m)) {
+            unsigned vidx = var_idx(m);
+            if (vidx >= s1) {
+                if (is_instantiated(vidx, offset))
+                    return some_expr(lift(vidx - s1, offset));
+                else
+                    return some_expr(mk_var(vidx - m_n));
+            }
+        } else if (m_beta && is_app(m)) {
+            expr const * it = &m;
+            while (is_app(*it))
+                it = &app_fn(*it);
+            if (is_var(*it) && is_instantiated(var_idx(*it), offset) && is_lambda(get_subst(var_idx(*it) - s1))) {
+                expr new_f = lift(var_idx(*it) - s1, offset);
+                buffer<expr> new_rev_args;
+                it = &m;
+                while (is_app(*it)) {
+                    new_rev_args.push_back(apply(app_arg(*it), offset));
+                    it = &app_fn(*it);
                 }
+                return some_expr(apply_beta(new_f, new_rev_args.size(), new_rev_args.data()));
             }
-            return none_expr();
-        });
-}
+        }
+        return none_expr();
+    }
+
+public:
+    instantiate_fn(unsigned s, unsigned n, expr const * subst, bool rev, bool beta):
+        m_s(s), m_n(n), m_subst(subst), m_rev(rev), m_beta(beta) {}
+
+    /** \brief Instantiate \c e, where \c offset is the number of binders enclosing \c e. */
+    template<typename E> expr apply(E && e, unsigned offset) {
+        if (m_n == 0 || m_s + offset >= get_free_var_range(e))
+            return std::forward<E>(e);
+        return replace(std::forward<E>(e), [&](expr const & m, unsigned o) { return visit(m, offset + o); });
+    }
+};
 
+expr instantiate(expr const & a, unsigned s, unsigned n, expr const * subst) { return instantiate_fn(s, n, subst, false, false).apply(a, 0); }
 expr instantiate(expr const & e, unsigned n, expr const * s) { return instantiate(e, 0, n, s); }
+expr instantiate(expr && e, unsigned n, expr const * s) { return instantiate_fn(0, n, s, false, false).apply(std::move(e), 0); }
+expr instantiate(expr && e, expr const & s) { return instantiate_fn(0, 1, &s, false, false).apply(std::move(e), 0); }
 expr instantiate(expr const & e, std::initializer_list<expr> const & l) {  return instantiate(e, l.size(), l.begin()); }
 expr instantiate(expr const & e, unsigned i, expr const & s) { return instantiate(e, i, 1, &s); }
 expr instantiate(expr const & e, expr const & s) { return instantiate(e, 0, s); }
+expr instantiate_rev(expr const & a, unsigned n, expr const * subst) { return instantiate_fn(0, n, subst, true, false).apply(a, 0); }
+expr instantiate_beta(expr const & e, unsigned n, expr const * s) { return instantiate_fn(0, n, s, false, true).apply(e, 0); }
 
 bool is_head_beta(expr const & t) {
     expr const * it = &t;
@@ -17,7 +17,27 @@ expr instantiate(expr const & e, std::initializer_list<expr> const & l);
 expr instantiate(expr const & e, unsigned i, expr const & s);
 /** \brief Replace free variable \c 0 with \c s in \c e. */
 expr instantiate(expr const & e, expr const & s);
+/**
+   \brief Replace the free variables with indices 0, ..., n-1 with s[n-1], ..., s[0] in e.
+   That is, s is a telescope of local constants, where s[n-1] is the innermost one.
+*/
+expr instantiate_rev(expr const & e, unsigned n, expr const * s);
+/**
+   \brief Similar to the previous procedures, but the cells of \c e that are not shared are reused.
+   \see replace_fn
+*/
+expr instantiate(expr && e, unsigned n, expr const * s);
+expr instantiate(expr && e, expr const & s);
 
+/**
+   \brief Similar to instantiate, but the applications (x a_1 ... a_k) occurring anywhere in \c e, where x is one of
+   the instantiated free variables and s[i] is a lambda, are beta reduced. That is, the instantiation and beta
+   reduction steps are performed simultaneously, and no intermediate beta-redex is created.
+
+   \remark The result is usually more reduced than the one produced by \c instantiate followed by \c head_beta_reduce.
+*/
+expr instantiate_beta(expr const & e, unsigned n, expr const * s);
+/** \brief Head beta reduce (f args[num_args-1] ... args[0]). */
 expr apply_beta(expr f, unsigned num_args, expr const * args);
 bool is_head_beta(expr const & t);
 expr head_beta_reduce(expr const & t);
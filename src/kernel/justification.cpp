@@ -5,6 +5,9 @@ Released under Apache 2.0 license as described in the file LICENSE.
 Author: Leonardo de Moura
 */
 #include <vector>
+#include <unordered_set>
+#include "util/thread.h"
+#include "util/hash.h"
 #include "util/buffer.h"
 #include "util/int64.h"
 #include "kernel/justification.h"
@@ -26,10 +29,13 @@ static approx_set mk_union(approx_set s1, approx_set s2) { return s1 | s2; }
 static approx_set mk_intersection(approx_set s1, approx_set s2) { return s1 & s2; }
 static approx_set mk_singleton(unsigned i) { return static_cast<uint64>(1) << (i % 64); }
 static approx_set may_contain(approx_set s, unsigned i) { return mk_intersection(s, mk_singleton(i)) != 0ull; }
+/** \brief The approximated set is exact when all assumptions have an index smaller than this bound. */
+static constexpr unsigned g_exact_bound = 64;
 
 enum class justification_kind { Asserted, Composite, ExtComposite, Assumption, ExtAssumption };
 
 approx_set get_approx_assumption_set(justification const & j);
+bool is_exact_assumption_set(justification const & j);
 
 struct justification_cell {
     MK_LEAN_RC();
@@ -53,12 +59,14 @@ struct asserted_cell : public justification_cell {
 
 struct composite_cell : public justification_cell {
     approx_set    m_assumption_set; // approximated set of assumptions contained in child1 and child2
+    bool          m_exact;          // true iff m_assumption_set is exact (i.e., all assumption indices are < g_exact_bound)
     justification m_child[2];
     composite_cell(justification_kind k, justification const & j1, justification const & j2):
         justification_cell(k) {
         m_child[0] = j1;
         m_child[1] = j2;
         m_assumption_set = mk_union(get_approx_assumption_set(j1), get_approx_assumption_set(j2));
+        m_exact          = is_exact_assumption_set(j1) && is_exact_assumption_set(j2);
     }
     composite_cell(justification const & j1, justification const & j2):
         composite_cell(justification_kind::Composite, j1, j2) {}
@@ -111,6 +119,21 @@ approx_set get_approx_assumption_set(justification const & j) {
     lean_unreachable(); // LCOV_EXCL_LINE
 }
 
+bool is_exact_assumption_set(justification const & j) {
+    justification_cell * it = j.raw();
+    if (!it)
+        return true;
+    switch (it->m_kind) {
+    case justification_kind::Asserted:
+        return true;
+    case justification_kind::Assumption: case justification_kind::ExtAssumption:
+        return to_assumption(it)->m_idx < g_exact_bound;
+    case justification_kind::Composite: case justification_kind::ExtComposite:
+        return to_composite(it)->m_exact;
+    }
+    lean_unreachable(); // LCOV_EXCL_LINE
+}
+
 void justification_cell::dealloc() {
     switch (m_kind) {
     case justification_kind::Asserted:         delete to_asserted(this); break;
@@ -121,10 +144,29 @@ void justification_cell::dealloc() {
     }
 }
 
-bool depends_on(justification const & j, unsigned i) {
-    if (!may_contain(get_approx_assumption_set(j), i))
+/**
+   \brief Return true if the approximated assumption set of \c j is enough to decide whether
+   \c j depends on \c i or not. The result is stored in \c r.
+*/
+static bool depends_on_approx(justification const & j, unsigned i, bool & r) {
+    if (!may_contain(get_approx_assumption_set(j), i)) {
+        r = false;
+        return true;
+    } else if (is_exact_assumption_set(j)) {
+        r = i < g_exact_bound;
+        return true;
+    } else {
         return false;
-    buffer<justification_cell *>   todo;
+    }
+}
+
+bool depends_on(justification const & j, unsigned i) {
+    bool r;
+    if (depends_on_approx(j, i, r))
+        return r;
+    // Remark: the justification is a DAG, we use \c visited to make sure shared subterms are visited only once.
+    std::unordered_set<justification_cell *> visited;
+    buffer<justification_cell *>              todo;
     todo.push_back(j.raw());
     while (!todo.empty()) {
         justification_cell * curr = todo.back();
@@ -138,9 +180,13 @@ bool depends_on(justification const & j, unsigned i) {
             break;
         case justification_kind::Composite: case justification_kind::ExtComposite:
             for (unsigned k = 0; k < 2; k++) {
-                justification c = to_composite(curr)->m_child[k];
-                if (may_contain(get_approx_assumption_set(c), i))
+                justification const & c = to_composite(curr)->m_child[k];
+                if (depends_on_approx(c, i, r)) {
+                    if (r)
+                        return true;
+                } else if (visited.insert(c.raw()).second) {
                     todo.push_back(c.raw());
+                }
             }
         }
     }
@@ -221,12 +267,65 @@ justification mk_composite(justification const & j1, justification const & j2, o
         return j1;
     return justification(new ext_composite_cell(j1, j2, fn, s));
 }
+#ifndef LEAN_COMPOSITE_JST_CACHE_SIZE
+#define LEAN_COMPOSITE_JST_CACHE_SIZE 1024
+#endif
+
+/**
+   \brief Hash-consing table for (non-extended) composite justifications.
+   It is a direct mapped cache indexed by the address of the children, and it is only
+   available while a \c scoped_composite_justification_cache object is alive.
+   Remark: the entries keep the children alive, so the addresses cannot be reused
+   while they are in the cache.
+*/
+static LEAN_THREAD_LOCAL std::vector<justification> * g_composite_cache = nullptr;
+
+scoped_composite_justification_cache::scoped_composite_justification_cache():m_owner(g_composite_cache == nullptr) {
+    if (m_owner)
+        g_composite_cache = new std::vector<justification>();
+}
+
+scoped_composite_justification_cache::~scoped_composite_justification_cache() {
+    if (m_owner) {
+        delete g_composite_cache;
+        g_composite_cache = nullptr;
+    }
+}
+
+static justification * get_composite_cache() {
+    if (!g_composite_cache)
+        return nullptr;
+    if (g_composite_cache->empty())
+        g_composite_cache->resize(LEAN_COMPOSITE_JST_CACHE_SIZE);
+    return g_composite_cache->data();
+}
+
+static unsigned composite_cache_idx(justification const & j1, justification const & j2) {
+    unsigned h1 = static_cast<unsigned>(reinterpret_cast<size_t>(j1.raw()) >> 3);
+    unsigned h2 = static_cast<unsigned>(reinterpret_cast<size_t>(j2.raw()) >> 3);
+    return hash(h1, h2) % LEAN_COMPOSITE_JST_CACHE_SIZE;
+}
+
 justification mk_composite1(justification const & j1, justification const & j2) {
     if (j1.is_none())
         return j2;
     if (j2.is_none())
         return j1;
-    return justification(new composite_cell(j1, j2));
+    if (is_eqp(j1, j2))
+        return j1;
+    if (j1.is_composite() && (is_eqp(composite_child1(j1), j2) || is_eqp(composite_child2(j1), j2))) {
+        // j2 is already part of j1, and the new justification would be printed using j1.
+        return j1;
+    }
+    justification * cache = get_composite_cache();
+    if (!cache)
+        return justification(new composite_cell(j1, j2));
+    justification & entry = cache[composite_cache_idx(j1, j2)];
+    if (entry.is_composite() && !to_composite(entry.raw())->is_ext_composite() &&
+        is_eqp(composite_child1(entry), j1) && is_eqp(composite_child2(entry), j2))
+        return entry;
+    entry = justification(new composite_cell(j1, j2));
+    return entry;
 }
 justification mk_assumption_justification(unsigned idx, optional<expr> const & s, pp_jst_fn const & fn) {
     return justification(new ext_assumption_cell(idx, fn, s));
@@ -94,6 +94,17 @@ justification mk_composite(justification const & j1, justification const & j2, o
    resulting justification into a format object.
 */
 justification mk_composite1(justification const & j1, justification const & j2);
+/**
+   \brief While this object is alive, \c mk_composite1 reuses the composite justifications it has created
+   in the current thread for the same children. Nested objects share the table of the outermost one,
+   and the table (and the justifications it references) is released when the outermost object is destructed.
+*/
+class scoped_composite_justification_cache {
+    bool m_owner;
+public:
+    scoped_composite_justification_cache();
+    ~scoped_composite_justification_cache();
+};
 /**
    \brief Alias for \c mk_composite1
 */
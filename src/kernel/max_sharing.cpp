@@ -7,9 +7,13 @@ Author: Leonardo de Moura
 #include <tuple>
 #include <unordered_set>
 #include <functional>
+#include <vector>
 #include "util/buffer.h"
+#include "util/list_fn.h"
 #include "util/interrupt.h"
+#include "util/parallel_for.h"
 #include "kernel/max_sharing.h"
+#include "kernel/expr_maps.h"
 
 namespace lean {
 /**
@@ -17,7 +21,7 @@ namespace lean {
    shared sub-expressions.
 */
 struct max_sharing_fn::imp {
-    typedef typename std::unordered_set<expr, expr_hash, std::equal_to<expr>> expr_cache;
+    typedef typename std::unordered_set<expr, expr_hash64, std::equal_to<expr>> expr_cache;
 
     expr_cache m_cache;
 
@@ -47,7 +51,7 @@ struct max_sharing_fn::imp {
         case expr_kind::Macro: {
             buffer<expr> new_args;
             for (unsigned i = 0; i < macro_num_args(a); i++)
-                new_args.push_back(macro_arg(a, i));
+                new_args.push_back(apply(macro_arg(a, i)));
             res = update_macro(a, new_args.size(), new_args.data());
             break;
         }}
@@ -72,4 +76,224 @@ bool max_sharing_fn::already_processed(expr const & a) const { return m_ptr->alr
 expr max_sharing(expr const & a) {
     return max_sharing_fn::imp()(a);
 }
+
+size_t get_cell_size(expr const & e) {
+    switch (e.kind()) {
+    case expr_kind::Var:      return sizeof(expr_var);
+    case expr_kind::Constant: return sizeof(expr_const);
+    case expr_kind::Sort:     return sizeof(expr_sort);
+    case expr_kind::App:      return sizeof(expr_app);
+    case expr_kind::Lambda: case expr_kind::Pi:
+        return sizeof(expr_binder);
+    case expr_kind::Let:      return sizeof(expr_let);
+    case expr_kind::Meta: case expr_kind::Local:
+        return sizeof(expr_mlocal);
+    case expr_kind::Macro:    return sizeof(expr_macro) + macro_num_args(e) * sizeof(expr);
+    }
+    lean_unreachable(); // LCOV_EXCL_LINE
+}
+
+unsigned get_num_cells(unsigned num, expr const * es, size_t * size) {
+    // Remark: cells that are not shared are reachable from only one parent, so we only need to track the shared ones.
+    std::unordered_set<expr_cell const *> visited;
+    buffer<expr const *> todo;
+    unsigned r = 0;
+    size_t   sz = 0;
+    auto visit = [&](expr const & e) {
+        if (is_shared(e) && !visited.insert(e.raw()).second)
+            return;
+        r++;
+        if (size)
+            sz += get_cell_size(e);
+        todo.push_back(&e);
+    };
+    for (unsigned i = 0; i < num; i++)
+        visit(es[i]);
+    while (!todo.empty()) {
+        expr const & e = *todo.back();
+        todo.pop_back();
+        switch (e.kind()) {
+        case expr_kind::Constant: case expr_kind::Var: case expr_kind::Sort:
+            break;
+        case expr_kind::App:
+            visit(app_fn(e)); visit(app_arg(e));
+            break;
+        case expr_kind::Lambda: case expr_kind::Pi:
+            visit(binder_domain(e)); visit(binder_body(e));
+            break;
+        case expr_kind::Let:
+            visit(let_type(e)); visit(let_value(e)); visit(let_body(e));
+            break;
+        case expr_kind::Meta: case expr_kind::Local:
+            visit(mlocal_type(e));
+            break;
+        case expr_kind::Macro:
+            for (unsigned i = 0; i < macro_num_args(e); i++)
+                visit(macro_arg(e, i));
+            break;
+        }
+    }
+    if (size)
+        *size = sz;
+    return r;
+}
+
+/**
+   \brief Thread safe hash set. It is split in buckets protected by different mutexes to reduce contention.
+*/
+template<typename T, typename Hash, typename Eq>
+class striped_set {
+    static constexpr unsigned num_buckets = 64;
+    struct bucket {
+        mutex                             m_mutex;
+        std::unordered_set<T, Hash, Eq>   m_set;
+    };
+    bucket m_buckets[num_buckets]; // NOLINT
+    bucket & get_bucket(T const & v) { return m_buckets[Hash()(v) % num_buckets]; }
+public:
+    optional<T> find(T const & v) {
+        bucket & b = get_bucket(v);
+        lock_guard<mutex> lock(b.m_mutex);
+        auto it = b.m_set.find(v);
+        return it == b.m_set.end() ? optional<T>() : optional<T>(*it);
+    }
+    /** \brief Return the element in the set that is equal to \c v, and insert \c v if there is none. */
+    T insert(T const & v) {
+        bucket & b = get_bucket(v);
+        lock_guard<mutex> lock(b.m_mutex);
+        return *(b.m_set.insert(v).first);
+    }
+    unsigned size() {
+        unsigned r = 0;
+        for (bucket & b : m_buckets) {
+            lock_guard<mutex> lock(b.m_mutex);
+            r += b.m_set.size();
+        }
+        return r;
+    }
+};
+
+struct level_hash { unsigned operator()(level const & l) const { return l.hash(); } };
+struct level_eq { bool operator()(level const & l1, level const & l2) const { return l1 == l2; } };
+
+struct sharing_table::imp {
+    striped_set<expr, expr_bi_hash64, expr_bi_eq> m_exprs;
+    striped_set<name, name_hash, name_eq>         m_names;
+    striped_set<level, level_hash, level_eq>      m_levels;
+};
+
+sharing_table::sharing_table():m_ptr(new imp) {}
+sharing_table::~sharing_table() {}
+name sharing_table::share(name const & n) { return m_ptr->m_names.insert(n); }
+level sharing_table::share(level const & l) { return m_ptr->m_levels.insert(l); }
+levels sharing_table::share(levels const & ls) {
+    return map_reuse(ls, [&](level const & l) { return share(l); }, [](level const & l1, level const & l2) { return is_eqp(l1, l2); });
+}
+unsigned sharing_table::get_num_exprs() const { return m_ptr->m_exprs.size(); }
+unsigned sharing_table::get_num_names() const { return m_ptr->m_names.size(); }
+unsigned sharing_table::get_num_levels() const { return m_ptr->m_levels.size(); }
+
+/**
+   \brief Functional object used by each thread in the batch version of \c max_sharing.
+   The cache maps the shared cells already visited by this thread to their maximally shared version,
+   it avoids the structural lookups in the table for sub-expressions that are pointer equal.
+*/
+class max_sharing_batch_fn {
+    sharing_table &     m_table;
+    expr_cell_map<expr> m_cache;
+
+    /** \brief Store in \c new_n the shared version of \c n, and return true iff it is \c n itself. */
+    bool is_canonical(name const & n, name & new_n) {
+        new_n = m_table.share(n);
+        return name::ptr_eq()(n, new_n);
+    }
+
+    expr apply(expr const & a) {
+        check_system("max_sharing");
+        bool sh = false;
+        if (is_shared(a)) {
+            auto r = m_cache.find(a.raw());
+            if (r != m_cache.end())
+                return r->second;
+            sh = true;
+        }
+        if (auto r = m_table.m_ptr->m_exprs.find(a)) {
+            if (sh)
+                m_cache.insert(std::make_pair(a.raw(), *r));
+            return *r;
+        }
+        expr res;
+        name new_n;
+        switch (a.kind()) {
+        case expr_kind::Var:
+            res = a;
+            break;
+        case expr_kind::Constant:
+            if (is_canonical(const_name(a), new_n))
+                res = update_constant(a, m_table.share(const_level_params(a)));
+            else
+                res = mk_constant(new_n, m_table.share(const_level_params(a)));
+            break;
+        case expr_kind::Sort:
+            res = update_sort(a, m_table.share(sort_level(a)));
+            break;
+        case expr_kind::App:
+            res = update_app(a, apply(app_fn(a)), apply(app_arg(a)));
+            break;
+        case expr_kind::Lambda: case expr_kind::Pi:
+            if (is_canonical(binder_name(a), new_n))
+                res = update_binder(a, apply(binder_domain(a)), apply(binder_body(a)));
+            else
+                res = mk_binder(a.kind(), new_n, apply(binder_domain(a)), apply(binder_body(a)), binder_info(a));
+            break;
+        case expr_kind::Let:
+            if (is_canonical(let_name(a), new_n))
+                res = update_let(a, apply(let_type(a)), apply(let_value(a)), apply(let_body(a)));
+            else
+                res = mk_let(new_n, apply(let_type(a)), apply(let_value(a)), apply(let_body(a)));
+            break;
+        case expr_kind::Meta:
+            if (is_canonical(mlocal_name(a), new_n))
+                res = update_mlocal(a, apply(mlocal_type(a)));
+            else
+                res = mk_metavar(new_n, apply(mlocal_type(a)));
+            break;
+        case expr_kind::Local:
+            if (is_canonical(mlocal_name(a), new_n))
+                res = update_mlocal(a, apply(mlocal_type(a)));
+            else
+                res = mk_local(new_n, apply(mlocal_type(a)));
+            break;
+        case expr_kind::Macro: {
+            buffer<expr> new_args;
+            for (unsigned i = 0; i < macro_num_args(a); i++)
+                new_args.push_back(apply(macro_arg(a, i)));
+            res = update_macro(a, new_args.size(), new_args.data());
+            break;
+        }}
+        res = m_table.m_ptr->m_exprs.insert(res);
+        if (sh)
+            m_cache.insert(std::make_pair(a.raw(), res));
+        return res;
+    }
+public:
+    max_sharing_batch_fn(sharing_table & t):m_table(t) {}
+    expr operator()(expr const & a) { return apply(a); }
+};
+
+sharing_stats max_sharing(sharing_table & t, unsigned num, expr const * es, buffer<expr> & r, unsigned num_threads) {
+    sharing_stats stats;
+    stats.m_num_cells_before = get_num_cells(num, es, &stats.m_size_before);
+    std::vector<max_sharing_batch_fn> fns(get_parallel_for_num_threads(num, num_threads), max_sharing_batch_fn(t));
+    r.clear();
+    r.resize(num);
+    parallel_for(num, num_threads, [&](unsigned i, unsigned w) { r[i] = fns[w](es[i]); });
+    stats.m_num_cells_after = get_num_cells(num, r.data(), &stats.m_size_after);
+    return stats;
+}
+
+sharing_stats max_sharing(unsigned num, expr const * es, buffer<expr> & r, unsigned num_threads) {
+    sharing_table t;
+    return max_sharing(t, num, es, r, num_threads);
+}
 }
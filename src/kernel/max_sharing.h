@@ -6,6 +6,7 @@ Author: Leonardo de Moura
 */
 #pragma once
 #include <memory>
+#include "util/buffer.h"
 #include "kernel/expr.h"
 
 namespace lean {
@@ -35,4 +36,59 @@ public:
    it uses maximally shared sub-expressions.
 */
 expr max_sharing(expr const & a);
+
+/** \brief Return the amount of memory (in bytes) used by the cell of \c e, without its sub-expressions. */
+size_t get_cell_size(expr const & e);
+
+/**
+   \brief Return the number of distinct cells (aka nodes) used to represent <tt>es[0], ..., es[num-1]</tt>.
+   If \c size is not nullptr, then the amount of memory (in bytes) used by these cells is stored in it.
+*/
+unsigned get_num_cells(unsigned num, expr const * es, size_t * size = nullptr);
+
+/** \brief Number of cells (and memory) used to represent a vector of expressions before and after a batch operation. */
+struct sharing_stats {
+    unsigned m_num_cells_before;
+    unsigned m_num_cells_after;
+    size_t   m_size_before;
+    size_t   m_size_after;
+    sharing_stats():m_num_cells_before(0), m_num_cells_after(0), m_size_before(0), m_size_after(0) {}
+};
+
+/**
+   \brief Thread safe table of maximally shared expressions used by the batch version of \c max_sharing.
+   The names and universe levels occurring in the expressions are also shared.
+
+   The same table can be used in several batches, then the results of all of them share their sub-expressions.
+*/
+class sharing_table {
+    struct imp;
+    friend class max_sharing_batch_fn;
+    std::unique_ptr<imp> m_ptr;
+public:
+    sharing_table();
+    ~sharing_table();
+
+    /** \brief Return a name equal to \c n, it is pointer equal to the equal names previously shared by this table. */
+    name share(name const & n);
+    /** \brief Return a level equal to \c l, it is pointer equal to the equal levels previously shared by this table. */
+    level share(level const & l);
+    levels share(levels const & ls);
+
+    unsigned get_num_exprs() const;
+    unsigned get_num_names() const;
+    unsigned get_num_levels() const;
+};
+
+/**
+   \brief Batch version of \c max_sharing. Store in \c r the expressions <tt>es[0], ..., es[num-1]</tt> using
+   maximally shared sub-expressions (and names and levels). Identical sub-expressions of different roots are also shared.
+   Unlike \c max_sharing, sub-expressions are only identical when they also have the same binder names and
+   \c binder_info (see \c is_bi_equal), so <tt>is_bi_equal(r[i], es[i])</tt>.
+
+   The roots are distributed over \c num_threads threads (0 means one per hardware thread) that
+   share the table \c t containing the sub-expressions processed so far.
+*/
+sharing_stats max_sharing(sharing_table & t, unsigned num, expr const * es, buffer<expr> & r, unsigned num_threads = 0);
+sharing_stats max_sharing(unsigned num, expr const * es, buffer<expr> & r, unsigned num_threads = 0);
 }
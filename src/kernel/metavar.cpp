@@ -5,19 +5,102 @@ Released under Apache 2.0 license as described in the file LICENSE.
 Author: Leonardo de Moura
 */
 #include <utility>
+#include "util/thread.h"
 #include "kernel/metavar.h"
 #include "kernel/free_vars.h"
 #include "kernel/replace_visitor.h"
 #include "kernel/justification.h"
 #include "kernel/instantiate.h"
-#include "kernel/find_fn.h"
+#include "kernel/for_each_fn.h"
 #include "kernel/level.h"
+#include "kernel/expr_maps.h"
+
+#ifndef LEAN_INSTANTIATE_METAVARS_CACHE_CAPACITY
+#define LEAN_INSTANTIATE_METAVARS_CACHE_CAPACITY 1024*8
+#endif
 
 namespace lean {
-substitution::substitution(expr_map const & em, level_map const & lm):
-    m_expr_subst(em), m_level_subst(lm) {}
+/**
+   \brief Cache for \c instantiate_metavars and \c instantiate_metavars_wo_jst.
+   The keys are compared using pointer equality. The cache is discarded
+   whenever a new assignment is performed. The assignments performed by
+   the \c d_assign methods only compress the substitution, so they do not
+   affect the result of \c instantiate_metavars.
+*/
+struct substitution::cache {
+    mutex                                                    m_mutex;
+    ::lean::expr_map<std::pair<expr, justification>>        m_jst_cache;
+    ::lean::expr_map<expr>                                   m_cache;
+
+    template<typename T>
+    static optional<T> find(::lean::expr_map<T> const & c, expr const & e) {
+        auto it = c.find(e);
+        if (it != c.end())
+            return optional<T>(it->second);
+        else
+            return optional<T>();
+    }
+
+    template<typename T>
+    static void insert(::lean::expr_map<T> & c, expr const & e, T const & v) {
+        if (c.size() >= LEAN_INSTANTIATE_METAVARS_CACHE_CAPACITY)
+            c.clear();
+        c.insert(mk_pair(e, v));
+    }
+
+    optional<std::pair<expr, justification>> find_jst(expr const & e) {
+        lock_guard<mutex> lock(m_mutex);
+        return find(m_jst_cache, e);
+    }
+
+    void insert_jst(expr const & e, std::pair<expr, justification> const & v) {
+        lock_guard<mutex> lock(m_mutex);
+        insert(m_jst_cache, e, v);
+    }
+
+    optional<expr> find_wo_jst(expr const & e) {
+        lock_guard<mutex> lock(m_mutex);
+        return find(m_cache, e);
+    }
+
+    void insert_wo_jst(expr const & e, expr const & v) {
+        lock_guard<mutex> lock(m_mutex);
+        insert(m_cache, e, v);
+    }
+};
+
+substitution::substitution(expr_map const & em, level_map const & lm, unsigned fingerprint):
+    m_expr_subst(em), m_level_subst(lm), m_fingerprint(fingerprint) {}
 
-substitution::substitution() {}
+substitution::substitution():m_fingerprint(0) {}
+
+// The cache may be created concurrently by const methods, so m_cache is only accessed using the atomic operations.
+substitution::substitution(substitution const & s):
+    m_expr_subst(s.m_expr_subst), m_level_subst(s.m_level_subst), m_fingerprint(s.m_fingerprint),
+    m_cache(std::atomic_load(&s.m_cache)) {}
+
+substitution & substitution::operator=(substitution const & s) {
+    m_expr_subst  = s.m_expr_subst;
+    m_level_subst = s.m_level_subst;
+    m_fingerprint = s.m_fingerprint;
+    std::atomic_store(&m_cache, std::atomic_load(&s.m_cache));
+    return *this;
+}
+
+std::shared_ptr<substitution::cache> substitution::get_cache() const {
+    std::shared_ptr<cache> c = std::atomic_load(&m_cache);
+    if (!c) {
+        std::shared_ptr<cache> new_c = std::make_shared<cache>();
+        // if another thread created the cache first, then c is set to it
+        if (std::atomic_compare_exchange_strong(&m_cache, &c, new_c))
+            c = new_c;
+    }
+    return c;
+}
+
+bool substitution::may_contain_assigned(expr const & e) const {
+    return has_metavar(e) && (get_mv_fingerprint(e) & m_fingerprint) != 0;
+}
 
 bool substitution::is_expr_assigned(name const & m) const {
     return m_expr_subst.contains(m);
@@ -62,6 +145,7 @@ optional<level> substitution::get_level(name const & m) const {
 void substitution::d_assign(name const & m, expr const & t, justification const & j) {
     lean_assert(closed(t));
     m_expr_subst.insert(m, mk_pair(t, j));
+    m_fingerprint |= mk_mv_fingerprint(m);
 }
 
 void substitution::d_assign(name const & m, expr const & t) {
@@ -70,6 +154,7 @@ void substitution::d_assign(name const & m, expr const & t) {
 
 void substitution::d_assign(name const & m, level const & l, justification const & j) {
     m_level_subst.insert(m, mk_pair(l, j));
+    m_fingerprint |= mk_mv_fingerprint(m);
 }
 
 void substitution::d_assign(name const & m, level const & l) {
@@ -78,7 +163,7 @@ void substitution::d_assign(name const & m, level const & l) {
 
 substitution substitution::assign(name const & m, expr const & t, justification const & j) const {
     lean_assert(closed(t));
-    return substitution(insert(m_expr_subst, m, mk_pair(t, j)), m_level_subst);
+    return substitution(insert(m_expr_subst, m, mk_pair(t, j)), m_level_subst, m_fingerprint | mk_mv_fingerprint(m));
 }
 
 substitution substitution::assign(name const & m, expr const & t) const {
@@ -86,7 +171,7 @@ substitution substitution::assign(name const & m, expr const & t) const {
 }
 
 substitution substitution::assign(name const & m, level const & l, justification const & j) const {
-    return substitution(m_expr_subst, insert(m_level_subst, m, mk_pair(l, j)));
+    return substitution(m_expr_subst, insert(m_level_subst, m, mk_pair(l, j)), m_fingerprint | mk_mv_fingerprint(m));
 }
 
 substitution substitution::assign(name const & m, level const & l) const {
@@ -123,6 +208,7 @@ std::pair<level, justification> substitution::d_instantiate_metavars(level const
 
 class instantiate_metavars_fn : public replace_visitor {
 protected:
+    scoped_composite_justification_cache m_jst_cache;
     substitution & m_subst;
     justification  m_jst;
     bool           m_use_jst;
@@ -201,7 +287,7 @@ protected:
     }
 
     virtual expr visit(expr const & e, context const & ctx) {
-        if (!has_metavar(e)) {
+        if (!m_subst.may_contain_assigned(e)) {
             return e;
         } else {
             return replace_visitor::visit(e, ctx);
@@ -215,10 +301,16 @@ public:
 };
 
 std::pair<expr, justification> substitution::instantiate_metavars(expr const & e) const {
+    if (!may_contain_assigned(e))
+        return mk_pair(e, justification());
+    std::shared_ptr<cache> c = get_cache();
+    if (auto r = c->find_jst(e))
+        return *r;
     substitution s(*this);
     instantiate_metavars_fn fn(s, true, false);
-    expr r = fn(e);
-    return mk_pair(r, fn.get_justification());
+    auto r = mk_pair(fn(e), fn.get_justification());
+    c->insert_jst(e, r);
+    return r;
 }
 
 std::pair<expr, justification> substitution::d_instantiate_metavars(expr const & e) {
@@ -240,8 +332,15 @@ std::pair<level, justification> substitution::instantiate_metavars(level const &
 }
 
 expr substitution::instantiate_metavars_wo_jst(expr const & e) const {
+    if (!may_contain_assigned(e))
+        return e;
+    std::shared_ptr<cache> c = get_cache();
+    if (auto r = c->find_wo_jst(e))
+        return *r;
     substitution s(*this);
-    return instantiate_metavars_fn(s, false, false)(e);
+    expr r = instantiate_metavars_fn(s, false, false)(e);
+    c->insert_wo_jst(e, r);
+    return r;
 }
 
 expr substitution::d_instantiate_metavars_wo_jst(expr const & e) {
@@ -259,18 +358,27 @@ level substitution::instantiate_metavars_wo_jst(level const & l) const {
 }
 
 bool substitution::occurs_expr(name const & m, expr const & e) const {
-    if (!has_metavar(e))
+    // Remark: subterms that do not contain \c m nor assigned metavariables are skipped.
+    unsigned fingerprint = m_fingerprint | mk_mv_fingerprint(m);
+    if (!has_metavar(e) || (get_mv_fingerprint(e) & fingerprint) == 0)
         return false;
-    auto it = find(e, [&](expr const & e, unsigned) {
+    bool found = false;
+    for_each(e, [&](expr const & e, unsigned) {
+            if (found || !has_metavar(e) || (get_mv_fingerprint(e) & fingerprint) == 0)
+                return false;
             if (is_metavar(e)) {
-                if (mlocal_name(e) == m)
-                    return true;
+                if (mlocal_name(e) == m) {
+                    found = true;
+                    return false;
+                }
                 auto s = get_expr(e);
-                return s && occurs_expr(m, *s);
-            } else {
-                return false;
+                if (s && occurs_expr(m, *s)) {
+                    found = true;
+                    return false;
+                }
             }
+            return true;
         });
-    return static_cast<bool>(it);
+    return found;
 }
 }
@@ -6,6 +6,7 @@ Author: Leonardo de Moura
 */
 #pragma once
 #include <utility>
+#include <memory>
 #include "util/rb_map.h"
 #include "util/optional.h"
 #include "kernel/expr.h"
@@ -15,10 +16,21 @@ namespace lean {
 class substitution {
     typedef rb_map<name, std::pair<expr, justification>, name_quick_cmp> expr_map;
     typedef rb_map<name, std::pair<level, justification>, name_quick_cmp> level_map;
+    struct cache;
     expr_map  m_expr_subst;
     level_map m_level_subst;
+    /** \brief Bloom filter for the names of the assigned metavariables (see \c get_mv_fingerprint). */
+    unsigned  m_fingerprint;
+    /**
+        \brief Memoized results of \c instantiate_metavars, it is shared by copies of this substitution.
+        It is only created by the first lookup that needs it (see \c get_cache).
+    */
+    mutable std::shared_ptr<cache> m_cache;
 
-    substitution(expr_map const & em, level_map const & lm);
+    substitution(expr_map const & em, level_map const & lm, unsigned fingerprint);
+    std::shared_ptr<cache> get_cache() const;
+    /** \brief Return true if \c e may contain a metavariable assigned in this substitution. */
+    bool may_contain_assigned(expr const & e) const;
     void d_assign(name const & m, expr const & t, justification const & j);
     void d_assign(name const & m, expr const & t);
     void d_assign(name const & m, level const & t, justification const & j);
@@ -29,6 +41,10 @@ class substitution {
     friend class instantiate_metavars_fn;
 public:
     substitution();
+    substitution(substitution const & s);
+    substitution(substitution && s) = default;
+    substitution & operator=(substitution const & s);
+    substitution & operator=(substitution && s) = default;
     typedef optional<std::pair<expr,  justification>> opt_expr_jst;
     typedef optional<std::pair<level, justification>> opt_level_jst;
 
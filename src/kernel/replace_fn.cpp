@@ -4,6 +4,7 @@ Released under Apache 2.0 license as described in the file LICENSE.
 
 Author: Leonardo de Moura
 */
+#include "util/step_budget.h"
 #include "kernel/replace_fn.h"
 
 namespace lean {
@@ -31,6 +32,7 @@ bool replace_fn::visit(expr const & e, unsigned offset) {
         shared = true;
     }
 
+    consume_steps();
     optional<expr> r = m_f(e, offset);
     if (r) {
         save_result(e, *r, offset, shared);
@@ -44,6 +46,46 @@ bool replace_fn::visit(expr const & e, unsigned offset) {
     }
 }
 
+/**
+   \brief Similar to the previous method, but \c e is owned by this object.
+   If \c e is not shared, its children are moved to the children stack \c m_cs,
+   and its cell is reused when the new expression is built.
+*/
+bool replace_fn::visit(expr && e, unsigned offset) {
+    if (is_shared(e))
+        return visit(static_cast<expr const &>(e), offset);
+    consume_steps();
+    optional<expr> r = m_f(e, offset);
+    if (r) {
+        save_result(e, *r, offset, false);
+        return true;
+    } else if (is_atomic(e)) {
+        save_result(e, e, offset, false);
+        return true;
+    } else if (is_shared(e) || is_mlocal(e)) {
+        // Remark: \c e may have been stored by m_f
+        m_fs.emplace_back(e, offset, is_shared(e));
+        return false;
+    } else {
+        unsigned cs_base = m_cs.size();
+        take_children(e, m_cs);
+        m_fs.emplace_back(std::move(e), offset, cs_base);
+        return false;
+    }
+}
+
+/**
+   \brief Visit the i-th child \c c of the expression being processed in the frame \c f.
+*/
+bool replace_fn::visit_child(frame & f, expr const & c, unsigned i, unsigned offset) {
+    if (f.m_unique) {
+        expr new_c = std::move(m_cs[f.m_cs_base + i]);
+        return visit(std::move(new_c), offset);
+    } else {
+        return visit(c, offset);
+    }
+}
+
 /**
    \brief Return true iff <tt>f.m_index == idx</tt>.
    When the result is true, <tt>f.m_index</tt> is incremented.
@@ -67,11 +109,23 @@ void replace_fn::pop_rs(unsigned num) {
 }
 
 expr replace_fn::operator()(expr const & e) {
-    expr r;
     visit(e, 0);
+    return main_loop();
+}
+
+expr replace_fn::operator()(expr && e) {
+    if (m_has_post)
+        visit(static_cast<expr const &>(e), 0);
+    else
+        visit(std::move(e), 0);
+    return main_loop();
+}
+
+expr replace_fn::main_loop() {
+    expr r;
     while (!m_fs.empty()) {
       begin_loop:
-        check_interrupted();
+        check_system("replace");
         frame & f = m_fs.back();
         expr const & e   = f.m_expr;
         unsigned offset  = f.m_offset;
@@ -86,41 +140,62 @@ expr replace_fn::operator()(expr const & e) {
             pop_rs(1);
             break;
         case expr_kind::App:
-            if (check_index(f, 0) && !visit(app_fn(e), offset))
+            if (check_index(f, 0) && !visit_child(f, app_fn(e), 0, offset))
                 goto begin_loop;
-            if (check_index(f, 1) && !visit(app_arg(e), offset))
+            if (check_index(f, 1) && !visit_child(f, app_arg(e), 1, offset))
                 goto begin_loop;
-            r = update_app(e, rs(-2), rs(-1));
+            if (f.m_unique)
+                r = update_app(std::move(f.m_expr), rs(-2), rs(-1));
+            else
+                r = update_app(e, rs(-2), rs(-1));
             pop_rs(2);
             break;
         case expr_kind::Pi: case expr_kind::Lambda:
-            if (check_index(f, 0) && !visit(binder_domain(e), offset))
+            if (check_index(f, 0) && !visit_child(f, binder_domain(e), 0, offset))
                 goto begin_loop;
-            if (check_index(f, 1) && !visit(binder_body(e), offset + 1))
+            if (check_index(f, 1) && !visit_child(f, binder_body(e), 1, offset + 1))
                 goto begin_loop;
-            r = update_binder(e, rs(-2), rs(-1));
+            if (f.m_unique)
+                r = update_binder(std::move(f.m_expr), rs(-2), rs(-1));
+            else
+                r = update_binder(e, rs(-2), rs(-1));
             pop_rs(2);
             break;
         case expr_kind::Let:
-            if (check_index(f, 0) && !visit(let_type(e), offset))
+            if (check_index(f, 0) && !visit_child(f, let_type(e), 0, offset))
                 goto begin_loop;
-            if (check_index(f, 1) && !visit(let_value(e), offset))
+            if (check_index(f, 1) && !visit_child(f, let_value(e), 1, offset))
                 goto begin_loop;
-            if (check_index(f, 2) && !visit(let_body(e), offset + 1))
+            if (check_index(f, 2) && !visit_child(f, let_body(e), 2, offset + 1))
                 goto begin_loop;
-            r = update_let(e, rs(-3), rs(-2), rs(-1));
+            if (f.m_unique)
+                r = update_let(std::move(f.m_expr), rs(-3), rs(-2), rs(-1));
+            else
+                r = update_let(e, rs(-3), rs(-2), rs(-1));
             pop_rs(3);
             break;
-        case expr_kind::Macro:
-            while (f.m_index < macro_num_args(e)) {
-                if (!visit(macro_arg(e, f.m_index), offset))
+        case expr_kind::Macro: {
+            unsigned num = macro_num_args(e);
+            while (f.m_index < num) {
+                unsigned i = f.m_index++;
+                if (!visit_child(f, macro_arg(e, i), i, offset))
                     goto begin_loop;
             }
-            r = update_macro(e, macro_num_args(e), &rs(-macro_num_args(e)));
-            pop_rs(macro_num_args(e));
+            if (f.m_unique)
+                r = update_macro(std::move(f.m_expr), num, &rs(-num));
+            else
+                r = update_macro(e, num, &rs(-num));
+            pop_rs(num);
             break;
         }
-        save_result(e, r, offset, f.m_shared);
+        }
+        if (f.m_unique) {
+            // Remark: the cell of f.m_expr was reused by r, and it is not shared.
+            m_cs.shrink(f.m_cs_base);
+            m_rs.push_back(std::move(r));
+        } else {
+            save_result(e, r, offset, f.m_shared);
+        }
         m_fs.pop_back();
     }
     lean_assert(m_rs.size() == 1);
@@ -133,5 +208,6 @@ void replace_fn::clear() {
     m_cache.clear();
     m_fs.clear();
     m_rs.clear();
+    m_cs.clear();
 }
 }
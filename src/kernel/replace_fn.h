@@ -6,6 +6,8 @@ Author: Leonardo de Moura
 */
 #pragma once
 #include <tuple>
+#include <utility>
+#include <type_traits>
 #include "util/buffer.h"
 #include "util/interrupt.h"
 #include "kernel/expr.h"
@@ -34,6 +36,10 @@ public:
 
    P is a "post-processing" functional object that is applied to each
    pair (old, new)
+
+   When the input expression is passed as an rvalue and no post-processing
+   object is provided, the cells that are not shared are updated in place
+   (see update_app(expr && e, ...)).
 */
 class replace_fn {
     struct frame {
@@ -41,7 +47,12 @@ class replace_fn {
         unsigned   m_offset;
         bool       m_shared;
         unsigned   m_index;
-        frame(expr const & e, unsigned o, bool s):m_expr(e), m_offset(o), m_shared(s), m_index(0) {}
+        // When m_unique is true, m_expr is not shared, and its children were moved to the children stack starting at position m_cs_base.
+        bool       m_unique;
+        unsigned   m_cs_base;
+        frame(expr const & e, unsigned o, bool s):m_expr(e), m_offset(o), m_shared(s), m_index(0), m_unique(false), m_cs_base(0) {}
+        frame(expr && e, unsigned o, unsigned cs_base):
+            m_expr(std::move(e)), m_offset(o), m_shared(false), m_index(0), m_unique(true), m_cs_base(cs_base) {}
     };
     typedef buffer<frame>  frame_stack;
     typedef buffer<expr>   result_stack;
@@ -49,11 +60,16 @@ class replace_fn {
     expr_cell_offset_map<expr>                            m_cache;
     std::function<optional<expr>(expr const &, unsigned)> m_f;
     std::function<void(expr const &, expr const &)>       m_post;
+    bool                                                  m_has_post;
     frame_stack                                           m_fs;
     result_stack                                          m_rs;
+    result_stack                                          m_cs; // children of frames that are not shared
 
     void save_result(expr const & e, expr const & r, unsigned offset, bool shared);
     bool visit(expr const & e, unsigned offset);
+    bool visit(expr && e, unsigned offset);
+    bool visit_child(frame & f, expr const & c, unsigned i, unsigned offset);
+    expr main_loop();
     bool check_index(frame & f, unsigned idx);
     expr const & rs(int i);
     void pop_rs(unsigned num);
@@ -61,14 +77,18 @@ class replace_fn {
 public:
     template<typename F, typename P = default_replace_postprocessor>
     replace_fn(F const & f, P const & p = P()):
-        m_f(f), m_post(p) {}
+        m_f(f), m_post(p), m_has_post(!std::is_same<P, default_replace_postprocessor>::value) {}
     expr operator()(expr const & e);
+    expr operator()(expr && e);
     void clear();
 };
 
 template<typename F> expr replace(expr const & e, F const & f) {
     return replace_fn(f)(e);
 }
+template<typename F> expr replace(expr && e, F const & f) {
+    return replace_fn(f)(std::move(e));
+}
 
 template<typename F, typename P> expr replace(expr const & e, F const & f, P const & p) {
     return replace_fn(f, p)(e);
@@ -4,12 +4,15 @@ Released under Apache 2.0 license as described in the file LICENSE.
 
 Author: Leonardo de Moura
 */
+#include <algorithm>
 #include <utility>
 #include <vector>
+#include <unordered_set>
 #include "util/interrupt.h"
 #include "util/lbool.h"
 #include "util/flet.h"
 #include "util/sstream.h"
+#include "util/step_budget.h"
 #include "kernel/type_checker.h"
 #include "kernel/expr_maps.h"
 #include "kernel/instantiate.h"
@@ -20,6 +23,8 @@ Author: Leonardo de Moura
 #include "kernel/kernel_exception.h"
 #include "kernel/abstract.h"
 #include "kernel/replace_fn.h"
+#include "kernel/check_cache.h"
+#include "kernel/for_each_fn.h"
 
 namespace lean {
 static name g_x_name("x");
@@ -28,6 +33,11 @@ no_constraints_allowed_exception::no_constraints_allowed_exception():exception("
 exception * no_constraints_allowed_exception::clone() const { return new no_constraints_allowed_exception(); }
 void no_constraints_allowed_exception::rethrow() const { throw *this; }
 
+void constraint_handler::add_cnstrs(unsigned num, constraint const * cs) {
+    for (unsigned i = 0; i < num; i++)
+        add_cnstr(cs[i]);
+}
+
 void no_constraint_handler::add_cnstr(constraint const &) {
     throw no_constraints_allowed_exception();
 }
@@ -56,20 +66,37 @@ struct type_checker::imp {
         virtual void add_cnstr(constraint const & c) { m_imp.add_cnstr(c); }
     };
 
+    /**
+        \brief Equality used to remove duplicate constraints. Remark: <tt>operator==</tt> ignores the justifications,
+        but constraints with different justifications must be preserved.
+    */
+    struct cnstr_eq {
+        bool operator()(constraint const & c1, constraint const & c2) const {
+            return is_eqp(c1.get_justification(), c2.get_justification()) && c1 == c2;
+        }
+    };
+    typedef std::unordered_set<constraint, constraint_hash, cnstr_eq> cnstr_set;
     environment                m_env;
     name_generator             m_gen;
     constraint_handler &       m_chandler;
     std::unique_ptr<converter> m_conv;
-    expr_struct_map<expr>      m_infer_type_cache;
+    expr_struct_cache<expr>    m_infer_type_cache;
     converter_context          m_conv_ctx;
     type_checker_context       m_tc_ctx;
     bool                       m_memoize;
+    bool                       m_batch_cnstrs;
+    // constraints that were not sent to m_chandler yet (only used when m_batch_cnstrs is true)
+    std::vector<constraint>    m_cnstrs;
+    cnstr_set                  m_cnstr_set;
+    type_checker_stats         m_stats;
+    unsigned                   m_max_steps;
+    unsigned                   m_num_steps;
     // temp flag
     param_names                m_params;
 
     imp(environment const & env, name_generator const & g, constraint_handler & h, std::unique_ptr<converter> && conv, bool memoize):
         m_env(env), m_gen(g), m_chandler(h), m_conv(std::move(conv)), m_conv_ctx(*this), m_tc_ctx(*this),
-        m_memoize(memoize) {}
+        m_memoize(memoize), m_batch_cnstrs(h.batch_cnstrs()), m_max_steps(get_default_max_steps()), m_num_steps(0) {}
 
     optional<expr> expand_macro(expr const & m) {
         lean_assert(is_macro(m));
@@ -80,17 +107,62 @@ struct type_checker::imp {
     }
 
     /**
-        \brief Return the body of the given binder, where the free variable #0 is replaced with a fresh local constant.
-        It also returns the fresh local constant.
-     */
-    std::pair<expr, expr> open_binder_body(expr const & e) {
-        expr local     = mk_local(m_gen.next() + binder_name(e), binder_domain(e));
-        return mk_pair(instantiate(binder_body(e), local), local);
+        \brief Open the telescope of binders of kind \c k at the beginning of \c e.
+        The binders are stored in \c bs, and a fresh local constant is created for each one of them (and stored in \c ls).
+        The type of each local constant is the instantiated binder domain.
+        The result is the instantiated body of the telescope.
+
+        \remark Each binder domain, and the body, is instantiated only once. So, the cost is
+        linear in the size of the telescope.
+    */
+    expr open_telescope(expr_kind k, expr const & e, buffer<expr> & bs, buffer<expr> & ls) {
+        expr it = e;
+        while (it.kind() == k) {
+            expr d = instantiate_rev(binder_domain(it), ls.size(), ls.data());
+            bs.push_back(it);
+            ls.push_back(mk_local(m_gen.next() + binder_name(it), d));
+            it = binder_body(it);
+        }
+        return instantiate_rev(it, ls.size(), ls.data());
     }
 
     /** \brief Add given constraint to the constraint handler m_chandler. */
     void add_cnstr(constraint const & c) {
-        m_chandler.add_cnstr(c);
+        m_stats.m_cnstrs++;
+        if (!m_batch_cnstrs)
+            m_chandler.add_cnstr(c);
+        else if (m_cnstr_set.insert(c).second)
+            m_cnstrs.push_back(c);
+    }
+
+    /** \brief Send the accumulated constraints to m_chandler. */
+    void flush_cnstrs() {
+        if (m_cnstrs.empty())
+            return;
+        std::vector<constraint> cs;
+        cs.swap(m_cnstrs);
+        m_cnstr_set.clear();
+        m_chandler.add_cnstrs(cs.size(), cs.data());
+    }
+
+    /**
+        \brief Execute \c fn using the step budget of this type checker, and send the constraints it produced to m_chandler.
+        If \c fn throws an exception, then the constraints are discarded.
+    */
+    template<typename F>
+    auto batch(F && fn) -> decltype(fn()) {
+        scoped_step_budget budget(m_max_steps, m_num_steps);
+        if (!m_batch_cnstrs)
+            return fn();
+        try {
+            auto r = fn();
+            flush_cnstrs();
+            return r;
+        } catch (...) {
+            m_cnstrs.clear();
+            m_cnstr_set.clear();
+            throw;
+        }
     }
 
     /** \brief Return true iff \c t and \c s are definitionally equal */
@@ -238,13 +310,13 @@ struct type_checker::imp {
         \brief Create a justification for a application type mismatch,
         \c e is the application, \c fn_type and \c arg_type are the function and argument type.
     */
-    justification mk_app_mismatch_jst(expr const & e, expr const & fn_type, expr const & arg_type) {
+    justification mk_app_mismatch_jst(expr const & e, expr const & expected_type, expr const & arg_type) {
         lean_assert(is_app(e));
         return mk_justification(e,
                                 [=](formatter const & fmt, options const & o, substitution const & subst) {
                                     return pp_app_type_mismatch(fmt, m_env, o,
                                                                 subst.instantiate_metavars_wo_jst(e),
-                                                                subst.instantiate_metavars_wo_jst(binder_domain(fn_type)),
+                                                                subst.instantiate_metavars_wo_jst(expected_type),
                                                                 subst.instantiate_metavars_wo_jst(arg_type));
                                 });
     }
@@ -287,11 +359,13 @@ struct type_checker::imp {
     expr infer_type_core(expr const & e, bool infer_only) {
         lean_assert(closed(e));
         check_system("type checker");
+        m_stats.m_infer++;
 
         if (m_memoize) {
-            auto it = m_infer_type_cache.find(e);
-            if (it != m_infer_type_cache.end())
-                return it->second;
+            if (expr const * r = m_infer_type_cache.find(e)) {
+                m_stats.m_infer_hits++;
+                return *r;
+            }
         }
 
         expr r;
@@ -337,37 +411,76 @@ struct type_checker::imp {
             break;
         }
         case expr_kind::Lambda: {
+            // The whole telescope is processed at once, and the local constants are abstracted in a single pass.
+            buffer<expr> bs, ls;
+            expr b = open_telescope(expr_kind::Lambda, e, bs, ls);
             if (!infer_only) {
-                expr t = infer_type_core(binder_domain(e), infer_only);
-                ensure_sort(t, binder_domain(e));
+                for (expr const & l : ls) {
+                    expr t = infer_type_core(mlocal_type(l), infer_only);
+                    ensure_sort(t, mlocal_type(l));
+                }
+            }
+            r = abstract_locals(infer_type_core(b, infer_only), ls);
+            unsigned i = bs.size();
+            while (i > 0) {
+                --i;
+                r = mk_pi(binder_name(bs[i]), binder_domain(bs[i]), r, binder_info(bs[i]));
             }
-            auto b = open_binder_body(e);
-            r = mk_pi(binder_name(e), binder_domain(e), abstract_p(infer_type_core(b.first, infer_only), b.second), binder_info(e));
             break;
         }
         case expr_kind::Pi: {
-            expr t1 = ensure_sort(infer_type_core(binder_domain(e), infer_only), binder_domain(e));
-            auto b  = open_binder_body(e);
-            expr t2 = ensure_sort(infer_type_core(b.first, infer_only), binder_body(e));
-            if (m_env.impredicative())
-                r = mk_sort(mk_imax(sort_level(t1), sort_level(t2)));
-            else
-                r = mk_sort(mk_max(sort_level(t1), sort_level(t2)));
+            buffer<expr> bs, ls;
+            expr b = open_telescope(expr_kind::Pi, e, bs, ls);
+            buffer<level> lvls;
+            for (unsigned i = 0; i < ls.size(); i++) {
+                expr t = ensure_sort(infer_type_core(mlocal_type(ls[i]), infer_only), mlocal_type(ls[i]));
+                lvls.push_back(sort_level(t));
+            }
+            level l = sort_level(ensure_sort(infer_type_core(b, infer_only), binder_body(bs.back())));
+            unsigned i = lvls.size();
+            while (i > 0) {
+                --i;
+                l = m_env.impredicative() ? mk_imax(lvls[i], l) : mk_max(lvls[i], l);
+            }
+            r = mk_sort(l);
             break;
         }
         case expr_kind::App: {
-            expr f_type = ensure_pi(infer_type_core(app_fn(e), infer_only), app_fn(e));
-            if (!infer_only) {
-                expr a_type = infer_type_core(app_arg(e), infer_only);
-                delayed_justification jst([=]() { return mk_app_mismatch_jst(e, f_type, a_type); });
-                if (!is_def_eq(a_type, binder_domain(f_type), jst)) {
-                    throw_kernel_exception(m_env, e,
-                                           [=](formatter const & fmt, options const & o) {
-                                               return pp_app_type_mismatch(fmt, m_env, o, e, binder_domain(f_type), a_type);
-                                           });
+            // The whole spine (f a_1 ... a_n) is processed at once, and the substitution of the arguments
+            // in the type of f is delayed: if f_type is (Pi x_{j+1} ... x_i, B), then B is waiting for
+            // the arguments a_{j+1} ... a_i. Only the binder domains and the resultant type are materialized.
+            buffer<expr> apps; // apps[i] is the application whose argument is a_i
+            buffer<expr> args;
+            expr f = e;
+            while (is_app(f)) {
+                apps.push_back(f);
+                f = app_fn(f);
+            }
+            std::reverse(apps.begin(), apps.end());
+            for (expr const & app : apps)
+                args.push_back(app_arg(app));
+            expr f_type = infer_type_core(f, infer_only);
+            unsigned j  = 0;
+            for (unsigned i = 0; i < args.size(); i++) {
+                if (!is_pi(f_type)) {
+                    f_type = ensure_pi(instantiate_rev(f_type, i - j, args.data() + j), app_fn(apps[i]));
+                    j      = i;
                 }
+                if (!infer_only) {
+                    expr app    = apps[i];
+                    expr a_type = infer_type_core(args[i], infer_only);
+                    expr d      = instantiate_rev(binder_domain(f_type), i - j, args.data() + j);
+                    delayed_justification jst([=]() { return mk_app_mismatch_jst(app, d, a_type); });
+                    if (!is_def_eq(a_type, d, jst)) {
+                        throw_kernel_exception(m_env, app,
+                                               [=](formatter const & fmt, options const & o) {
+                                                   return pp_app_type_mismatch(fmt, m_env, o, app, d, a_type);
+                                               });
+                    }
+                }
+                f_type = binder_body(f_type);
             }
-            r = instantiate(binder_body(f_type), app_arg(e));
+            r = instantiate_rev(f_type, args.size() - j, args.data() + j);
             break;
         }
         case expr_kind::Let:
@@ -387,7 +500,7 @@ struct type_checker::imp {
         }
 
         if (m_memoize)
-            m_infer_type_cache.insert(mk_pair(e, r));
+            m_infer_type_cache.insert(e, r);
 
         return r;
     }
@@ -399,6 +512,18 @@ struct type_checker::imp {
     }
     bool is_def_eq(expr const & t, expr const & s) { return m_conv->is_def_eq(t, s, m_conv_ctx); }
     expr whnf(expr const & t) { return m_conv->whnf(t, m_conv_ctx); }
+    expr normalize(expr const & t) { return m_conv->normalize(t, m_conv_ctx); }
+    type_checker_stats get_stats() const {
+        type_checker_stats r = m_stats;
+        r.m_infer_struct_fallbacks = m_infer_type_cache.get_num_struct_fallbacks();
+        r.m_conv = m_conv->get_stats();
+        return r;
+    }
+    void reset_stats() {
+        m_stats = type_checker_stats();
+        m_infer_type_cache.reset_stats();
+        m_conv->reset_stats();
+    }
 };
 
 no_constraint_handler g_no_constraint_handler;
@@ -415,13 +540,18 @@ type_checker::type_checker(environment const & env):
     type_checker(env, name_generator(g_tmp_prefix), g_no_constraint_handler, mk_default_converter(env), true) {}
 
 type_checker::~type_checker() {}
-expr type_checker::infer(expr const & t) { return m_ptr->infer_type(t); }
-expr type_checker::check(expr const & t, param_names const & ps) { return m_ptr->check(t, ps); }
-bool type_checker::is_def_eq(expr const & t, expr const & s) { return m_ptr->is_def_eq(t, s); }
-bool type_checker::is_prop(expr const & t) { return m_ptr->is_prop(t); }
-expr type_checker::whnf(expr const & t) { return m_ptr->whnf(t); }
-expr type_checker::ensure_pi(expr const & t) { return m_ptr->ensure_pi(t, t); }
-expr type_checker::ensure_sort(expr const & t) { return m_ptr->ensure_sort(t, t); }
+expr type_checker::infer(expr const & t) { return m_ptr->batch([&]() { return m_ptr->infer_type(t); }); }
+expr type_checker::check(expr const & t, param_names const & ps) { return m_ptr->batch([&]() { return m_ptr->check(t, ps); }); }
+bool type_checker::is_def_eq(expr const & t, expr const & s) { return m_ptr->batch([&]() { return m_ptr->is_def_eq(t, s); }); }
+bool type_checker::is_prop(expr const & t) { return m_ptr->batch([&]() { return m_ptr->is_prop(t); }); }
+expr type_checker::whnf(expr const & t) { return m_ptr->batch([&]() { return m_ptr->whnf(t); }); }
+expr type_checker::normalize(expr const & t) { return m_ptr->batch([&]() { return m_ptr->normalize(t); }); }
+expr type_checker::ensure_pi(expr const & t) { return m_ptr->batch([&]() { return m_ptr->ensure_pi(t, t); }); }
+expr type_checker::ensure_sort(expr const & t) { return m_ptr->batch([&]() { return m_ptr->ensure_sort(t, t); }); }
+void type_checker::set_max_steps(unsigned max_steps) { m_ptr->m_max_steps = max_steps; m_ptr->m_num_steps = 0; }
+unsigned type_checker::get_num_steps() const { return m_ptr->m_num_steps; }
+type_checker_stats type_checker::get_stats() const { return m_ptr->get_stats(); }
+void type_checker::reset_stats() { m_ptr->reset_stats(); }
 
 static void check_no_metavar(environment const & env, expr const & e) {
     if (has_metavar(e))
@@ -443,14 +573,18 @@ static void check_name(environment const & env, name const & n) {
         throw_already_declared(env, n);
 }
 
-certified_definition check(environment const & env, definition const & d, name_generator const & g, name_set const & extra_opaque, bool memoize) {
+void check_definition_type(environment const & env, definition const & d, name_generator const & g,
+                           name_set const & extra_opaque, bool memoize) {
     check_no_mlocal(env, d.get_type());
     if (d.is_definition())
         check_no_mlocal(env, d.get_value());
     check_name(env, d.get_name());
+    type_checker checker(env, g, mk_default_converter(env, optional<module_idx>(), memoize, extra_opaque));
+    checker.check(d.get_type(), d.get_params());
+}
 
-    type_checker checker1(env, g, mk_default_converter(env, optional<module_idx>(), memoize, extra_opaque));
-    checker1.check(d.get_type(), d.get_params());
+void check_definition_value(environment const & env, definition const & d, name_generator const & g,
+                            name_set const & extra_opaque, bool memoize) {
     if (d.is_definition()) {
         optional<module_idx> midx;
         if (d.is_opaque())
@@ -464,10 +598,91 @@ certified_definition check(environment const & env, definition const & d, name_g
                                    });
         }
     }
+}
+
+certified_definition check(environment const & env, definition const & d, name_generator const & g, name_set const & extra_opaque, bool memoize) {
+    std::shared_ptr<check_cache> cache = get_check_cache();
+    optional<fingerprint> key;
+    if (cache) {
+        key = mk_check_cache_key(env, d);
+        if (key && cache->contains(*key)) {
+            check_no_mlocal(env, d.get_type());
+            if (d.is_definition())
+                check_no_mlocal(env, d.get_value());
+            check_name(env, d.get_name());
+            return certified_definition(env.get_id(), d);
+        }
+    }
+    check_definition_type(env, d, g, extra_opaque, memoize);
+    check_definition_value(env, d, g, extra_opaque, memoize);
+    if (key)
+        cache->insert(*key);
     return certified_definition(env.get_id(), d);
 }
 
 certified_definition check(environment const & env, definition const & d, name_set const & extra_opaque, bool memoize) {
     return check(env, d, name_generator(g_tmp_prefix), extra_opaque, memoize);
 }
+
+environment recheck(environment const & env, unsigned num, definition const * ds,
+                    name_generator const & g, name_set const & extra_opaque, bool memoize) {
+    rb_map<name, definition, name_quick_cmp> new_defs;
+    buffer<name> roots;
+    for (unsigned i = 0; i < num; i++) {
+        new_defs.insert(ds[i].get_name(), ds[i]);
+        if (env.find(ds[i].get_name()))
+            roots.push_back(ds[i].get_name());
+    }
+    buffer<name> affected;
+    env.get_transitive_dependents(roots.size(), roots.data(), affected);
+    name_set to_remove;
+    for (name const & n : affected)
+        to_remove.insert(n);
+    name_set to_add = to_remove;
+    for (unsigned i = 0; i < num; i++) {
+        if (!to_add.contains(ds[i].get_name())) {
+            to_add.insert(ds[i].get_name());
+            affected.push_back(ds[i].get_name());
+        }
+    }
+    auto get_def = [&](name const & n) {
+        definition const * d = new_defs.find(n);
+        return d ? *d : env.get(n);
+    };
+    // The definitions are added in a topological order of their new dependencies, since a new value may
+    // refer to a new definition in ds, or to an affected definition that occurs after it in env.
+    // We use the postorder of a depth-first traversal, starting at the definitions in the order of env.
+    buffer<name> order;
+    name_set visited;
+    buffer<std::pair<name, bool>> todo; // the flag is true if the dependencies of the given name were already visited
+    for (name const & n : affected) {
+        todo.emplace_back(n, false);
+        while (!todo.empty()) {
+            auto p = todo.back();
+            todo.pop_back();
+            if (p.second) {
+                order.push_back(p.first);
+            } else if (!visited.contains(p.first)) {
+                visited.insert(p.first);
+                todo.emplace_back(p.first, true);
+                definition d = get_def(p.first);
+                auto fn = [&](expr const & e, unsigned) {
+                    if (is_constant(e)) {
+                        if (to_add.contains(const_name(e)) && !visited.contains(const_name(e)))
+                            todo.emplace_back(const_name(e), false);
+                        return false;
+                    }
+                    return true;
+                };
+                for_each(d.get_type(), fn);
+                if (d.is_definition())
+                    for_each(d.get_value(), fn);
+            }
+        }
+    }
+    environment new_env = env.remove(to_remove);
+    for (name const & n : order)
+        new_env = new_env.add(check(new_env, get_def(n), g, extra_opaque, memoize));
+    return new_env;
+}
 }
@@ -18,6 +18,19 @@ class constraint_handler {
 public:
     virtual ~constraint_handler() {}
     virtual void add_cnstr(constraint const & c) = 0;
+    /**
+       \brief Add the given batch of constraints.
+       The default implementation invokes \c add_cnstr for each one of them.
+    */
+    virtual void add_cnstrs(unsigned num, constraint const * cs);
+    /**
+       \brief Return true if the type checker is allowed to accumulate the constraints
+       produced by \c check, \c infer, \c is_def_eq, ..., and send them using \c add_cnstrs
+       when these methods return. Duplicate constraints (with the same justification) are sent only once,
+       and the accumulated constraints are discarded if the method throws an exception.
+       The default implementation returns false, i.e., each constraint is sent as soon as it is produced.
+    */
+    virtual bool batch_cnstrs() const { return false; }
 };
 
 /** \brief This handler always throw an exception (\c no_constraints_allowed_exception) when \c add_cnstr is invoked. */
@@ -34,11 +47,23 @@ public:
     virtual void rethrow() const;
 };
 
+/** \brief Performance counters collected by a type checker (and its converter). */
+struct type_checker_stats {
+    unsigned        m_infer;       // number of calls to infer_type_core
+    unsigned        m_infer_hits;  // number of infer_type_core cache hits
+    unsigned        m_cnstrs;      // number of constraints emitted
+    unsigned        m_infer_struct_fallbacks; // number of structural equality tests performed by infer_type_core cache lookups
+    converter_stats m_conv;        // counters collected by the converter
+    type_checker_stats():m_infer(0), m_infer_hits(0), m_cnstrs(0), m_infer_struct_fallbacks(0) {}
+};
+
 /**
    \brief Lean Type Checker. It can also be used to infer types, check whether a
    type \c A is convertible to a type \c B, etc.
 
    The type checker produces constraints, and they are sent to the constraint handler.
+   If the constraint handler supports batches (see \c constraint_handler::batch_cnstrs), the
+   constraints are sent when the public methods of this class return.
 */
 class type_checker {
     struct imp;
@@ -91,10 +116,27 @@ public:
     bool is_prop(expr const & t);
     /** \brief Return the weak head normal form of \c t. */
     expr whnf(expr const & t);
+    /** \brief Return the normal form of \c t. */
+    expr normalize(expr const & t);
     /** \brief Return a Pi if \c t is convertible to a Pi type. Throw an exception otherwise. */
     expr ensure_pi(expr const & t);
     /** \brief Return a Sort if \c t is convertible to Sort. Throw an exception otherwise. */
     expr ensure_sort(expr const & t);
+
+    /**
+       \brief Set the maximum number of steps this type checker can perform (0 means unlimited),
+       and reset the number of consumed steps. The steps are consumed by whnf_core, beta and delta
+       reduction, and \c replace_fn visits. When the budget is exhausted, a \c step_budget_exception
+       is thrown. By default, the budget is \c get_default_max_steps().
+    */
+    void set_max_steps(unsigned max_steps);
+    /** \brief Return the number of steps consumed by this type checker. */
+    unsigned get_num_steps() const;
+
+    /** \brief Return the performance counters collected by this type checker. */
+    type_checker_stats get_stats() const;
+    /** \brief Reset the performance counters. */
+    void reset_stats();
 };
 
 /**
@@ -104,4 +146,31 @@ public:
 certified_definition check(environment const & env, definition const & d,
                            name_generator const & g, name_set const & extra_opaque = name_set(), bool memoize = true);
 certified_definition check(environment const & env, definition const & d, name_set const & extra_opaque = name_set(), bool memoize = true);
+
+/**
+   \brief First phase of \c check: make sure the definition does not contain metavariables or local constants,
+   its name is not already in use, and its type is type correct.
+*/
+void check_definition_type(environment const & env, definition const & d, name_generator const & g,
+                           name_set const & extra_opaque = name_set(), bool memoize = true);
+/**
+   \brief Second phase of \c check: make sure the type of the value of \c d (if it is a definition or theorem)
+   is definitionally equal to the declared one.
+*/
+void check_definition_value(environment const & env, definition const & d, name_generator const & g,
+                            name_set const & extra_opaque = name_set(), bool memoize = true);
+
+/**
+   \brief Return a new environment where the definitions <tt>ds[0], ..., ds[num-1]</tt> replace the ones with the same name
+   in \c env (the ones that are not in \c env are added at the end).
+   Only the new definitions and the definitions that depend (directly or indirectly) on them are type checked again,
+   all other definitions are reused. The definitions are rechecked in a topological order of their new dependencies,
+   so a new definition may refer to other definitions in \c ds.
+
+   Throw an exception if one of the definitions is type incorrect.
+
+   \remark The result is not a descendant of \c env (see \c environment::remove).
+*/
+environment recheck(environment const & env, unsigned num, definition const * ds,
+                    name_generator const & g, name_set const & extra_opaque = name_set(), bool memoize = true);
 }
@@ -4,14 +4,48 @@ Released under Apache 2.0 license as described in the file LICENSE.
 
 Author: Leonardo de Moura
 */
+#include <vector>
 #include "util/buffer.h"
+#include "util/thread.h"
+#include "util/parallel_for.h"
 #include "kernel/expr.h"
 #include "kernel/expr_maps.h"
+#include "library/deep_copy.h"
 
 namespace lean {
+/**
+   \brief Table mapping cells to their copies used by the batch version of \c deep_copy.
+   The table is split in buckets protected by different mutexes to reduce contention.
+*/
+class copy_table {
+    static constexpr unsigned num_buckets = 64;
+    struct bucket {
+        mutex               m_mutex;
+        expr_cell_map<expr> m_map;
+    };
+    bucket m_buckets[num_buckets]; // NOLINT
+    bucket & get_bucket(expr_cell const * c) {
+        return m_buckets[(reinterpret_cast<uintptr_t>(c) >> 3) % num_buckets];
+    }
+public:
+    optional<expr> find(expr const & a) {
+        bucket & b = get_bucket(a.raw());
+        lock_guard<mutex> lock(b.m_mutex);
+        auto it = b.m_map.find(a.raw());
+        return it == b.m_map.end() ? none_expr() : some_expr(it->second);
+    }
+    /** \brief Associate \c r with \c a if \c a is not in the table yet, and return the copy associated with \c a. */
+    expr insert(expr const & a, expr const & r) {
+        bucket & b = get_bucket(a.raw());
+        lock_guard<mutex> lock(b.m_mutex);
+        return b.m_map.insert(std::make_pair(a.raw(), r)).first->second;
+    }
+};
+
 /** \brief Implements deep copy of kernel expressions. */
 class deep_copy_fn {
     expr_cell_map<expr> m_cache;
+    copy_table *        m_table; // table shared with other threads (if not nullptr)
 
     expr apply(expr const & a) {
         bool sh = false;
@@ -19,6 +53,12 @@ class deep_copy_fn {
             auto r = m_cache.find(a.raw());
             if (r != m_cache.end())
                 return r->second;
+            if (m_table) {
+                if (auto c = m_table->find(a)) {
+                    m_cache.insert(std::make_pair(a.raw(), *c));
+                    return *c;
+                }
+            }
             sh = true;
         }
         expr r;
@@ -34,11 +74,15 @@ class deep_copy_fn {
         case expr_kind::Meta:    r = mk_metavar(mlocal_name(a), apply(mlocal_type(a))); break;
         case expr_kind::Local:   r = mk_local(mlocal_name(a), apply(mlocal_type(a))); break;
         }
-        if (sh)
+        if (sh) {
+            if (m_table)
+                r = m_table->insert(a, r);
             m_cache.insert(std::make_pair(a.raw(), r));
+        }
         return r;
     }
 public:
+    deep_copy_fn(copy_table * t = nullptr):m_table(t) {}
     /**
         \brief Return a new expression that is equal to the given
         argument, but does not share any memory cell with it.
@@ -46,4 +90,16 @@ public:
     expr operator()(expr const & a) { return apply(a); }
 };
 expr deep_copy(expr const & e) { return deep_copy_fn()(e); }
+
+sharing_stats deep_copy(unsigned num, expr const * es, buffer<expr> & r, unsigned num_threads) {
+    sharing_stats stats;
+    stats.m_num_cells_before = get_num_cells(num, es, &stats.m_size_before);
+    copy_table table;
+    std::vector<deep_copy_fn> fns(get_parallel_for_num_threads(num, num_threads), deep_copy_fn(&table));
+    r.clear();
+    r.resize(num);
+    parallel_for(num, num_threads, [&](unsigned i, unsigned w) { r[i] = fns[w](es[i]); });
+    stats.m_num_cells_after = get_num_cells(num, r.data(), &stats.m_size_after);
+    return stats;
+}
 }
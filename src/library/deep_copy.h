@@ -5,7 +5,9 @@ Released under Apache 2.0 license as described in the file LICENSE.
 Author: Leonardo de Moura
 */
 #pragma once
+#include "util/buffer.h"
 #include "kernel/expr.h"
+#include "kernel/max_sharing.h"
 
 namespace lean {
 /**
@@ -13,4 +15,14 @@ namespace lean {
     argument, but does not share any memory cell with it.
 */
 expr deep_copy(expr const & e);
+
+/**
+    \brief Batch version of \c deep_copy. Store in \c r copies of <tt>es[0], ..., es[num-1]</tt> that do not
+    share any memory cell with them. A cell shared by different roots is copied only once, and the copy is
+    shared by the results.
+
+    The roots are distributed over \c num_threads threads (0 means one per hardware thread) that
+    share a concurrent table mapping the cells copied so far to their copies.
+*/
+sharing_stats deep_copy(unsigned num, expr const * es, buffer<expr> & r, unsigned num_threads = 0);
 }
@@ -0,0 +1,165 @@
+/*
+Copyright (c) 2014 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+
+Author: Leonardo de Moura
+*/
+#include "util/sstream.h"
+#include "library/discr_tree.h"
+#include "library/kernel_bindings.h"
+
+namespace lean {
+int cmp(discr_tree_key const & k1, discr_tree_key const & k2) {
+    if (k1.m_kind != k2.m_kind)
+        return k1.m_kind < k2.m_kind ? -1 : 1;
+    if (k1.m_arity != k2.m_arity)
+        return k1.m_arity < k2.m_arity ? -1 : 1;
+    switch (k1.m_kind) {
+    case discr_tree_key_kind::Constant:
+        return quick_cmp(k1.m_name, k2.m_name);
+    case discr_tree_key_kind::Var:
+        return k1.m_idx == k2.m_idx ? 0 : (k1.m_idx < k2.m_idx ? -1 : 1);
+    case discr_tree_key_kind::Star: case discr_tree_key_kind::Sort: case discr_tree_key_kind::Other:
+        return 0;
+    }
+    lean_unreachable(); // LCOV_EXCL_LINE
+}
+
+std::ostream & operator<<(std::ostream & out, discr_tree_key const & k) {
+    switch (k.m_kind) {
+    case discr_tree_key_kind::Star:     out << "*"; break;
+    case discr_tree_key_kind::Constant: out << k.m_name << "/" << k.m_arity; break;
+    case discr_tree_key_kind::Var:      out << "#" << k.m_idx << "/" << k.m_arity; break;
+    case discr_tree_key_kind::Sort:     out << "Sort"; break;
+    case discr_tree_key_kind::Other:    out << "Other"; break;
+    }
+    return out;
+}
+
+static discr_tree_key get_key(expr const & e, unsigned & nargs) {
+    expr const * f = &e;
+    nargs = 0;
+    while (is_app(*f)) {
+        f = &app_fn(*f);
+        nargs++;
+    }
+    switch (f->kind()) {
+    case expr_kind::Constant:
+        return discr_tree_key(discr_tree_key_kind::Constant, const_name(*f), 0, nargs);
+    case expr_kind::Var:
+        return discr_tree_key(discr_tree_key_kind::Var, name(), var_idx(*f), nargs);
+    case expr_kind::Meta: case expr_kind::Local:
+        nargs = 0;
+        return discr_tree_key(discr_tree_key_kind::Star);
+    case expr_kind::Sort:
+        return discr_tree_key(discr_tree_key_kind::Sort);
+    case expr_kind::Lambda: case expr_kind::Pi: case expr_kind::Let: case expr_kind::Macro: case expr_kind::App:
+        nargs = 0;
+        return discr_tree_key(discr_tree_key_kind::Other);
+    }
+    lean_unreachable(); // LCOV_EXCL_LINE
+}
+
+template<bool Next>
+static void get_keys(expr const & e, buffer<discr_tree_key> & r, buffer<unsigned> & next) {
+    unsigned nargs;
+    r.push_back(get_key(e, nargs));
+    unsigned i = 0;
+    if (Next) {
+        i = next.size();
+        next.push_back(0);
+    }
+    if (nargs > 0) {
+        buffer<expr> args;
+        get_app_args(e, args);
+        for (expr const & a : args)
+            get_keys<Next>(a, r, next);
+    }
+    if (Next)
+        next[i] = r.size();
+}
+
+void get_discr_tree_keys(expr const & e, buffer<discr_tree_key> & r) {
+    buffer<unsigned> next;
+    get_keys<false>(e, r, next);
+}
+
+void get_discr_tree_keys(expr const & e, buffer<discr_tree_key> & r, buffer<unsigned> & next) {
+    get_keys<true>(e, r, next);
+}
+
+DECL_UDATA(expr_discr_tree)
+static int mk_discr_tree(lua_State * L) { return push_expr_discr_tree(L, expr_discr_tree()); }
+static int discr_tree_size(lua_State * L) { return push_integer(L, to_expr_discr_tree(L, 1).size()); }
+static int discr_tree_empty(lua_State * L) { return push_boolean(L, to_expr_discr_tree(L, 1).empty()); }
+static int discr_tree_insert(lua_State * L) {
+    int nargs = lua_gettop(L);
+    expr const & e = to_expr(L, 2);
+    return push_expr_discr_tree(L, insert(to_expr_discr_tree(L, 1), e, nargs == 2 ? e : to_expr(L, 3)));
+}
+static int discr_tree_erase(lua_State * L) {
+    int nargs = lua_gettop(L);
+    expr const & e = to_expr(L, 2);
+    return push_expr_discr_tree(L, erase(to_expr_discr_tree(L, 1), e, nargs == 2 ? e : to_expr(L, 3)));
+}
+static int push_values(lua_State * L, buffer<expr> const & vs) {
+    lua_newtable(L);
+    int i = 1;
+    for (expr const & v : vs) {
+        push_expr(L, v);
+        lua_rawseti(L, -2, i);
+        i++;
+    }
+    return 1;
+}
+static int discr_tree_generalizations(lua_State * L) {
+    buffer<expr> r;
+    to_expr_discr_tree(L, 1).get_generalizations(to_expr(L, 2), r);
+    return push_values(L, r);
+}
+static int discr_tree_instances(lua_State * L) {
+    buffer<expr> r;
+    to_expr_discr_tree(L, 1).get_instances(to_expr(L, 2), r);
+    return push_values(L, r);
+}
+static int discr_tree_unifiables(lua_State * L) {
+    buffer<expr> r;
+    to_expr_discr_tree(L, 1).get_unifiables(to_expr(L, 2), r);
+    return push_values(L, r);
+}
+static int discr_tree_keys(lua_State * L) {
+    buffer<discr_tree_key> ks;
+    get_discr_tree_keys(to_expr(L, 1), ks);
+    lua_newtable(L);
+    int i = 1;
+    for (discr_tree_key const & k : ks) {
+        lua_pushstring(L, (sstream() << k).str().c_str());
+        lua_rawseti(L, -2, i);
+        i++;
+    }
+    return 1;
+}
+
+static const struct luaL_Reg expr_discr_tree_m[] = {
+    {"__gc",            expr_discr_tree_gc}, // never throws
+    {"size",            safe_function<discr_tree_size>},
+    {"empty",           safe_function<discr_tree_empty>},
+    {"insert",          safe_function<discr_tree_insert>},
+    {"erase",           safe_function<discr_tree_erase>},
+    {"generalizations", safe_function<discr_tree_generalizations>},
+    {"instances",       safe_function<discr_tree_instances>},
+    {"unifiables",      safe_function<discr_tree_unifiables>},
+    {0, 0}
+};
+
+void open_discr_tree(lua_State * L) {
+    luaL_newmetatable(L, expr_discr_tree_mt);
+    lua_pushvalue(L, -1);
+    lua_setfield(L, -2, "__index");
+    setfuncs(L, expr_discr_tree_m, 0);
+
+    SET_GLOBAL_FUN(mk_discr_tree,         "discr_tree");
+    SET_GLOBAL_FUN(expr_discr_tree_pred,  "is_discr_tree");
+    SET_GLOBAL_FUN(discr_tree_keys,       "discr_tree_keys");
+}
+}
@@ -0,0 +1,204 @@
+/*
+Copyright (c) 2014 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+
+Author: Leonardo de Moura
+*/
+#pragma once
+#include <algorithm>
+#include "util/rb_map.h"
+#include "util/list_fn.h"
+#include "util/buffer.h"
+#include "util/lua.h"
+#include "kernel/expr.h"
+
+namespace lean {
+enum class discr_tree_key_kind { Star, Constant, Var, Sort, Other };
+
+/**
+   \brief Keys used to index terms in discrimination trees. A term is represented by the sequence of keys
+   of its subterms in preorder. The arity of a key is the number of subterms represented by the keys that
+   follow it.
+
+   - <tt>(c a_1 ... a_n)</tt> where \c c is a constant is mapped to the key <tt>c/n</tt> followed by the keys of a_1 ... a_n.
+   - <tt>(x a_1 ... a_n)</tt> where \c x is a free variable is mapped to <tt>#i/n</tt> followed by the keys of a_1 ... a_n.
+   - Metavariables and local constants (and their applications) are mapped to the wildcard \c *.
+   - Sorts are mapped to \c Sort, and all other terms (binders, let-expressions, macros, ...) to \c Other.
+     That is, levels and the structure of these terms are ignored.
+*/
+class discr_tree_key {
+    discr_tree_key_kind m_kind;
+    name                m_name;  // name of the constant
+    unsigned            m_idx;   // index of the free variable
+    unsigned            m_arity;
+public:
+    discr_tree_key(discr_tree_key_kind k = discr_tree_key_kind::Star, name const & n = name(), unsigned idx = 0, unsigned arity = 0):
+        m_kind(k), m_name(n), m_idx(idx), m_arity(arity) {}
+    discr_tree_key_kind kind() const { return m_kind; }
+    bool is_star() const { return m_kind == discr_tree_key_kind::Star; }
+    name const & get_name() const { return m_name; }
+    unsigned get_idx() const { return m_idx; }
+    unsigned get_arity() const { return m_arity; }
+    friend int cmp(discr_tree_key const & k1, discr_tree_key const & k2);
+    friend std::ostream & operator<<(std::ostream & out, discr_tree_key const & k);
+};
+struct discr_tree_key_cmp { int operator()(discr_tree_key const & k1, discr_tree_key const & k2) const { return cmp(k1, k2); } };
+
+/** \brief Store in \c r the keys of \c e (in preorder). */
+void get_discr_tree_keys(expr const & e, buffer<discr_tree_key> & r);
+
+/**
+   \brief Store in \c r the keys of \c e, and in \c next the position after the subterm that starts at each key.
+   That is, the keys of the subterm starting at <tt>r[i]</tt> are <tt>r[i], ..., r[next[i]-1]</tt>.
+*/
+void get_discr_tree_keys(expr const & e, buffer<discr_tree_key> & r, buffer<unsigned> & next);
+
+/**
+   \brief Persistent discrimination tree. It maps terms (aka patterns) to values of type \c T.
+   Metavariables and local constants occurring in the patterns and queries are wildcards.
+
+   The retrieval operations are filters: they return a superset of the values associated with
+   the patterns that match/unify with the query, since the keys ignore some of the term structure
+   (e.g., universe levels, binders, and non-linear occurrences of wildcards).
+*/
+template<typename T>
+class discr_tree {
+    struct node;
+    typedef rb_map<discr_tree_key, node, discr_tree_key_cmp> children;
+    struct node {
+        children m_children;
+        list<T>  m_values;
+        bool empty() const { return m_children.empty() && is_nil(m_values); }
+    };
+    enum class mode { Generalizations, Instances, Unifiables };
+    node     m_root;
+    unsigned m_size;
+
+    static bool contains(list<T> const & l, T const & v) {
+        return std::find(l.begin(), l.end(), v) != l.end();
+    }
+
+    static node insert(node const & n, discr_tree_key const * it, discr_tree_key const * end, T const & v, bool & added) {
+        node r = n;
+        if (it == end) {
+            if (!contains(r.m_values, v)) {
+                r.m_values = cons(v, r.m_values);
+                added = true;
+            }
+        } else {
+            node const * c = n.m_children.find(*it);
+            r.m_children.insert(*it, insert(c ? *c : node(), it+1, end, v, added));
+        }
+        return r;
+    }
+
+    static node erase(node const & n, discr_tree_key const * it, discr_tree_key const * end, T const & v, bool & erased) {
+        node r = n;
+        if (it == end) {
+            if (contains(r.m_values, v)) {
+                r.m_values = filter(r.m_values, [&](T const & w) { return !(w == v); });
+                erased = true;
+            }
+        } else if (node const * c = n.m_children.find(*it)) {
+            node new_c = erase(*c, it+1, end, v, erased);
+            if (new_c.empty())
+                r.m_children.erase(*it);
+            else
+                r.m_children.insert(*it, new_c);
+        }
+        return r;
+    }
+
+    /** \brief Apply \c fn to the nodes reached from \c n after consuming \c k complete subterms. */
+    template<typename F>
+    static void skip(node const & n, unsigned k, F && fn) {
+        if (k == 0) {
+            fn(n);
+        } else {
+            n.m_children.for_each([&](discr_tree_key const & key, node const & c) {
+                    skip(c, k - 1 + key.get_arity(), fn);
+                });
+        }
+    }
+
+    template<typename F>
+    static void find(node const & n, buffer<discr_tree_key> const & keys, buffer<unsigned> const & next,
+                     unsigned i, mode m, F && fn) {
+        if (i == keys.size()) {
+            for (T const & v : n.m_values)
+                fn(v);
+            return;
+        }
+        discr_tree_key const & k = keys[i];
+        if (m != mode::Instances) {
+            // wildcards in the patterns match any subterm of the query
+            if (node const * c = n.m_children.find(discr_tree_key()))
+                find(*c, keys, next, next[i], m, fn);
+        }
+        if (k.is_star()) {
+            if (m != mode::Generalizations) {
+                // wildcards in the query match any subterm of the patterns
+                n.m_children.for_each([&](discr_tree_key const & key, node const & c) {
+                        if (m == mode::Instances || !key.is_star())
+                            skip(c, key.get_arity(), [&](node const & r) { find(r, keys, next, i+1, m, fn); });
+                    });
+            }
+        } else if (node const * c = n.m_children.find(k)) {
+            find(*c, keys, next, i+1, m, fn);
+        }
+    }
+
+    template<typename F>
+    void find(expr const & e, mode m, F && fn) const {
+        buffer<discr_tree_key> keys;
+        buffer<unsigned>       next;
+        get_discr_tree_keys(e, keys, next);
+        find(m_root, keys, next, 0, m, fn);
+    }
+
+public:
+    discr_tree():m_size(0) {}
+
+    /** \brief Return the number of (pattern, value) pairs stored in the tree. */
+    unsigned size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+
+    /** \brief Associate the value \c v with the pattern \c e. */
+    void insert(expr const & e, T const & v) {
+        buffer<discr_tree_key> keys;
+        get_discr_tree_keys(e, keys);
+        bool added = false;
+        m_root = insert(m_root, keys.begin(), keys.end(), v, added);
+        if (added)
+            m_size++;
+    }
+
+    /** \brief Remove the value \c v associated with the pattern \c e. */
+    void erase(expr const & e, T const & v) {
+        buffer<discr_tree_key> keys;
+        get_discr_tree_keys(e, keys);
+        bool erased = false;
+        m_root = erase(m_root, keys.begin(), keys.end(), v, erased);
+        if (erased)
+            m_size--;
+    }
+
+    /** \brief Apply \c fn to the values associated with patterns that may match \c e (i.e., the generalizations of \c e). */
+    template<typename F> void for_each_generalization(expr const & e, F && fn) const { find(e, mode::Generalizations, fn); }
+    /** \brief Apply \c fn to the values associated with patterns that \c e may match (i.e., the instances of \c e). */
+    template<typename F> void for_each_instance(expr const & e, F && fn) const { find(e, mode::Instances, fn); }
+    /** \brief Apply \c fn to the values associated with patterns that may be unifiable with \c e. */
+    template<typename F> void for_each_unifiable(expr const & e, F && fn) const { find(e, mode::Unifiables, fn); }
+
+    void get_generalizations(expr const & e, buffer<T> & r) const { for_each_generalization(e, [&](T const & v) { r.push_back(v); }); }
+    void get_instances(expr const & e, buffer<T> & r) const { for_each_instance(e, [&](T const & v) { r.push_back(v); }); }
+    void get_unifiables(expr const & e, buffer<T> & r) const { for_each_unifiable(e, [&](T const & v) { r.push_back(v); }); }
+};
+
+template<typename T> discr_tree<T> insert(discr_tree<T> const & t, expr const & e, T const & v) { auto r = t; r.insert(e, v); return r; }
+template<typename T> discr_tree<T> erase(discr_tree<T> const & t, expr const & e, T const & v) { auto r = t; r.erase(e, v); return r; }
+
+typedef discr_tree<expr> expr_discr_tree;
+UDATA_DEFS_CORE(expr_discr_tree)
+void open_discr_tree(lua_State * L);
+}
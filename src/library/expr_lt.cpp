@@ -4,66 +4,136 @@ Released under Apache 2.0 license as described in the file LICENSE.
 
 Author: Leonardo de Moura
 */
+#include <algorithm>
+#include <memory>
+#include <utility>
+#include <vector>
+#include "util/interrupt.h"
 #include "kernel/expr.h"
+#include "kernel/expr_sets.h"
 #include "library/expr_lt.h"
 
 namespace lean {
-bool is_lt(expr const & a, expr const & b, bool use_hash) {
-    if (is_eqp(a, b))                    return false;
-    unsigned da = get_depth(a);
-    unsigned db = get_depth(b);
-    if (da < db)                         return true;
-    if (da > db)                         return false;
-    if (a.kind() != b.kind())            return a.kind() < b.kind();
-    if (use_hash) {
-        if (a.hash() < b.hash())         return true;
-        if (a.hash() > b.hash())         return false;
-    }
-    if (a == b)                          return false;
-    switch (a.kind()) {
-    case expr_kind::Var:
-        return var_idx(a) < var_idx(b);
-    case expr_kind::Constant:
-        if (const_name(a) != const_name(b))
-            return const_name(a) < const_name(b);
-        else
-            return is_lt(const_level_params(a), const_level_params(b), use_hash);
-    case expr_kind::App:
-        if (app_fn(a) != app_fn(b))
-            return is_lt(app_fn(a), app_fn(b), use_hash);
-        else
-            return is_lt(app_arg(a), app_arg(b), use_hash);
-    case expr_kind::Lambda: case expr_kind::Pi:
-        if (binder_domain(a) != binder_domain(b))
-            return is_lt(binder_domain(a), binder_domain(b), use_hash);
-        else
-            return is_lt(binder_body(a), binder_body(b), use_hash);
-    case expr_kind::Sort:
-        return is_lt(sort_level(a), sort_level(b), use_hash);
-    case expr_kind::Let:
-        if (let_type(a) != let_type(b)) {
-            return is_lt(let_type(a), let_type(b), use_hash);
-        } else if (let_value(a) != let_value(b)){
-            return is_lt(let_value(a), let_value(b), use_hash);
-        } else {
-            return is_lt(let_body(a), let_body(b), use_hash);
+/** \brief Three-way version of \c is_lt for pairs of levels, and lists of levels. */
+template<typename T> static int cmp_levels(T const & a, T const & b, bool use_hash) {
+    if (is_lt(a, b, use_hash))
+        return -1;
+    else if (is_lt(b, a, use_hash))
+        return 1;
+    else
+        return 0;
+}
+
+/**
+   \brief Functional object for comparing expressions using the total order described at \c is_lt.
+
+   It performs a three-way comparison, and the comparison of two subterms is resumed at the first pair of
+   subterms that are not structurally equal. Thus, we do not need to test the subterms for
+   equality before comparing them. Pairs of shared cells that are known to be structurally equal
+   are cached to avoid an exponential blowup on terms with a lot of sharing (see \c expr_eq_fn).
+*/
+class expr_cmp_fn {
+    bool                                 m_use_hash;
+    std::unique_ptr<expr_cell_pair_set>  m_eq_visited;
+
+    int apply(expr const & a, expr const & b, bool root) {
+        if (is_eqp(a, b))                    return 0;
+        uint64 ka = get_lt_key(a);
+        uint64 kb = get_lt_key(b);
+        if (!m_use_hash) {
+            // ignore the hash code stored in the lower 32 bits
+            ka >>= 32;
+            kb >>= 32;
+        }
+        if (ka != kb)                        return ka < kb ? -1 : 1;
+        check_system("expression order test");
+        switch (a.kind()) {
+        case expr_kind::Var:
+            return var_idx(a) == var_idx(b) ? 0 : (var_idx(a) < var_idx(b) ? -1 : 1);
+        case expr_kind::Constant:
+            if (int r = cmp(const_name(a), const_name(b)))
+                return r;
+            return cmp_levels(const_level_params(a), const_level_params(b), m_use_hash);
+        case expr_kind::Sort:
+            return cmp_levels(sort_level(a), sort_level(b), m_use_hash);
+        case expr_kind::Local: case expr_kind::Meta:
+            if (int r = cmp(mlocal_name(a), mlocal_name(b)))
+                return r;
+            return apply(mlocal_type(a), mlocal_type(b), false);
+        case expr_kind::App: case expr_kind::Lambda: case expr_kind::Pi:
+        case expr_kind::Let: case expr_kind::Macro:
+            break;
         }
-    case expr_kind::Local: case expr_kind::Meta:
-        if (mlocal_name(a) != mlocal_name(b))
-            return mlocal_name(a) < mlocal_name(b);
-        else
-            return is_lt(mlocal_type(a), mlocal_type(b), use_hash);
-    case expr_kind::Macro:
-        if (macro_def(a) != macro_def(b))
-            return macro_def(a) < macro_def(b);
-        if (macro_num_args(a) != macro_num_args(b))
-            return macro_num_args(a) < macro_num_args(b);
-        for (unsigned i = 0; i < macro_num_args(a); i++) {
-            if (macro_arg(a, i) != macro_arg(b, i))
-                return is_lt(macro_arg(a, i), macro_arg(b, i), use_hash);
+        // composite terms: the root pair is never visited again
+        bool cache = !root && is_shared(a) && is_shared(b);
+        if (cache && m_eq_visited && m_eq_visited->find(std::make_pair(a.raw(), b.raw())) != m_eq_visited->end())
+            return 0;
+        int r = apply_composite(a, b);
+        if (r == 0 && cache) {
+            if (!m_eq_visited)
+                m_eq_visited.reset(new expr_cell_pair_set);
+            m_eq_visited->insert(std::make_pair(a.raw(), b.raw()));
         }
-        return false;
+        return r;
     }
-    lean_unreachable(); // LCOV_EXCL_LINE
+
+    int apply_composite(expr const & a, expr const & b) {
+        switch (a.kind()) {
+        case expr_kind::App:
+            if (int r = apply(app_fn(a), app_fn(b), false))
+                return r;
+            return apply(app_arg(a), app_arg(b), false);
+        case expr_kind::Lambda: case expr_kind::Pi:
+            if (int r = apply(binder_domain(a), binder_domain(b), false))
+                return r;
+            return apply(binder_body(a), binder_body(b), false);
+        case expr_kind::Let:
+            if (int r = apply(let_type(a), let_type(b), false))
+                return r;
+            if (int r = apply(let_value(a), let_value(b), false))
+                return r;
+            return apply(let_body(a), let_body(b), false);
+        case expr_kind::Macro:
+            if (macro_def(a) != macro_def(b))
+                return macro_def(a) < macro_def(b) ? -1 : 1;
+            if (macro_num_args(a) != macro_num_args(b))
+                return macro_num_args(a) < macro_num_args(b) ? -1 : 1;
+            for (unsigned i = 0; i < macro_num_args(a); i++) {
+                if (int r = apply(macro_arg(a, i), macro_arg(b, i), false))
+                    return r;
+            }
+            return 0;
+        case expr_kind::Var: case expr_kind::Constant: case expr_kind::Sort:
+        case expr_kind::Local: case expr_kind::Meta:
+            break;
+        }
+        lean_unreachable(); // LCOV_EXCL_LINE
+    }
+public:
+    expr_cmp_fn(bool use_hash):m_use_hash(use_hash) {}
+    int operator()(expr const & a, expr const & b) { return apply(a, b, true); }
+};
+
+bool is_lt(expr const & a, expr const & b, bool use_hash) {
+    return expr_cmp_fn(use_hash)(a, b) < 0;
+}
+
+void sort_exprs(unsigned num, expr * es) {
+    typedef std::pair<uint64, unsigned> entry;
+    std::vector<entry> entries;
+    entries.reserve(num);
+    for (unsigned i = 0; i < num; i++)
+        entries.emplace_back(get_lt_key(es[i]), i);
+    std::sort(entries.begin(), entries.end(), [&](entry const & e1, entry const & e2) {
+            if (e1.first != e2.first)
+                return e1.first < e2.first;
+            // same key, use the structural comparison as a tiebreak
+            return is_lt(es[e1.second], es[e2.second], true);
+        });
+    std::vector<expr> tmp;
+    tmp.reserve(num);
+    for (entry const & e : entries)
+        tmp.push_back(es[e.second]);
+    std::move(tmp.begin(), tmp.end(), es);
 }
 }
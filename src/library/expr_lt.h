@@ -5,8 +5,26 @@ Released under Apache 2.0 license as described in the file LICENSE.
 Author: Leonardo de Moura
 */
 #pragma once
+#include "util/int64.h"
 #include "kernel/expr.h"
 namespace lean {
+/**
+    \brief Return the ordering key of \c e. It packs the depth (16 bits), kind (4 bits) and
+    structural hash code (32 bits) of \c e into a 64-bit rank.
+
+    The key is consistent with \c is_lt: if the keys of \c a and \c b are different, then
+    <tt>is_lt(a, b, true)</tt> iff <tt>get_lt_key(a) < get_lt_key(b)</tt>. Moreover, if the
+    bits above the hash code are different, then the same holds for <tt>is_lt(a, b, false)</tt>.
+    Thus, comparisons of terms with different keys take constant time, and the structural
+    comparison is only used as a tiebreak.
+
+    \remark The depth and hash code are computed when the expression is created and are
+    cached in the cell, so the key does not require any extra storage.
+*/
+inline uint64 get_lt_key(expr const & e) {
+    return (static_cast<uint64>(get_depth(e)) << 36) | (static_cast<uint64>(e.kind()) << 32) | e.hash();
+}
+
 /**
     \brief Total order on expressions.
 
@@ -19,4 +37,12 @@ inline bool operator<(expr const & a, expr const & b)  { return is_lt(a, b, true
 inline bool operator>(expr const & a, expr const & b)  { return is_lt(b, a, true); }
 inline bool operator<=(expr const & a, expr const & b) { return !is_lt(b, a, true); }
 inline bool operator>=(expr const & a, expr const & b) { return !is_lt(a, b, true); }
+
+/**
+    \brief Sort the expressions <tt>es[0], ..., es[num-1]</tt> using the total order \c operator<.
+
+    The ordering keys are computed once, and stored next to the position of each expression.
+    So, most comparisons performed by the sorting algorithm do not even access the expression cells.
+*/
+void sort_exprs(unsigned num, expr * es);
 }
@@ -12,6 +12,7 @@ Author: Leonardo de Moura
 #include "util/lua_pair.h"
 #include "util/lua_named_param.h"
 #include "util/luaref.h"
+#include "util/step_budget.h"
 #include "kernel/abstract.h"
 #include "kernel/for_each_fn.h"
 #include "kernel/free_vars.h"
@@ -28,7 +29,6 @@ Author: Leonardo de Moura
 // bindings in the kernel because we do not want to inflate the Kernel.
 
 namespace lean {
-static environment get_global_environment(lua_State * L);
 io_state * get_io_state(lua_State * L);
 
 // Level
@@ -885,6 +885,47 @@ static int mk_empty_environment(lua_State * L) {
     return push_environment(L, environment(trust_lvl, proof_irrel, eta, impredicative));
 }
 static int environment_forget(lua_State * L) { return push_environment(L, to_environment(L, 1).forget()); }
+static int environment_dependencies(lua_State * L) { return push_name_set(L, to_environment(L, 1).get_dependencies(to_name_ext(L, 2))); }
+static int environment_dependents(lua_State * L) { return push_name_set(L, to_environment(L, 1).get_dependents(to_name_ext(L, 2))); }
+static int environment_transitive_dependents(lua_State * L) {
+    buffer<name> ns;
+    if (lua_istable(L, 2)) {
+        for (name const & n : table_to_list<name>(L, 2, to_name_ext))
+            ns.push_back(n);
+    } else {
+        ns.push_back(to_name_ext(L, 2));
+    }
+    buffer<name> r;
+    to_environment(L, 1).get_transitive_dependents(ns.size(), ns.data(), r);
+    return push_list_name(L, to_list(r.begin(), r.end()));
+}
+static int environment_remove(lua_State * L) { return push_environment(L, to_environment(L, 1).remove(to_name_set(L, 2))); }
+static int environment_enable_head_index(lua_State * L) { return push_environment(L, to_environment(L, 1).enable_head_index()); }
+static int environment_has_head_index(lua_State * L) { return push_boolean(L, to_environment(L, 1).has_head_index()); }
+static int environment_definitions_with_head(lua_State * L) {
+    return push_name_set(L, to_environment(L, 1).get_definitions_with_head(to_name_ext(L, 2)));
+}
+static int environment_compact(lua_State * L) {
+    int nargs = lua_gettop(L);
+    compact_report r;
+    push_environment(L, to_environment(L, 1).compact(r, nargs == 1 ? 0 : lua_tointeger(L, 2)));
+    lua_newtable(L);
+    push_integer(L, r.m_num_definitions);
+    lua_setfield(L, -2, "definitions");
+    push_integer(L, r.m_num_cells_before);
+    lua_setfield(L, -2, "cells_before");
+    push_integer(L, r.m_num_cells_after);
+    lua_setfield(L, -2, "cells_after");
+    push_integer(L, r.m_size_before);
+    lua_setfield(L, -2, "size_before");
+    push_integer(L, r.m_size_after);
+    lua_setfield(L, -2, "size_after");
+    push_integer(L, r.m_num_names);
+    lua_setfield(L, -2, "names");
+    push_integer(L, r.m_num_levels);
+    lua_setfield(L, -2, "levels");
+    return 2;
+}
 
 static const struct luaL_Reg environment_m[] = {
     {"__gc",              environment_gc}, // never throws
@@ -902,6 +943,14 @@ static const struct luaL_Reg environment_m[] = {
     {"add",               safe_function<environment_add>},
     {"replace",           safe_function<environment_replace>},
     {"forget",            safe_function<environment_forget>},
+    {"dependencies",      safe_function<environment_dependencies>},
+    {"dependents",        safe_function<environment_dependents>},
+    {"transitive_dependents", safe_function<environment_transitive_dependents>},
+    {"remove",            safe_function<environment_remove>},
+    {"enable_head_index", safe_function<environment_enable_head_index>},
+    {"has_head_index",    safe_function<environment_has_head_index>},
+    {"definitions_with_head", safe_function<environment_definitions_with_head>},
+    {"compact",           safe_function<environment_compact>},
     {0, 0}
 };
 
@@ -924,7 +973,7 @@ set_environment::~set_environment() {
     lua_settable(m_state, LUA_REGISTRYINDEX);
 }
 
-static environment get_global_environment(lua_State * L) {
+environment get_global_environment(lua_State * L) {
     lua_pushlightuserdata(L, static_cast<void *>(&g_set_environment_key));
     lua_gettable(L, LUA_REGISTRYINDEX);
     if (!is_environment(L, -1))
@@ -938,6 +987,11 @@ int get_environment(lua_State * L) {
     return push_environment(L, get_global_environment(L));
 }
 
+static int set_environment_core(lua_State * L) {
+    set_global_environment(L, to_environment(L, 1));
+    return 0;
+}
+
 static void environment_migrate(lua_State * src, int i, lua_State * tgt) {
     push_environment(tgt, to_environment(src, i));
 }
@@ -953,6 +1007,8 @@ static void open_environment(lua_State * L) {
     SET_GLOBAL_FUN(environment_pred,       "is_environment");
     SET_GLOBAL_FUN(get_environment,        "get_environment");
     SET_GLOBAL_FUN(get_environment,        "get_env");
+    SET_GLOBAL_FUN(set_environment_core,   "set_environment");
+    SET_GLOBAL_FUN(set_environment_core,   "set_env");
 }
 
 // IO state
@@ -1407,19 +1463,37 @@ static void open_substitution(lua_State * L) {
 // constraint_handler
 class lua_constraint_handler : public constraint_handler {
     luaref m_f;
+    bool   m_batch; // if true, m_f receives a table of constraints
 public:
-    lua_constraint_handler(luaref const & f):m_f(f) {}
+    lua_constraint_handler(luaref const & f, bool batch):m_f(f), m_batch(batch) {}
     virtual void add_cnstr(constraint const & c) {
+        add_cnstrs(1, &c);
+    }
+    virtual bool batch_cnstrs() const { return m_batch; }
+    virtual void add_cnstrs(unsigned num, constraint const * cs) {
         lua_State * L = m_f.get_state();
-        m_f.push();
-        push_constraint(L, c);
-        pcall(L, 1, 0, 0);
+        if (m_batch) {
+            m_f.push();
+            lua_createtable(L, num, 0);
+            for (unsigned i = 0; i < num; i++) {
+                push_constraint(L, cs[i]);
+                lua_rawseti(L, -2, i + 1);
+            }
+            pcall(L, 1, 0, 0);
+        } else {
+            for (unsigned i = 0; i < num; i++) {
+                m_f.push();
+                push_constraint(L, cs[i]);
+                pcall(L, 1, 0, 0);
+            }
+        }
     }
 };
 DECL_UDATA(lua_constraint_handler)
 int mk_constraint_handler(lua_State * L) {
     luaL_checktype(L, 1, LUA_TFUNCTION); // user-fun
-    return push_lua_constraint_handler(L, lua_constraint_handler(luaref(L, 1)));
+    bool batch = lua_gettop(L) >= 2 && lua_toboolean(L, 2);
+    return push_lua_constraint_handler(L, lua_constraint_handler(luaref(L, 1), batch));
 }
 
 static const struct luaL_Reg lua_constraint_handler_m[] = {
@@ -1441,10 +1515,12 @@ static void open_constraint_handler(lua_State * L) {
 typedef std::shared_ptr<type_checker> type_checker_ref;
 DECL_UDATA(type_checker_ref)
 
-static void get_type_checker_args(lua_State * L, int idx, optional<module_idx> & mod_idx, bool & memoize, name_set & extra_opaque) {
+static void get_type_checker_args(lua_State * L, int idx, optional<module_idx> & mod_idx, bool & memoize, name_set & extra_opaque,
+                                  unsigned & max_steps) {
     mod_idx      = get_opt_uint_named_param(L, idx, "module_idx", optional<module_idx>());
     memoize      = get_bool_named_param(L, idx, "memoize", true);
     extra_opaque = get_name_set_named_param(L, idx, "extra_opaque", name_set());
+    max_steps    = get_uint_named_param(L, idx, "max_steps", get_default_max_steps());
 }
 
 int mk_type_checker(lua_State * L) {
@@ -1457,24 +1533,27 @@ int mk_type_checker(lua_State * L) {
         return push_type_checker_ref(L, std::make_shared<type_checker>(to_environment(L, 1), to_name_generator(L, 2),
                                                                        to_lua_constraint_handler(L, 3)));
     } else {
-        optional<module_idx> mod_idx; bool memoize; name_set extra_opaque;
+        optional<module_idx> mod_idx; bool memoize; name_set extra_opaque; unsigned max_steps;
         if (nargs == 3) {
-            get_type_checker_args(L, 3, mod_idx, memoize, extra_opaque);
+            get_type_checker_args(L, 3, mod_idx, memoize, extra_opaque, max_steps);
             auto t = std::make_shared<type_checker>(to_environment(L, 1), to_name_generator(L, 2),
                                                     mk_default_converter(to_environment(L, 1), mod_idx, memoize, extra_opaque),
                                                     memoize);
+            t->set_max_steps(max_steps);
             return push_type_checker_ref(L, t);
         } else {
-            get_type_checker_args(L, 4, mod_idx, memoize, extra_opaque);
+            get_type_checker_args(L, 4, mod_idx, memoize, extra_opaque, max_steps);
             auto t = std::make_shared<type_checker>(to_environment(L, 1), to_name_generator(L, 2),
                                                     to_lua_constraint_handler(L, 3),
                                                     mk_default_converter(to_environment(L, 1), mod_idx, memoize, extra_opaque),
                                                     memoize);
+            t->set_max_steps(max_steps);
             return push_type_checker_ref(L, t);
         }
     }
 }
 int type_checker_whnf(lua_State * L) { return push_expr(L, to_type_checker_ref(L, 1)->whnf(to_expr(L, 2))); }
+int type_checker_normalize(lua_State * L) { return push_expr(L, to_type_checker_ref(L, 1)->normalize(to_expr(L, 2))); }
 int type_checker_ensure_pi(lua_State * L) { return push_expr(L, to_type_checker_ref(L, 1)->ensure_pi(to_expr(L, 2))); }
 int type_checker_ensure_sort(lua_State * L) { return push_expr(L, to_type_checker_ref(L, 1)->ensure_sort(to_expr(L, 2))); }
 int type_checker_check(lua_State * L) {
@@ -1487,16 +1566,49 @@ int type_checker_check(lua_State * L) {
 int type_checker_infer(lua_State * L) { return push_expr(L, to_type_checker_ref(L, 1)->infer(to_expr(L, 2))); }
 int type_checker_is_def_eq(lua_State * L) { return push_boolean(L, to_type_checker_ref(L, 1)->is_def_eq(to_expr(L, 2), to_expr(L, 3))); }
 int type_checker_is_prop(lua_State * L) { return push_boolean(L, to_type_checker_ref(L, 1)->is_prop(to_expr(L, 2))); }
+static void set_stat_field(lua_State * L, char const * name, double v) {
+    lua_pushnumber(L, v);
+    lua_setfield(L, -2, name);
+}
+int type_checker_get_stats(lua_State * L) {
+    type_checker_stats s = to_type_checker_ref(L, 1)->get_stats();
+    lua_newtable(L);
+    set_stat_field(L, "infer",          s.m_infer);
+    set_stat_field(L, "infer_hits",     s.m_infer_hits);
+    set_stat_field(L, "cnstrs",         s.m_cnstrs);
+    set_stat_field(L, "infer_struct_fallbacks", s.m_infer_struct_fallbacks);
+    set_stat_field(L, "whnf_core",      s.m_conv.m_whnf_core);
+    set_stat_field(L, "whnf_core_hits", s.m_conv.m_whnf_core_hits);
+    set_stat_field(L, "whnf",           s.m_conv.m_whnf);
+    set_stat_field(L, "whnf_hits",      s.m_conv.m_whnf_hits);
+    set_stat_field(L, "delta",          s.m_conv.m_delta);
+    set_stat_field(L, "norm_ext",       s.m_conv.m_norm_ext);
+    set_stat_field(L, "macro_expand",   s.m_conv.m_macro_expand);
+    set_stat_field(L, "is_def_eq",      s.m_conv.m_is_def_eq);
+    set_stat_field(L, "is_def_eq_time", s.m_conv.m_is_def_eq_time);
+    set_stat_field(L, "struct_fallbacks", s.m_conv.m_struct_fallbacks);
+    return 1;
+}
+int type_checker_reset_stats(lua_State * L) { to_type_checker_ref(L, 1)->reset_stats(); return 0; }
+int type_checker_set_max_steps(lua_State * L) { to_type_checker_ref(L, 1)->set_max_steps(luaL_checkinteger(L, 2)); return 0; }
+int type_checker_num_steps(lua_State * L) { return push_integer(L, to_type_checker_ref(L, 1)->get_num_steps()); }
+static int set_default_max_steps(lua_State * L) { set_default_max_steps(luaL_checkinteger(L, 1)); return 0; }
+static int get_default_max_steps(lua_State * L) { return push_integer(L, get_default_max_steps()); }
 
 static const struct luaL_Reg type_checker_ref_m[] = {
     {"__gc",        type_checker_ref_gc},
     {"whnf",        safe_function<type_checker_whnf>},
+    {"normalize",   safe_function<type_checker_normalize>},
     {"ensure_pi",   safe_function<type_checker_ensure_pi>},
     {"ensure_sort", safe_function<type_checker_ensure_sort>},
     {"check",       safe_function<type_checker_check>},
     {"infer",       safe_function<type_checker_infer>},
     {"is_def_eq",   safe_function<type_checker_is_def_eq>},
     {"is_prop",     safe_function<type_checker_is_prop>},
+    {"stats",       safe_function<type_checker_get_stats>},
+    {"reset_stats", safe_function<type_checker_reset_stats>},
+    {"set_max_steps", safe_function<type_checker_set_max_steps>},
+    {"num_steps",   safe_function<type_checker_num_steps>},
     {0, 0}
 };
 
@@ -1528,6 +1640,17 @@ static int add_declaration(lua_State * L) {
     return push_environment(L, to_environment(L, 1).add(*d));
 }
 
+static int recheck(lua_State * L) {
+    int nargs = lua_gettop(L);
+    buffer<definition> ds;
+    for (definition const & d : table_to_list<definition>(L, 2, to_definition))
+        ds.push_back(d);
+    name_generator g = nargs >= 3 ? to_name_generator(L, 3) : name_generator(name::mk_internal_unique_name());
+    name_set extra_opaque = nargs >= 4 ? to_name_set(L, 4) : name_set();
+    bool memoize          = nargs >= 5 ? lua_toboolean(L, 5) : true;
+    return push_environment(L, recheck(to_environment(L, 1), ds.size(), ds.data(), g, extra_opaque, memoize));
+}
+
 static void open_type_checker(lua_State * L) {
     luaL_newmetatable(L, type_checker_ref_mt);
     lua_pushvalue(L, -1);
@@ -1536,9 +1659,12 @@ static void open_type_checker(lua_State * L) {
 
     SET_GLOBAL_FUN(mk_type_checker, "type_checker");
     SET_GLOBAL_FUN(type_checker_ref_pred, "is_type_checker");
+    SET_GLOBAL_FUN(set_default_max_steps, "set_default_max_steps");
+    SET_GLOBAL_FUN(get_default_max_steps, "get_default_max_steps");
     SET_GLOBAL_FUN(type_check, "type_check");
     SET_GLOBAL_FUN(type_check, "check");
     SET_GLOBAL_FUN(add_declaration, "add_decl");
+    SET_GLOBAL_FUN(recheck, "recheck");
 }
 
 void open_kernel_module(lua_State * L) {
@@ -7,6 +7,7 @@ Author: Leonardo de Moura
 #pragma once
 #include "util/script_state.h"
 #include "library/kernel_bindings.h"
+#include "library/discr_tree.h"
 // #include "library/substitution.h"
 // #include "library/fo_unify.h"
 // #include "library/hop_match.h"
@@ -15,6 +16,7 @@ Author: Leonardo de Moura
 namespace lean {
 inline void open_core_module(lua_State * L) {
     open_kernel_module(L);
+    open_discr_tree(L);
     // open_substitution(L);
     // open_fo_unify(L);
     // open_placeholder(L);
@@ -13,17 +13,19 @@ Author: Leonardo de Moura
 #include "util/stackinfo.h"
 #include "util/debug.h"
 #include "util/interrupt.h"
+#include "util/step_budget.h"
 #include "util/script_state.h"
 #include "util/thread.h"
 #include "util/lean_path.h"
 #include "kernel/environment.h"
+#include "kernel/check_cache.h"
 #include "kernel/kernel_exception.h"
 #include "kernel/formatter.h"
+#include "library/kernel_bindings.h"
 #include "library/error_handling/error_handling.h"
 #if 0
 #include "kernel/io_state.h"
 #include "library/printer.h"
-#include "library/kernel_bindings.h"
 #include "library/io_state_stream.h"
 #include "frontends/lean/parser.h"
 #include "frontends/lean/shell.h"
@@ -75,6 +77,14 @@ static void display_help(std::ostream & out) {
     std::cout << "  --luahook=num -c  how often the Lua interpreter checks the interrupted flag,\n";
     std::cout << "                    it is useful for interrupting non-terminating user scripts,\n";
     std::cout << "                    0 means 'do not check'.\n";
+    std::cout << "  --maxsteps=num -S maximum number of steps (whnf, beta/delta reduction and replace visits)\n";
+    std::cout << "                    a type checker may perform, it makes resource limits deterministic,\n";
+    std::cout << "                    0 means 'no limit'.\n";
+    std::cout << "  --checkcache=file -k  skip type checking definitions certified in previous executions,\n";
+    std::cout << "                    the certificates are loaded from and stored in the given file,\n";
+    std::cout << "                    it is only used in trusted mode (i.e., trust level > 0).\n";
+    std::cout << "  --compact -C      rebuild the final environment using maximally shared terms, names and\n";
+    std::cout << "                    universe levels, and display a memory report\n";
     std::cout << "  --trust -t        trust imported modules\n";
     std::cout << "  --quiet -q        do not print verbose messages\n";
 #if defined(LEAN_USE_BOOST)
@@ -107,6 +117,9 @@ static struct option g_long_options[] = {
     {"luahook",    required_argument, 0, 'c'},
     {"githash",    no_argument,       0, 'g'},
     {"output",     required_argument, 0, 'o'},
+    {"maxsteps",   required_argument, 0, 'S'},
+    {"checkcache", required_argument, 0, 'k'},
+    {"compact",    no_argument,       0, 'C'},
     {"trust",      no_argument,       0, 't'},
     {"quiet",      no_argument,       0, 'q'},
 #if defined(LEAN_USE_BOOST)
@@ -123,9 +136,11 @@ int main(int argc, char ** argv) {
     // bool trust_imported = false;
     // bool quiet          = false;
     std::string output;
+    std::string check_cache_file;
+    bool compact = false;
     input_kind default_k = input_kind::Lean; // default
     while (true) {
-        int c = getopt_long(argc, argv, "qtnlupgvhc:012s:012o:", g_long_options, NULL);
+        int c = getopt_long(argc, argv, "qtnlupgvhCc:012s:012o:S:k:", g_long_options, NULL);
         if (c == -1)
             break; // end of command line
         switch (c) {
@@ -150,6 +165,15 @@ int main(int argc, char ** argv) {
         case 'c':
             script_state::set_check_interrupt_freq(atoi(optarg));
             break;
+        case 'S':
+            lean::set_default_max_steps(atoi(optarg));
+            break;
+        case 'k':
+            check_cache_file = optarg;
+            break;
+        case 'C':
+            compact = true;
+            break;
         case 'p':
             std::cout << lean::get_lean_path() << "\n";
             return 0;
@@ -184,6 +208,18 @@ int main(int argc, char ** argv) {
     // if (quiet)
     //     ios.set_option("verbose", false);
 
+    std::shared_ptr<lean::check_cache> cache;
+    if (!check_cache_file.empty()) {
+        cache = std::make_shared<lean::check_cache>();
+        try {
+            cache->load(check_cache_file);
+        } catch (lean::exception & ex) {
+            std::cerr << "Failed to load check cache '" << check_cache_file << "': " << ex.what() << "\n";
+            return 1;
+        }
+        lean::set_check_cache(cache);
+    }
+
     script_state S;
 
     // S.apply([&](lua_State * L) {
@@ -248,8 +284,17 @@ int main(int argc, char ** argv) {
                     lean_unreachable(); // LCOV_EXCL_LINE
                 }
             }
+            if (compact) {
+                S.apply([&](lua_State * L) {
+                        lean::compact_report r;
+                        lean::set_global_environment(L, lean::get_global_environment(L).compact(r));
+                        std::cout << r;
+                    });
+            }
             // if (export_objects)
             //    env->export_objects(output);
+            if (cache)
+                cache->save(check_cache_file);
             return ok ? 0 : 1;
         }
     } catch (lean::exception & ex) {
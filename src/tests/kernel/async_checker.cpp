@@ -0,0 +1,134 @@
+/*
+Copyright (c) 2014 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+
+Author: Leonardo de Moura
+*/
+#include <string>
+#include "util/test.h"
+#include "util/timeit.h"
+#include "util/sstream.h"
+#include "kernel/environment.h"
+#include "kernel/type_checker.h"
+#include "kernel/async_checker.h"
+#include "kernel/abstract.h"
+#include "kernel/kernel_exception.h"
+using namespace lean;
+
+static environment mk_env() {
+    environment env;
+    expr A = Const("A");
+    expr x = Const("x");
+    // id for propositions
+    env = env.add(check(env, mk_definition("id", param_names(), Pi(A, Bool, A >> A), Fun({{A, Bool}, {x, A}}, x))));
+    env = env.add(check(env, mk_var_decl("p", param_names(), Bool)));
+    env = env.add(check(env, mk_var_decl("q", param_names(), Bool)));
+    env = env.add(check(env, mk_var_decl("H1", param_names(), Const("p"))));
+    env = env.add(check(env, mk_var_decl("H2", param_names(), Const("q"))));
+    return env;
+}
+
+/** \brief Return a proof of \c p of size \c n */
+static expr mk_proof(unsigned n, expr const & H = Const("H1")) {
+    expr r = H;
+    for (unsigned i = 0; i < n; i++)
+        r = Const("id")(Const("p"), r);
+    return r;
+}
+
+static void tst1() {
+    environment env = mk_env();
+    name_generator g("test");
+    async_checker checker(2);
+    for (unsigned i = 0; i < 10; i++) {
+        name n(name("th"), i);
+        certified_definition c = checker.check(env, mk_theorem(n, param_names(), Const("p"), mk_proof(i)), g);
+        env = env.add(c);
+    }
+    // definitions using the theorems can be checked before the proofs are
+    env = env.add(checker.check(env, mk_definition("d", param_names(), Const("p"), Const(name(name("th"), 9))), g));
+    checker.wait_all();
+    lean_assert(checker.num_pending() == 0);
+    lean_assert(env.find(name(name("th"), 9)));
+}
+
+static void tst2() {
+    environment env = mk_env();
+    name_generator g("test");
+    async_checker checker(2);
+    env = env.add(checker.check(env, mk_theorem("ok", param_names(), Const("p"), mk_proof(10)), g));
+    // the proof is type incorrect, but the error is only reported by wait_all
+    certified_definition c = checker.check(env, mk_theorem("bad", param_names(), Const("p"), mk_proof(10, Const("H2"))), g);
+    env = env.add(c);
+    try {
+        checker.wait_all();
+        lean_unreachable();
+    } catch (kernel_exception & ex) {
+        std::cout << "expected error: " << ex.pp(mk_simple_formatter(), options()) << "\n";
+    }
+    lean_assert(!c.is_pending());
+    try {
+        c.wait();
+        lean_unreachable();
+    } catch (kernel_exception &) {
+    }
+    // the types of theorems are checked eagerly
+    try {
+        checker.check(env, mk_theorem("bad_type", param_names(), Const("id")(Const("H1")), Const("H1")), g);
+        lean_unreachable();
+    } catch (kernel_exception & ex) {
+        std::cout << "expected error: " << ex.pp(mk_simple_formatter(), options()) << "\n";
+    }
+    checker.wait_all();
+}
+
+static void tst3() {
+#if defined(LEAN_MULTI_THREAD)
+    environment env = mk_env();
+    name_generator g("test");
+    async_checker checker(1);
+    for (unsigned i = 0; i < 10; i++)
+        env = env.add(checker.check(env, mk_theorem(name(name("th"), i), param_names(), Const("p"), mk_proof(200)), g));
+    checker.cancel();
+    try {
+        checker.wait_all();
+        lean_unreachable();
+    } catch (interrupted &) {
+        std::cout << "cancelled\n";
+    }
+    // the checker can be used after a cancellation
+    certified_definition c = checker.check(env, mk_theorem("ok", param_names(), Const("p"), mk_proof(10)), g);
+    checker.wait_all();
+    lean_assert(!c.is_pending());
+    c.wait();
+#endif
+}
+
+static void tst4() {
+    environment env = mk_env();
+    name_generator g("test");
+    unsigned n = 8;
+    {
+        timeit timer(std::cout, "synchronous checking");
+        environment env2 = env;
+        for (unsigned i = 0; i < n; i++)
+            env2 = env2.add(check(env2, mk_theorem(name(name("th"), i), param_names(), Const("p"), mk_proof(150)), g));
+    }
+    {
+        timeit timer(std::cout, "asynchronous checking");
+        async_checker checker;
+        environment env2 = env;
+        for (unsigned i = 0; i < n; i++)
+            env2 = env2.add(checker.check(env2, mk_theorem(name(name("th"), i), param_names(), Const("p"), mk_proof(150)), g));
+        checker.wait_all();
+    }
+}
+
+int main() {
+    save_stack_info();
+    tst1();
+    tst2();
+    tst3();
+    tst4();
+    return has_violations() ? 1 : 0;
+}
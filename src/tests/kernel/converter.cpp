@@ -0,0 +1,300 @@
+/*
+Copyright (c) 2014 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+
+Author: Leonardo de Moura
+*/
+#include <iostream>
+#include "util/test.h"
+#include "util/timeit.h"
+#include "util/step_budget.h"
+#include "kernel/environment.h"
+#include "kernel/type_checker.h"
+#include "kernel/instantiate.h"
+#include "kernel/abstract.h"
+#include "kernel/find_fn.h"
+using namespace lean;
+
+/** \brief Reference implementation for whnf_core (without eta), it uses substitution at each step. */
+static expr whnf_ref(expr const & e) {
+    if (is_let(e)) {
+        return whnf_ref(instantiate(let_body(e), let_value(e)));
+    } else if (is_app(e)) {
+        buffer<expr> args;
+        expr const * it = &e;
+        while (is_app(*it)) {
+            args.push_back(app_arg(*it));
+            it = &(app_fn(*it));
+        }
+        expr f = whnf_ref(*it);
+        if (is_lambda(f))
+            return whnf_ref(apply_beta(f, args.size(), args.data()));
+        else
+            return is_eqp(f, *it) ? e : mk_rev_app(f, args.size(), args.data());
+    } else {
+        return e;
+    }
+}
+
+static expr mk_church(unsigned n, expr const & f, expr const & x) {
+    expr r = x;
+    for (unsigned i = 0; i < n; i++)
+        r = f(r);
+    return Fun({{f, Bool >> Bool}, {x, Bool}}, r);
+}
+
+static void tst1() {
+    environment env(0, true, false);
+    type_checker tc(env);
+    expr f = Const("f");
+    expr g = Const("g");
+    expr x = Const("x");
+    expr y = Const("y");
+    expr a = mk_local("a", Bool);
+    expr b = mk_local("b", Bool);
+    expr h = mk_local("h", Bool >> (Bool >> Bool));
+    expr id = Fun({x, Bool}, x);
+    buffer<expr> ts;
+    ts.push_back(id(a));
+    ts.push_back(Fun({{x, Bool}, {y, Bool}}, h(y, x))(a, b));
+    ts.push_back(Fun({{x, Bool}, {y, Bool}}, h(y, x))(a));
+    ts.push_back(Fun({{g, Bool >> Bool}}, g)(Fun({x, Bool}, h(x)), a, b));
+    ts.push_back(mk_let("x", Bool, a, Fun({y, Bool}, h(Var(1), y))(b)));
+    ts.push_back(mk_let("x", Bool, a, Fun({y, Bool}, h(Var(1), y))));
+    ts.push_back(Fun({{x, Bool}, {f, Bool >> Bool}}, f(x))(a, Fun({y, Bool}, mk_let("z", Bool, y, h(Var(0), y)))));
+    ts.push_back(mk_church(3, f, x)(id, a));
+    ts.push_back(mk_church(3, f, x)(h(a), b));
+    ts.push_back(h(a, b));
+    for (expr const & t : ts) {
+        expr r1 = tc.whnf(t);
+        expr r2 = whnf_ref(t);
+        std::cout << t << " --> " << r1 << "\n";
+        lean_assert_eq(r1, r2);
+    }
+    // terms that are already in whnf are returned
+    expr t = h(id(a), b);
+    lean_assert(is_eqp(tc.whnf(t), t));
+}
+
+static void tst2() {
+    environment env(0, true, false);
+    type_checker tc(env);
+    expr f = Const("f");
+    expr x = Const("x");
+    expr a = mk_local("a", Bool);
+    expr id = Fun({x, Bool}, x);
+    expr t = mk_church(2000, f, x)(id, a);
+    expr r;
+    {
+        timeit timer(std::cout, "whnf_core (environment machine)");
+        r = tc.whnf(t);
+    }
+    lean_assert(r == a);
+    {
+        timeit timer(std::cout, "whnf_core (reference implementation based on substitution)");
+        r = whnf_ref(t);
+    }
+    lean_assert(r == a);
+}
+
+static environment add_def(environment const & env, definition const & d) {
+    return env.add(check(env, d, name_generator("test")));
+}
+
+/** \brief Normalizer based on recursive whnf calls (used as a baseline). */
+static expr normalize_ref(type_checker & tc, expr const & e, unsigned & next_idx) {
+    expr t = tc.whnf(e);
+    if (is_binder(t)) {
+        expr d = normalize_ref(tc, binder_domain(t), next_idx);
+        expr l = mk_local(name("_ref", next_idx++), d);
+        expr b = normalize_ref(tc, instantiate(binder_body(t), l), next_idx);
+        return mk_binder(t.kind(), binder_name(t), d, abstract_p(b, l), binder_info(t));
+    } else if (is_app(t)) {
+        buffer<expr> args;
+        expr const * it = &t;
+        while (is_app(*it)) {
+            args.push_back(normalize_ref(tc, app_arg(*it), next_idx));
+            it = &(app_fn(*it));
+        }
+        return mk_rev_app(normalize_ref(tc, *it, next_idx), args.size(), args.data());
+    } else {
+        return t;
+    }
+}
+
+static void tst3() {
+    environment env(0, true, false);
+    expr f = Const("f");
+    expr x = Const("x");
+    expr n = Const("n");
+    expr m = Const("m");
+    expr N = (Bool >> Bool) >> (Bool >> Bool);
+    env = add_def(env, mk_definition("two", param_names(), N, mk_church(2, f, x)));
+    env = add_def(env, mk_definition("two_opaque", param_names(), N, mk_church(2, f, x), true, 0, 1));
+    env = add_def(env, mk_definition("mul", param_names(), N >> (N >> N),
+                                     Fun({{n, N}, {m, N}, {f, Bool >> Bool}, {x, Bool}}, n(m(f), x))));
+    env = add_def(env, mk_definition("add", param_names(), N >> (N >> N),
+                                     Fun({{n, N}, {m, N}, {f, Bool >> Bool}, {x, Bool}}, n(f, m(f, x)))));
+    expr two = Const("two");
+    expr mul = Const("mul");
+    expr add = Const("add");
+    type_checker tc(env);
+    expr r = tc.normalize(mul(two, add(two, two)));
+    std::cout << r << "\n";
+    lean_assert_eq(r, mk_church(8, f, x));
+    lean_assert_eq(tc.normalize(Fun({n, N}, add(n, two))),
+                   Fun({{n, N}, {f, Bool >> Bool}, {x, Bool}}, n(f, f(f(x)))));
+    // opaque definitions are not unfolded
+    expr two_opaque = Const("two_opaque");
+    r = tc.normalize(mul(two_opaque, two));
+    std::cout << r << "\n";
+    lean_assert(find(r, [&](expr const & e, unsigned) { return e == two_opaque; }));
+    name_set extra_opaque;
+    extra_opaque.insert("two");
+    type_checker tc2(env, name_generator("tmp"), mk_default_converter(env, optional<module_idx>(), true, extra_opaque));
+    lean_assert_eq(tc2.normalize(two), two);
+    lean_assert_eq(tc2.normalize(add(two, two)), Fun({{f, Bool >> Bool}, {x, Bool}}, two(f, two(f, x))));
+    // benchmark
+    expr k = mk_church(40, f, x);
+    expr t = mul(k, add(k, k));
+    {
+        timeit timer(std::cout, "normalize (environment machine)");
+        r = tc.normalize(t);
+    }
+    expr r2;
+    {
+        type_checker tc3(env);
+        unsigned next_idx = 0;
+        timeit timer(std::cout, "normalize (recursive whnf)");
+        r2 = normalize_ref(tc3, t, next_idx);
+    }
+    lean_assert(r == r2);
+    lean_assert_eq(r, mk_church(3200, f, x));
+}
+
+static void tst4() {
+    environment env(0, true, false);
+    expr f = Const("f");
+    expr x = Const("x");
+    expr n = Const("n");
+    expr m = Const("m");
+    expr N = (Bool >> Bool) >> (Bool >> Bool);
+    env = add_def(env, mk_definition("two", param_names(), N, mk_church(2, f, x)));
+    env = add_def(env, mk_definition("add", param_names(), N >> (N >> N),
+                                     Fun({{n, N}, {m, N}, {f, Bool >> Bool}, {x, Bool}}, n(f, m(f, x)))));
+    expr two = Const("two");
+    expr add = Const("add");
+    type_checker tc(env);
+    type_checker_stats s = tc.get_stats();
+    lean_assert(s.m_infer == 0 && s.m_conv.m_whnf_core == 0 && s.m_conv.m_is_def_eq == 0);
+    lean_assert(tc.is_def_eq(add(two, two), mk_church(4, f, x)));
+    lean_assert(tc.infer(add(two, two)) == N);
+    lean_assert(tc.infer(add(two, two)) == N);
+    s = tc.get_stats();
+    std::cout << "infer: " << s.m_infer << ", hits: " << s.m_infer_hits
+              << ", whnf_core: " << s.m_conv.m_whnf_core << ", hits: " << s.m_conv.m_whnf_core_hits
+              << ", whnf: " << s.m_conv.m_whnf << ", hits: " << s.m_conv.m_whnf_hits
+              << ", delta: " << s.m_conv.m_delta << ", is_def_eq: " << s.m_conv.m_is_def_eq
+              << ", time: " << s.m_conv.m_is_def_eq_time << "\n";
+    lean_assert(s.m_infer_hits > 0);
+    lean_assert(s.m_conv.m_delta >= 3);
+    lean_assert(s.m_conv.m_is_def_eq == 1);
+    lean_assert(s.m_cnstrs == 0);
+    tc.reset_stats();
+    lean_assert(tc.get_stats().m_conv.m_delta == 0);
+}
+
+static void tst5() {
+    environment env(0, true, false);
+    expr f = Const("f");
+    expr x = Const("x");
+    expr a = mk_local("a", Bool);
+    expr id = Fun({x, Bool}, x);
+    expr t = mk_church(1000, f, x)(id, a);
+    type_checker tc1(env);
+    lean_assert(tc1.whnf(t) == a);
+    unsigned n = tc1.get_num_steps();
+    std::cout << "steps: " << n << "\n";
+    lean_assert(n >= 1000);
+    // the number of steps is deterministic
+    type_checker tc2(env);
+    lean_assert(tc2.whnf(t) == a);
+    lean_assert_eq(tc2.get_num_steps(), n);
+    // budget is exhausted
+    type_checker tc3(env);
+    tc3.set_max_steps(n - 1);
+    try {
+        tc3.whnf(t);
+        lean_unreachable();
+    } catch (step_budget_exception &) {
+        std::cout << "step budget exhausted\n";
+    }
+    lean_assert_eq(tc3.get_num_steps(), n - 1);
+    type_checker tc4(env);
+    tc4.set_max_steps(n);
+    lean_assert(tc4.whnf(t) == a);
+    // nested budgets
+    unsigned used = 0;
+    {
+        scoped_step_budget outer(n / 2, used);
+        type_checker tc5(env);
+        try {
+            tc5.whnf(t);
+            lean_unreachable();
+        } catch (step_budget_exception &) {
+            lean_assert_eq(tc5.get_num_steps(), n / 2);
+        }
+    }
+    lean_assert_eq(used, n / 2);
+    type_checker tc6(env);
+    lean_assert(tc6.whnf(t) == a);
+}
+
+/** \brief Normalizer extension that reduces the constant \c a to \c b. */
+class a2b_normalizer_extension : public normalizer_extension {
+public:
+    virtual optional<expr> operator()(expr const & e, extension_context &) const {
+        if (is_constant(e) && const_name(e) == "a")
+            return some_expr(Const("b"));
+        return none_expr();
+    }
+};
+
+static void tst6() {
+    expr f = Const("f");
+    expr g = Const("g");
+    expr x = Const("x");
+    expr n = Const("n");
+    expr m = Const("m");
+    expr a = Const("a");
+    expr b = Const("b");
+    expr N = (Bool >> Bool) >> (Bool >> Bool);
+    auto mk_env = [&](environment env) {
+        env = add_def(env, mk_definition("two", param_names(), N, mk_church(2, f, x)));
+        return add_def(env, mk_definition("add", param_names(), N >> (N >> N),
+                                          Fun({{n, N}, {m, N}, {f, Bool >> Bool}, {x, Bool}}, n(f, m(f, x)))));
+    };
+    expr t1 = Fun({x, Bool}, g(x, x))(a);
+    expr t2 = Const("add")(Const("two"), Const("two"));
+    // the default extension is never invoked
+    type_checker tc1(mk_env(environment(0, true, false)));
+    lean_assert_eq(tc1.normalize(t1), g(a, a));
+    lean_assert_eq(tc1.normalize(t2), mk_church(4, f, x));
+    lean_assert(tc1.get_stats().m_conv.m_norm_ext == 0);
+    type_checker tc2(mk_env(environment(0, true, false, true, std::unique_ptr<normalizer_extension>(new a2b_normalizer_extension()))));
+    lean_assert_eq(tc2.normalize(t1), g(b, b));
+    lean_assert_eq(tc2.normalize(t2), mk_church(4, f, x));
+    lean_assert_eq(tc2.normalize(g(Fun({x, Bool}, f(x))(a))), g(f(b)));
+    lean_assert(tc2.get_stats().m_conv.m_norm_ext > 0);
+}
+
+int main() {
+    save_stack_info();
+    tst1();
+    tst2();
+    tst3();
+    tst4();
+    tst5();
+    tst6();
+    return has_violations() ? 1 : 0;
+}
@@ -7,9 +7,13 @@ Author: Leonardo de Moura
 #include "util/test.h"
 #include "util/exception.h"
 #include "util/trace.h"
+#include "util/timeit.h"
+#include "util/memory.h"
+#include "util/memory_pool.h"
 #include "kernel/environment.h"
 #include "kernel/type_checker.h"
 #include "kernel/abstract.h"
+#include "kernel/instantiate.h"
 #include "kernel/kernel_exception.h"
 using namespace lean;
 
@@ -140,10 +144,332 @@ static void tst3() {
     lean_assert_eq(checker.whnf(proj1(proj1(mk(id(A, mk(a, b)), b)))), a);
 }
 
+static void tst4() {
+    environment env;
+    expr B2B = Bool >> Bool;
+    expr x   = Const("x");
+    expr a = Const("a"); expr b = Const("b"); expr c = Const("c"); expr d = Const("d"); expr e = Const("e");
+    env = add_def(env, mk_definition("a", param_names(), B2B, Fun({x, Bool}, x)));
+    env = add_def(env, mk_definition("b", param_names(), B2B, a));
+    env = add_def(env, mk_definition("c", param_names(), B2B, Fun({x, Bool}, b(x))));
+    env = add_def(env, mk_definition("d", param_names(), B2B, Fun({x, Bool}, x)));
+    env = add_def(env, mk_definition("e", param_names(), B2B, Fun({x, Bool}, c(d(x)))));
+    lean_assert(env.get_dependencies("c").contains("b"));
+    lean_assert(env.get_dependencies("c").size() == 1);
+    lean_assert(env.get_dependencies("a").empty());
+    lean_assert(env.get_dependents("d").contains("e"));
+    buffer<name> r;
+    name a_name("a");
+    env.get_transitive_dependents(1, &a_name, r);
+    lean_assert(r.size() == 4);
+    lean_assert(r[0] == "a" && r[1] == "b" && r[2] == "c" && r[3] == "e");
+    // remove
+    try {
+        name_set s; s.insert("b");
+        env.remove(s);
+        lean_unreachable();
+    } catch (kernel_exception & ex) {
+        std::cout << "expected error: " << ex.what() << "\n";
+    }
+    name_set s; s.insert("c"); s.insert("e");
+    environment env2 = env.remove(s);
+    lean_assert(!env2.find("c") && !env2.find("e") && env2.find("b"));
+    lean_assert(env2.get_dependents("b").empty());
+    lean_assert(env2.get_dependents("d").empty());
+    lean_assert(!env2.is_descendant(env));
+    // recheck
+    definition new_a = mk_definition("a", param_names(), B2B, Fun({x, Bool}, d(x)));
+    environment env3 = recheck(env, 1, &new_a, name_generator("test"));
+    lean_assert(env3.get("a").get_value() == new_a.get_value());
+    lean_assert(is_eqp(env3.get("d"), env.get("d")));
+    lean_assert(env3.find("e"));
+    lean_assert(env3.get_dependents("c").contains("e"));
+    // the new value of a refers to a new definition, and to e (which does not depend on a anymore)
+    definition new_defs[3] = { mk_definition("a", param_names(), B2B, Fun({x, Bool}, Const("f")(e(x)))),
+                               mk_definition("e", param_names(), B2B, Fun({x, Bool}, d(x))),
+                               mk_definition("f", param_names(), B2B, Fun({x, Bool}, x)) };
+    environment env4 = recheck(env, 3, new_defs, name_generator("test"));
+    lean_assert(env4.get("a").get_value() == new_defs[0].get_value());
+    lean_assert(env4.get_dependents("e").contains("a"));
+    lean_assert(env4.get_dependents("a").contains("b"));
+    lean_assert(env4.find("c") && env4.find("f"));
+    definition bad_a = mk_definition("a", param_names(), Bool >> (Bool >> Bool), Fun({{x, Bool}, {c, Bool}}, x));
+    try {
+        recheck(env, 1, &bad_a, name_generator("test"));
+        lean_unreachable();
+    } catch (kernel_exception & ex) {
+        std::cout << "expected error: " << ex.what() << "\n";
+    }
+}
+
+static void tst5() {
+    // two independent chains of definitions
+    environment env;
+    expr B2B = Bool >> Bool;
+    expr x   = Const("x");
+    unsigned n = 2000;
+    buffer<definition> ds;
+    ds.push_back(mk_definition("h", param_names(), B2B, Fun({x, Bool}, x)));
+    for (unsigned k = 0; k < 2; k++) {
+        name prefix(k == 0 ? "f" : "g");
+        ds.push_back(mk_definition(name(prefix, 0u), param_names(), B2B, Fun({x, Bool}, x)));
+        for (unsigned i = 1; i < n; i++)
+            ds.push_back(mk_definition(name(prefix, i), param_names(), B2B, Fun({x, Bool}, mk_constant(name(prefix, i-1))(x))));
+    }
+    for (definition const & d : ds)
+        env = add_def(env, d);
+    definition new_f0 = mk_definition(name("f", 0u), param_names(), B2B, Fun({x, Bool}, Const("h")(x)));
+    environment env1;
+    {
+        timeit timer(std::cout, "recheck");
+        env1 = recheck(env, 1, &new_f0, name_generator("test"));
+    }
+    environment env2;
+    {
+        timeit timer(std::cout, "check everything");
+        for (definition const & d : ds)
+            env2 = add_def(env2, d.get_name() == new_f0.get_name() ? new_f0 : d);
+    }
+    lean_assert(env1.get(name("f", n-1)).get_value() == env2.get(name("f", n-1)).get_value());
+    lean_assert(is_eqp(env1.get(name("g", n-1)), env.get(name("g", n-1))));
+}
+
+static void tst6() {
+    // memory used by the expressions of a big environment
+    size_t pool_before = get_pool_memory();
+    size_t mem_before  = get_allocated_memory();
+    environment env;
+    expr B2B2B = Bool >> (Bool >> Bool);
+    expr x     = Const("x");
+    expr y     = Const("y");
+    unsigned n = 3000;
+    {
+        timeit timer(std::cout, "big environment");
+        env = add_def(env, mk_definition(name("f", 0u), param_names(), B2B2B, Fun({{x, Bool}, {y, Bool}}, x)));
+        for (unsigned i = 1; i < n; i++) {
+            expr prev = mk_constant(name("f", i-1));
+            env = add_def(env, mk_definition(name("f", i), param_names(), B2B2B,
+                                             Fun({{x, Bool}, {y, Bool}}, prev(prev(x, y), prev(y, x)))));
+        }
+    }
+    std::cout << "memory pool: " << (get_pool_memory() - pool_before) / 1024 << " Kb, "
+              << "allocated memory: " << (get_allocated_memory() - mem_before) / 1024 << " Kb\n";
+    std::cout << "sizeof(expr_app): " << sizeof(expr_app) << ", sizeof(expr_binder): " << sizeof(expr_binder)
+              << ", sizeof(expr_let): " << sizeof(expr_let) << "\n";
+    lean_assert(env.find(name("f", n-1)));
+}
+
+static void tst7() {
+    // type checking definitions with long telescopes
+    environment env;
+    expr A = mk_local("A", mk_Type());
+    expr P = mk_local("P", A >> Bool);
+    buffer<expr> ls;
+    ls.push_back(A);
+    ls.push_back(P);
+    unsigned n = 150;
+    for (unsigned i = 0; i < n; i++) {
+        expr x = mk_local(name("x", i), A);
+        ls.push_back(x);
+        ls.push_back(mk_local(name("h", i), P(x)));
+    }
+    expr type  = Pi(ls, P(ls[ls.size() - 2]));
+    expr value = Fun(ls, ls.back());
+    {
+        timeit timer(std::cout, "check definition with 302 binders");
+        env = add_def(env, mk_definition("big", param_names(), type, value));
+    }
+    lean_assert(env.get("big").get_type() == type);
+    try {
+        expr bad_value = Fun(ls, ls[ls.size() - 3]);
+        env = add_def(env, mk_definition("bad", param_names(), type, bad_value));
+        lean_unreachable();
+    } catch (kernel_exception & ex) {
+        std::cout << "expected error: " << ex.what() << "\n";
+    }
+}
+
+static void tst8() {
+    // type checking long application spines
+    environment env;
+    expr A = mk_local("A", mk_Type());
+    expr P = mk_local("P", A >> Bool);
+    expr g = mk_local("g", A >> (A >> A));
+    expr a = mk_local("a", A);
+    expr h = mk_local("h", P(a));
+    buffer<expr> ls;
+    ls.push_back(A);
+    ls.push_back(P);
+    ls.push_back(g);
+    unsigned n = 500;
+    expr t = a;
+    expr t_a = a;
+    for (unsigned i = 0; i < n; i++) {
+        expr x = mk_local(name("x", i), A);
+        ls.push_back(x);
+        ls.push_back(mk_local(name("h", i), P(x)));
+        t   = i == 0 ? x : g(x, t);
+        t_a = i == 0 ? a : g(a, t_a);
+    }
+    // f : Pi (A : Type) (P : A -> Bool) (g : A -> A -> A) (x_0 : A) (h_0 : P x_0) ..., P (g x_{n-1} (... x_0))
+    env = add_def(env, mk_var_decl("f", param_names(), Pi(ls, P(t))));
+    buffer<expr> args;
+    args.push_back(A);
+    args.push_back(P);
+    args.push_back(g);
+    for (unsigned i = 0; i < n; i++) {
+        args.push_back(a);
+        args.push_back(h);
+    }
+    buffer<expr> ctx;
+    ctx.push_back(A); ctx.push_back(P); ctx.push_back(g); ctx.push_back(a); ctx.push_back(h);
+    expr f = Const("f");
+    expr value = Fun(ctx, mk_app(f, args.size(), args.data()));
+    expr type  = Pi(ctx, P(t_a));
+    {
+        timeit timer(std::cout, "check application with 1003 arguments");
+        env = add_def(env, mk_definition("app", param_names(), type, value));
+    }
+    type_checker checker(env, name_generator("tmp"));
+    expr f_type = env.get("f").get_type();
+    for (unsigned i = 0; i < 5; i++)
+        f_type = binder_body(f_type);
+    expr l  = mk_local("l", mk_Type());
+    expr q  = mk_local("q", l >> Bool);
+    expr k  = mk_local("k", l >> (l >> l));
+    expr b  = mk_local("b", l);
+    expr hb = mk_local("hb", q(b));
+    lean_assert(checker.infer(mk_app({f, l, q, k, b, hb})) == instantiate(f_type, {hb, b, k, q, l}));
+    // binders whose domains are only definitionally equal
+    buffer<expr> ctx2(ctx);
+    ctx2[4] = mk_local("h", mk_app(mk_lambda("y", A, P(mk_var(0))), a));
+    lean_assert(checker.is_def_eq(Pi(ctx, P(a)), Pi(ctx2, P(a))));
+    lean_assert(!checker.is_def_eq(Pi(ctx, P(a)), Pi(ctx2, P(A))));
+    try {
+        args[args.size() - 1] = a;
+        expr bad_value = Fun(ctx, mk_app(f, args.size(), args.data()));
+        env = add_def(env, mk_definition("bad", param_names(), type, bad_value));
+        lean_unreachable();
+    } catch (kernel_exception & ex) {
+        std::cout << "expected error: " << ex.what() << "\n";
+    }
+}
+
+static void tst9() {
+    // head symbol index
+    environment env;
+    unsigned num_heads = 50;
+    unsigned n = 5000;
+    buffer<name> ns;
+    for (unsigned i = 0; i < num_heads; i++)
+        env = add_def(env, mk_var_decl(name("p", i), param_names(), Bool >> (Bool >> Bool)));
+    env = env.enable_head_index();
+    lean_assert(env.has_head_index());
+    expr x = Const("x");
+    for (unsigned i = 0; i < n; i++) {
+        name c("thm", i);
+        expr p = Const(name("p", i % num_heads));
+        env = add_def(env, mk_axiom(c, param_names(), Pi({x, Bool}, p(x, Const(name("p", (i + 1) % num_heads))(x, x)))));
+        ns.push_back(c);
+    }
+    lean_assert(env.get_definitions_with_head(name("p", 3)).contains(name("thm", 3)));
+    lean_assert(!env.get_definitions_with_head(name("p", 3)).contains(name("thm", 4)));
+    lean_assert(env.get_definitions_with_head(name("thm", 3)).empty());
+    lean_assert(*get_conclusion_head(env.get(name("thm", 7)).get_type()) == name("p", 7));
+    lean_assert(!get_conclusion_head(Bool >> Bool));
+    unsigned r1 = 0, r2 = 0;
+    {
+        timeit timer(std::cout, "find definitions by head using index");
+        for (unsigned i = 0; i < num_heads; i++)
+            env.get_definitions_with_head(name("p", i)).for_each([&](name const &) { r1++; });
+    }
+    {
+        timeit timer(std::cout, "find definitions by head using linear scan");
+        for (unsigned i = 0; i < num_heads; i++) {
+            for (name const & c : ns) {
+                auto h = get_conclusion_head(env.get(c).get_type());
+                if (h && *h == name("p", i))
+                    r2++;
+            }
+        }
+    }
+    lean_assert(r1 == n && r2 == n);
+    name_set to_remove;
+    to_remove.insert(name("thm", 3));
+    environment env2 = env.remove(to_remove);
+    lean_assert(!env2.get_definitions_with_head(name("p", 3)).contains(name("thm", 3)));
+    lean_assert(env2.get_definitions_with_head(name("p", 3)).contains(name("thm", 53)));
+    try {
+        environment().get_definitions_with_head(name("p", 3));
+        lean_unreachable();
+    } catch (kernel_exception & ex) {
+        std::cout << "expected error: " << ex.what() << "\n";
+    }
+}
+
+static void tst10() {
+    // compaction
+    environment env;
+    env = add_def(env, mk_var_decl("A", param_names(), Type));
+    unsigned n = 2000;
+    for (unsigned i = 0; i < n; i++) {
+        // each definition uses its own copy of A -> A -> A
+        expr A = mk_constant(name("A"));
+        expr t = mk_pi("x", A, mk_pi("y", A, A));
+        env = add_def(env, mk_definition(name("f", i), param_names(), t, mk_lambda("x", A, mk_lambda("y", A, Var(1)))));
+    }
+    // types that are structurally equal, but have different binder names and binder_info
+    env = add_def(env, mk_var_decl("g", param_names(), mk_pi("A", Type, mk_arrow(Var(0), Var(1)), expr_binder_info(true))));
+    env = add_def(env, mk_var_decl("h", param_names(), mk_pi("B", Type, mk_arrow(Var(0), Var(1)))));
+    env = env.enable_head_index();
+    compact_report r;
+    environment env2;
+    {
+        timeit timer(std::cout, "compact environment");
+        env2 = env.compact(r);
+    }
+    std::cout << r;
+    lean_assert(r.m_num_definitions == n + 3);
+    lean_assert(r.m_num_cells_after < r.m_num_cells_before / 100);
+    lean_assert(r.m_size_after < r.m_size_before / 100);
+    lean_assert(env2.is_descendant(env));
+    for (unsigned i = 0; i < n; i++) {
+        definition d1 = env.get(name("f", i));
+        definition d2 = env2.get(name("f", i));
+        lean_assert(d1.get_type() == d2.get_type());
+        lean_assert(d1.get_value() == d2.get_value());
+        lean_assert(d1.get_weight() == d2.get_weight());
+        lean_assert(env2.get_dependencies(name("f", i)).contains("A"));
+    }
+    expr t1 = env2.get(name("f", 1)).get_type();
+    expr t2 = env2.get(name("f", 2)).get_type();
+    lean_assert(is_eqp(t1, t2));
+    lean_assert(is_eqp(env2.get(name("f", 1)).get_value(), env2.get(name("f", 2)).get_value()));
+    lean_assert(is_eqp(binder_domain(t1), binder_body(binder_body(t1))));
+    expr g_type = env2.get("g").get_type();
+    expr h_type = env2.get("h").get_type();
+    lean_assert(g_type == h_type);
+    lean_assert(is_bi_equal(g_type, env.get("g").get_type()));
+    lean_assert(is_bi_equal(h_type, env.get("h").get_type()));
+    lean_assert(binder_name(g_type) == "A" && binder_info(g_type).is_implicit());
+    lean_assert(binder_name(h_type) == "B" && !binder_info(h_type).is_implicit());
+    lean_assert(env2.get_definitions_with_head("A").size() == n);
+    // definitions certified for env can be added to the compacted environment
+    environment env3 = env2.add(check(env, mk_var_decl("B", param_names(), Type), name_generator("test")));
+    lean_assert(env3.find("B"));
+}
+
 int main() {
     save_stack_info();
     tst1();
     tst2();
     tst3();
+    tst4();
+    tst5();
+    tst6();
+    tst7();
+    tst8();
+    tst9();
+    tst10();
     return has_violations() ? 1 : 0;
 }
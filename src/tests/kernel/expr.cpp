@@ -6,11 +6,14 @@ Author: Leonardo de Moura
         Soonho Kong
 */
 #include <algorithm>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 #include "util/test.h"
+#include "util/timeit.h"
 #include "kernel/expr.h"
 #include "kernel/expr_sets.h"
+#include "kernel/expr_maps.h"
 #include "kernel/free_vars.h"
 #include "kernel/abstract.h"
 #include "kernel/instantiate.h"
@@ -366,6 +369,172 @@ static void tst18() {
     lean_assert(!has_local(f(a, a, a, a)));
 }
 
+static void tst19() {
+    expr f = Const("f");
+    expr a = Const("a");
+    expr_struct_cache<unsigned> c;
+    buffer<expr> keys;
+    for (unsigned i = 0; i < 1000; i++) {
+        expr e = f(a, mk_var(i));
+        keys.push_back(e);
+        c.insert(e, i);
+    }
+    lean_assert(c.size() == 1000);
+    // pointer equality hits do not require structural equality tests
+    for (unsigned i = 0; i < 1000; i++)
+        lean_assert(*c.find(keys[i]) == i);
+    lean_assert(c.get_num_struct_fallbacks() == 0);
+    // structurally equal keys are found in the second level, and then added to the first one
+    expr k = f(a, mk_var(10));
+    lean_assert(!is_eqp(k, keys[10]));
+    lean_assert(*c.find(k) == 10);
+    unsigned n = c.get_num_struct_fallbacks();
+    lean_assert(n > 0);
+    lean_assert(*c.find(k) == 10);
+    lean_assert(c.get_num_struct_fallbacks() == n);
+    lean_assert(!c.find(f(a, mk_var(1000))));
+    c.insert(keys[0], 42);
+    lean_assert(*c.find(keys[0]) == 0);
+    c.clear();
+    lean_assert(c.empty() && !c.find(keys[0]));
+    // benchmark
+    expr_struct_map<unsigned> m;
+    for (unsigned i = 0; i < keys.size(); i++) {
+        m.insert(mk_pair(keys[i], i));
+        c.insert(keys[i], i);
+    }
+    unsigned num_rounds = 2000;
+    unsigned r1 = 0, r2 = 0;
+    {
+        timeit timer(std::cout, "expr_struct_map lookups");
+        for (unsigned j = 0; j < num_rounds; j++)
+            for (expr const & e : keys)
+                r1 += m.find(e)->second;
+    }
+    {
+        timeit timer(std::cout, "expr_struct_cache lookups");
+        for (unsigned j = 0; j < num_rounds; j++)
+            for (expr const & e : keys)
+                r2 += *c.find(e);
+    }
+    lean_assert(r1 == r2);
+}
+
+static void tst20() {
+    // collision rate of structural hash codes on generated terms
+    expr f = Const("f");
+    expr g = Const("g");
+    expr Type = mk_Type();
+    std::vector<expr> terms;
+    unsigned n = 150;
+    for (unsigned i = 0; i < n; i++) {
+        for (unsigned j = 0; j < n; j++) {
+            terms.push_back(f(mk_var(i), mk_var(j)));
+            terms.push_back(g(f(mk_var(i)), mk_var(j)));
+            terms.push_back(mk_lambda("x", mk_var(i), mk_var(j)));
+            terms.push_back(mk_pi("x", mk_var(i), mk_var(j)));
+            terms.push_back(mk_let("x", Type, mk_var(i), mk_var(j)));
+        }
+    }
+    std::unordered_set<unsigned> hs;
+    std::unordered_set<uint64> hs64;
+    {
+        timeit timer(std::cout, "hash codes");
+        for (expr const & t : terms) {
+            hs.insert(t.hash());
+            hs64.insert(t.hash64());
+        }
+    }
+    std::cout << "distinct terms: " << terms.size() << ", distinct hash codes: " << hs.size()
+              << ", distinct hash64 codes: " << hs64.size() << "\n";
+    std::cout << "hash collision rate: " << (1.0 - static_cast<double>(hs.size()) / terms.size())
+              << ", hash64 collision rate: " << (1.0 - static_cast<double>(hs64.size()) / terms.size()) << "\n";
+#if defined(LEAN_EXPR_HASH64)
+    lean_assert(hs64.size() == terms.size());
+#endif
+    // structurally equal terms have the same hash codes
+    lean_assert(mk_lambda("x", mk_var(1), mk_var(2)).hash64() == mk_lambda("y", mk_var(1), mk_var(2)).hash64());
+    lean_assert(f(mk_var(1)).hash64() == f(mk_var(1)).hash64());
+}
+
+static void tst21() {
+    // depth and free variable range are saturated, but get_free_var_range is still precise
+    expr f = Const("f");
+    expr Type = mk_Type();
+    expr v = mk_var(70000);
+    lean_assert(get_free_var_range(v) == 70001);
+    expr t = mk_lambda("x", Type, f(v, mk_var(3)));
+    lean_assert(get_free_var_range(t) == 70000);
+    expr t2 = mk_pi("y", t, mk_let("z", Type, Type, f(t, mk_var(1))));
+    lean_assert(get_free_var_range(t2) == 70000);
+    lean_assert(get_free_var_range(mk_local("l", v)) == 70001);
+    lean_assert(get_free_var_range(f(mk_local("l", Type), mk_var(65534))) == 65535);
+    lean_assert(get_free_var_range(mk_lambda("x", Type, mk_var(65536))) == 65536);
+    lean_assert(get_free_var_range(mk_lambda("x", Type, mk_var(65535))) == 65535);
+    lean_assert(!has_free_vars(mk_lambda("x", Type, mk_var(0))));
+    expr a = Const("a");
+    unsigned n = 70000;
+    for (unsigned i = 0; i < n; i++)
+        a = f(a);
+    lean_assert(get_depth(a) == LEAN_MAX_SMALL_FIELD);
+    lean_assert(get_depth(f(a, a)) == LEAN_MAX_SMALL_FIELD);
+    lean_assert(get_depth(f(Type)) == 2);
+}
+
+static void tst22() {
+    // tags are stored in a side table
+    expr f = Const("f");
+    expr a = Const("a");
+    expr b = Const("b");
+    unsigned n = get_num_tagged_exprs();
+    {
+        expr t = f(a);
+        lean_assert(t.get_tag() == nulltag);
+        t.set_tag(3);
+        lean_assert(t.get_tag() == 3);
+        lean_assert(f(a).get_tag() == nulltag);
+        expr t2 = update_app(t, f, b);
+        lean_assert(t2.get_tag() == 3);
+        expr l = mk_lambda("x", mk_Type(), t);
+        l.set_tag(5);
+        expr l2 = update_binder(l, mk_Bool(), binder_body(l));
+        lean_assert(l2.get_tag() == 5);
+        lean_assert(binder_body(l2).get_tag() == 3);
+        lean_assert(get_num_tagged_exprs() == n + 4);
+        t2.set_tag(nulltag);
+        lean_assert(t2.get_tag() == nulltag);
+        lean_assert(get_num_tagged_exprs() == n + 3);
+    }
+    // entries are removed when the expressions are deleted
+    lean_assert(get_num_tagged_exprs() == n);
+    expr c = f(b, b);
+    lean_assert(c.get_tag() == nulltag);
+}
+
+static void tst23() {
+    // name fingerprints
+    expr f = Const("f");
+    expr a = Const("a");
+    expr l = mk_local("l", f(a));
+    expr m = mk_metavar("m", f(a));
+    lean_assert(get_name_fingerprint(f) == mk_name_fingerprint("f"));
+    lean_assert(get_name_fingerprint(Var(0)) == 0);
+    lean_assert(get_name_fingerprint(mk_Type()) == 0);
+    lean_assert(get_name_fingerprint(m) == get_name_fingerprint(f(a)));
+    lean_assert(get_name_fingerprint(l) == (mk_name_fingerprint("l") | get_name_fingerprint(f(a))));
+    expr e = mk_lambda("x", mk_Type(), mk_let("y", Bool, m, f(l, Var(0))));
+    lean_assert(get_name_fingerprint(e) == get_name_fingerprint(l));
+    lean_assert(may_occur(l, e));
+    lean_assert(may_occur(f(a), e));
+    lean_assert(may_occur(mk_Type(), e));
+    lean_assert(get_name_fingerprint(mk_app(f, a)) == (mk_name_fingerprint("f") | mk_name_fingerprint("a")));
+    // terms with an empty fingerprint can still be abstracted
+    expr ts[2] = { a, mk_Type() };
+    lean_assert(abstract(f(mk_Type(), a), 2, ts) == f(Var(0), Var(1)));
+    // the fingerprint is stored in the header of the cell
+    lean_assert(sizeof(expr_app) == sizeof(expr_cell) + 2*sizeof(expr));
+}
+
 int main() {
     save_stack_info();
     lean_assert(sizeof(expr) == sizeof(optional<expr>));
@@ -387,9 +556,16 @@ int main() {
     tst16();
     tst17();
     tst18();
+    tst19();
+    tst20();
+    tst21();
+    tst22();
+    tst23();
     std::cout << "sizeof(expr):            " << sizeof(expr) << "\n";
     std::cout << "sizeof(expr_cell):       " << sizeof(expr_cell) << "\n";
     std::cout << "sizeof(expr_app):        " << sizeof(expr_app) << "\n";
+    std::cout << "sizeof(expr_binder):     " << sizeof(expr_binder) << "\n";
+    std::cout << "sizeof(expr_let):        " << sizeof(expr_let) << "\n";
     std::cout << "sizeof(expr_var):        " << sizeof(expr_var) << "\n";
     std::cout << "sizeof(expr_const):      " << sizeof(expr_const) << "\n";
     std::cout << "sizeof(optional<expr>):  " << sizeof(optional<expr>) << "\n";
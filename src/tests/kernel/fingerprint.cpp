@@ -0,0 +1,194 @@
+/*
+Copyright (c) 2014 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+
+Author: Leonardo de Moura
+*/
+#include <cstdio>
+#include <string>
+#include "util/test.h"
+#include "util/timeit.h"
+#include "kernel/environment.h"
+#include "kernel/type_checker.h"
+#include "kernel/abstract.h"
+#include "kernel/fingerprint.h"
+#include "kernel/check_cache.h"
+#include "kernel/kernel_exception.h"
+using namespace lean;
+
+static expr mk_id_type() {
+    expr A = Const("A");
+    return Pi(A, mk_Type(), A >> A);
+}
+
+static expr mk_id_value() {
+    expr A = Const("A");
+    expr x = Const("x");
+    return Fun({{A, mk_Type()}, {x, A}}, x);
+}
+
+static void tst1() {
+    // fingerprints only depend on the structure
+    lean_assert(get_fingerprint(mk_id_type()) == get_fingerprint(mk_id_type()));
+    lean_assert(get_fingerprint(mk_id_type()) != get_fingerprint(mk_id_value()));
+    expr A = Const("A");
+    expr B = Const("B");
+    lean_assert(get_fingerprint(Pi(A, mk_Type(), A)) == get_fingerprint(Pi(B, mk_Type(), B)));
+    lean_assert(get_fingerprint(name("a")) != get_fingerprint(name("b")));
+    lean_assert(get_fingerprint(name({"a", "b"})) != get_fingerprint(name("a.b")));
+    definition d1 = mk_definition("id", param_names(), mk_id_type(), mk_id_value());
+    definition d2 = mk_definition("id", param_names(), mk_id_type(), mk_id_value());
+    definition d3 = mk_definition("id", param_names(), mk_id_type(), mk_id_value(), true);
+    definition d4 = mk_theorem("id", param_names(), mk_id_type(), mk_id_value());
+    definition d5 = mk_definition("id2", param_names(), mk_id_type(), mk_id_value());
+    lean_assert(get_fingerprint(d1) == get_fingerprint(d2));
+    lean_assert(get_fingerprint(d1) != get_fingerprint(d3));
+    lean_assert(get_fingerprint(d1) != get_fingerprint(d4));
+    lean_assert(get_fingerprint(d1) != get_fingerprint(d5));
+    name_set deps;
+    get_fingerprint(mk_definition("f", param_names(), mk_Bool() >> mk_Bool(), Const("g")), &deps);
+    lean_assert(deps.contains("g"));
+}
+
+static environment add_def(environment const & env, definition const & d) {
+    return env.add(check(env, d, name_generator("test")));
+}
+
+static void tst2() {
+    std::shared_ptr<check_cache> cache = std::make_shared<check_cache>();
+    set_check_cache(cache);
+    expr Bool = mk_Bool();
+    // the cache is not used in untrusted mode
+    environment env0(0);
+    add_def(env0, mk_definition("id", param_names(), mk_id_type(), mk_id_value()));
+    lean_assert(cache->size() == 0);
+    environment env1(1);
+    env1 = add_def(env1, mk_definition("id", param_names(), mk_id_type(), mk_id_value()));
+    lean_assert(cache->size() == 1);
+    lean_assert(env1.get_deep_fingerprint("id"));
+    expr id = Const("id");
+    env1 = add_def(env1, mk_definition("f", param_names(), Bool >> Bool, id(Bool)));
+    lean_assert(cache->size() == 2);
+    // same definitions in a fresh environment hit the cache
+    environment env2(1);
+    env2 = add_def(env2, mk_definition("id", param_names(), mk_id_type(), mk_id_value()));
+    env2 = add_def(env2, mk_definition("f", param_names(), Bool >> Bool, id(Bool)));
+    lean_assert(cache->size() == 2);
+    lean_assert(*env1.get_deep_fingerprint("f") == *env2.get_deep_fingerprint("f"));
+    // changing a dependency changes the deep fingerprint of its dependents
+    environment env3(1);
+    env3 = add_def(env3, mk_definition("id", param_names(), mk_id_type(), mk_id_value(), true));
+    env3 = add_def(env3, mk_definition("f", param_names(), Bool >> Bool, id(Bool)));
+    lean_assert(cache->size() == 4);
+    lean_assert(*env1.get_deep_fingerprint("f") != *env3.get_deep_fingerprint("f"));
+    // save and load
+    std::string fname = "fingerprint_tst.cache";
+    cache->save(fname);
+    std::shared_ptr<check_cache> cache2 = std::make_shared<check_cache>();
+    cache2->load(fname);
+    lean_assert(cache2->size() == 4);
+    std::remove(fname.c_str());
+    check_cache cache3;
+    cache3.load("fingerprint_tst_missing.cache");
+    lean_assert(cache3.size() == 0);
+    set_check_cache(nullptr);
+    // deep fingerprints are not recorded when the cache is disabled
+    environment env4(1);
+    env4 = add_def(env4, mk_definition("id", param_names(), mk_id_type(), mk_id_value()));
+    lean_assert(!env4.get_deep_fingerprint("id"));
+}
+
+static expr mk_big(expr const & id, unsigned n) {
+    expr r = Const("a");
+    for (unsigned i = 0; i < n; i++)
+        r = id(mk_Bool(), r);
+    return r;
+}
+
+/** \brief Macros with the same name and hash code, they only differ in the serialized data. */
+class tst_macro : public macro_definition_cell {
+    unsigned m_val;
+public:
+    tst_macro(unsigned v):m_val(v) {}
+    virtual name get_name() const { return name("tst_macro"); }
+    virtual expr get_type(unsigned, expr const *, expr const *, extension_context &) const { return mk_Bool(); }
+    virtual optional<expr> expand1(unsigned, expr const *, extension_context &) const { return none_expr(); }
+    virtual optional<expr> expand(unsigned, expr const *, extension_context &) const { return none_expr(); }
+    virtual unsigned hash() const { return 7; }
+    virtual void write(serializer & s) const { s << m_val; }
+};
+
+class tst_normalizer_extension : public normalizer_extension {
+    optional<name> m_id;
+public:
+    tst_normalizer_extension(optional<name> const & id):m_id(id) {}
+    virtual optional<expr> operator()(expr const &, extension_context &) const { return none_expr(); }
+    virtual optional<name> get_identity() const { return m_id; }
+};
+
+static environment mk_env(optional<name> const & ext_id) {
+    return environment(1, true, true, true, std::unique_ptr<normalizer_extension>(new tst_normalizer_extension(ext_id)));
+}
+
+static void tst4() {
+    // macros are identified by their data
+    expr a  = Const("a");
+    expr m1 = mk_macro(macro_definition(new tst_macro(1)), 1, &a);
+    expr m2 = mk_macro(macro_definition(new tst_macro(2)), 1, &a);
+    lean_assert(get_fingerprint(m1) != get_fingerprint(m2));
+    lean_assert(get_fingerprint(m1) == get_fingerprint(mk_macro(macro_definition(new tst_macro(1)), 1, &a)));
+    // the key depends on the normalizer extension
+    definition d = mk_definition("id", param_names(), mk_id_type(), mk_id_value());
+    lean_assert(!mk_check_cache_key(mk_env(optional<name>()), d));
+    lean_assert(*mk_check_cache_key(mk_env(optional<name>("ext1")), d) == *mk_check_cache_key(mk_env(optional<name>("ext1")), d));
+    lean_assert(*mk_check_cache_key(mk_env(optional<name>("ext1")), d) != *mk_check_cache_key(mk_env(optional<name>("ext2")), d));
+    lean_assert(*mk_check_cache_key(environment(1), d) != *mk_check_cache_key(mk_env(optional<name>("ext1")), d));
+    // the global universe levels used by the definition must be declared
+    std::shared_ptr<check_cache> cache = std::make_shared<check_cache>();
+    set_check_cache(cache);
+    definition c = mk_var_decl("c", param_names(), mk_sort(mk_global_univ("u")));
+    environment env1 = environment(1).add_global_level("u");
+    lean_assert(mk_check_cache_key(env1, c));
+    env1 = add_def(env1, c);
+    lean_assert(cache->size() == 1);
+    environment env2(1);
+    lean_assert(!mk_check_cache_key(env2, c));
+    try {
+        add_def(env2, c);
+        lean_unreachable();
+    } catch (kernel_exception & ex) {
+        std::cout << "expected error: " << ex.what() << "\n";
+    }
+    set_check_cache(nullptr);
+}
+
+static void tst3() {
+    expr id = Const("id");
+    environment env(1);
+    env = add_def(env, mk_definition("id", param_names(), mk_id_type(), mk_id_value()));
+    env = add_def(env, mk_var_decl("a", param_names(), mk_Bool()));
+    definition d = mk_definition("big", param_names(), mk_Bool(), mk_big(id, 200));
+    {
+        timeit timer(std::cout, "check without cache");
+        check(env, d, name_generator("test"));
+    }
+    set_check_cache(std::make_shared<check_cache>());
+    env = environment(1);
+    env = add_def(env, mk_definition("id", param_names(), mk_id_type(), mk_id_value()));
+    env = add_def(env, mk_var_decl("a", param_names(), mk_Bool()));
+    check(env, d, name_generator("test"));
+    {
+        timeit timer(std::cout, "check with cache");
+        check(env, d, name_generator("test"));
+    }
+    set_check_cache(nullptr);
+}
+
+int main() {
+    save_stack_info();
+    tst1();
+    tst2();
+    tst3();
+    tst4();
+    return has_violations() ? 1 : 0;
+}
@@ -4,9 +4,14 @@ Released under Apache 2.0 license as described in the file LICENSE.
 
 Author: Leonardo de Moura
 */
+#include <vector>
 #include "util/test.h"
+#include "util/timeit.h"
+#include "util/buffer.h"
 #include "kernel/abstract.h"
 #include "kernel/instantiate.h"
+#include "kernel/free_vars.h"
+#include "kernel/replace_fn.h"
 using namespace lean;
 
 static void tst1() {
@@ -40,9 +45,171 @@ static void tst2() {
     lean_assert(head_beta_reduce(F1) == F1);
 }
 
+/** \brief Create the telescope A : Type, P : A -> Bool, x_1 : A, h_1 : P x_1, ..., x_n : A, h_n : P x_n */
+static void mk_telescope(unsigned n, buffer<expr> & ls) {
+    expr A = mk_local("A", mk_Type());
+    expr P = mk_local("P", A >> mk_Bool());
+    ls.push_back(A);
+    ls.push_back(P);
+    for (unsigned i = 0; i < n; i++) {
+        expr x = mk_local(name("x", i), A);
+        ls.push_back(x);
+        ls.push_back(mk_local(name("h", i), P(x)));
+    }
+}
+
+static void tst3() {
+    buffer<expr> ls;
+    mk_telescope(3, ls);
+    expr A = ls[0];
+    expr P = ls[1];
+    expr f = Const("f");
+    expr b = f(ls[2], ls[7], mk_lambda("y", A, f(mk_var(0), ls[5])));
+    lean_assert(abstract_locals(b, ls) == abstract_p(b, ls.size(), ls.data()));
+    lean_assert(abstract_locals(b, 0, ls.data()) == b);
+    lean_assert(abstract_locals(f(A, P), ls) == f(mk_var(7), mk_var(6)));
+    // telescopes
+    expr t = Pi(ls, P(ls[2]));
+    expr t2 = b;
+    unsigned i = ls.size();
+    while (i > 0) {
+        --i;
+        t2 = mk_pi(mlocal_name(ls[i]), mlocal_type(ls[i]), abstract_p(t2, ls[i]));
+    }
+    lean_assert(Pi(ls, b) == t2);
+    lean_assert(Fun(ls, ls[3]) == Fun(1, ls.data(), Fun(ls.size() - 1, ls.data() + 1, ls[3])));
+    lean_assert(is_pi(t) && binder_domain(binder_body(t)) == mk_pi("x", mk_var(0), mk_Bool()));
+    lean_assert(binder_domain(binder_body(binder_body(binder_body(t)))) == mk_var(1)(mk_var(0)));
+    // instantiate_rev is the inverse operation
+    lean_assert(instantiate_rev(abstract_locals(b, ls), ls.size(), ls.data()) == b);
+    lean_assert(instantiate_rev(mk_var(0), ls.size(), ls.data()) == ls.back());
+    lean_assert(instantiate_rev(mk_var(ls.size()), ls.size(), ls.data()) == mk_var(0));
+}
+
+static void tst4() {
+    // abstracting long telescopes
+    buffer<expr> ls;
+    mk_telescope(200, ls);
+    expr f = Const("f");
+    expr b = ls[1](ls.back());
+    for (unsigned i = 0; i < ls.size(); i++)
+        b = f(b, ls[i]);
+    expr r1, r2;
+    {
+        timeit timer(std::cout, "telescope with 402 binders (abstract_locals + Pi)");
+        r1 = Pi(ls, b);
+    }
+    {
+        timeit timer(std::cout, "telescope with 402 binders (abstract_p + mk_pi)");
+        r2 = b;
+        unsigned i = ls.size();
+        while (i > 0) {
+            --i;
+            r2 = mk_pi(mlocal_name(ls[i]), abstract_p(mlocal_type(ls[i]), i, ls.data()),
+                       abstract_p(r2, ls[i]));
+        }
+    }
+    lean_assert(r1 == r2);
+}
+
+static void tst5() {
+    expr f = Const("f");
+    expr g = Const("g");
+    expr a = Const("a");
+    expr N = Const("N");
+    expr x = Const("x");
+    expr y = Const("y");
+    expr F = Fun({x, N}, f(x));
+    // applications whose head is instantiated with a lambda are beta reduced
+    lean_assert(instantiate_beta(mk_var(0)(a), 1, &F) == f(a));
+    lean_assert(instantiate(mk_var(0)(a), F) == F(a));
+    lean_assert(instantiate_beta(mk_lambda("y", N, mk_var(1)(mk_var(0))), 1, &F) == mk_lambda("y", N, f(mk_var(0))));
+    lean_assert(instantiate_beta(g(mk_var(0)), 1, &F) == g(F));
+    lean_assert(apply_beta(Fun({x, N}, x), 1, &F) == F);
+    // apply_beta and head_beta_reduce only reduce the head redex
+    expr args[2] = { a, F };
+    lean_assert(apply_beta(Fun({x, N}, x), 2, args) == F(a));
+    lean_assert(head_beta_reduce(Fun({x, N >> N}, x)(F, a)) == F(a));
+    lean_assert(head_beta_reduce(Fun({x, N}, x)(g, a)) == g(a));
+    lean_assert(apply_beta(Fun({x, N >> N}, g(x(a))), 1, &F) == g(F(a)));
+    // substitution terms containing free variables are lifted
+    expr s = g(mk_var(0));
+    lean_assert(instantiate(mk_lambda("y", N, f(mk_var(1), mk_var(1), mk_var(2))), 2, std::vector<expr>{s, a}.data()) ==
+                mk_lambda("y", N, f(g(mk_var(1)), g(mk_var(1)), a)));
+    lean_assert(instantiate_rev(mk_lambda("y", N, f(mk_var(1), mk_var(2))), 2, std::vector<expr>{s, a}.data()) ==
+                mk_lambda("y", N, f(a, g(mk_var(1)))));
+    lean_assert(instantiate(mk_lambda("y", N, f(mk_var(1), mk_var(0))), y) == mk_lambda("y", N, f(y, mk_var(0))));
+}
+
+/** \brief Instantiate without caching lifted substitution terms */
+static expr naive_instantiate(expr const & a, unsigned n, expr const * subst) {
+    return replace(a, [=](expr const & m, unsigned offset) -> optional<expr> {
+            if (offset >= get_free_var_range(m))
+                return some_expr(m);
+            if (is_var(m) && var_idx(m) >= offset) {
+                unsigned vidx = var_idx(m);
+                if (vidx < offset + n)
+                    return some_expr(lift_free_vars(subst[vidx - offset], offset));
+                else
+                    return some_expr(mk_var(vidx - n));
+            }
+            return none_expr();
+        });
+}
+
+static void tst6() {
+    // substitution terms occurring many times under binders
+    expr f = Const("f");
+    expr g = Const("g");
+    expr N = Const("N");
+    unsigned depth = 40;
+    unsigned width = 2000;
+    expr s = g(mk_var(0), mk_var(1));
+    for (unsigned i = 0; i < 200; i++)
+        s = g(s, mk_var(i % 3));
+    expr b = f(mk_var(depth));
+    for (unsigned i = 0; i < width; i++)
+        b = f(b, mk_var(depth + (i % 2)), mk_var(i % depth));
+    for (unsigned i = 0; i < depth; i++)
+        b = mk_lambda(name("y", i), N, b);
+    expr subst[2] = { s, f(mk_var(5)) };
+    expr r1, r2;
+    {
+        timeit timer(std::cout, "instantiate (cached lifting)");
+        r1 = instantiate(b, 2, subst);
+    }
+    {
+        timeit timer(std::cout, "instantiate (lifting each occurrence)");
+        r2 = naive_instantiate(b, 2, subst);
+    }
+    lean_assert(r1 == r2);
+    // beta reduction under binders
+    expr x = Const("x");
+    expr h = Const("h");
+    expr c = mk_var(0);
+    for (unsigned i = 0; i < 500; i++)
+        c = h(c);
+    expr F = binder_body(Fun({h, N >> N}, mk_lambda("z", N, c)));
+    expr G = Fun({x, N}, f(x, x));
+    expr r3, r4;
+    {
+        timeit timer(std::cout, "instantiate_beta (fused)");
+        r3 = instantiate_beta(F, 1, &G);
+    }
+    {
+        timeit timer(std::cout, "instantiate + beta_reduce");
+        r4 = beta_reduce(instantiate(F, G));
+    }
+    lean_assert(r3 == r4);
+}
+
 int main() {
     save_stack_info();
     tst1();
     tst2();
+    tst3();
+    tst4();
+    tst5();
+    tst6();
     return has_violations() ? 1 : 0;
 }
@@ -0,0 +1,97 @@
+/*
+Copyright (c) 2014 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+
+Author: Leonardo de Moura
+*/
+#include <iostream>
+#include "util/test.h"
+#include "util/timeit.h"
+#include "kernel/justification.h"
+using namespace lean;
+
+static void tst1() {
+    justification a1 = mk_assumption_justification(1);
+    justification a2 = mk_assumption_justification(2);
+    justification a100 = mk_assumption_justification(100);
+    justification j1 = mk_composite1(a1, a2);
+    lean_assert(depends_on(j1, 1));
+    lean_assert(depends_on(j1, 2));
+    lean_assert(!depends_on(j1, 3));
+    lean_assert(!depends_on(j1, 65));
+    lean_assert(!depends_on(j1, 66));
+    justification j2 = mk_composite1(j1, a100);
+    lean_assert(depends_on(j2, 1));
+    lean_assert(depends_on(j2, 100));
+    lean_assert(!depends_on(j2, 36));
+    lean_assert(!depends_on(j2, 164));
+    lean_assert(!depends_on(j2, 65));
+    lean_assert(depends_on(mk_composite1(j2, j1), 2));
+}
+
+static void tst2() {
+    scoped_composite_justification_cache cache;
+    justification a1 = mk_assumption_justification(1);
+    justification a2 = mk_assumption_justification(2);
+    justification j1 = mk_composite1(a1, a2);
+    // shared subterms are reused
+    lean_assert(is_eqp(mk_composite1(a1, a2), j1));
+    lean_assert(is_eqp(mk_composite1(a1, a1), a1));
+    lean_assert(is_eqp(mk_composite1(j1, a2), j1));
+    lean_assert(is_eqp(mk_composite1(j1, justification()), j1));
+    lean_assert(!is_eqp(mk_composite1(a2, a1), j1));
+    {
+        scoped_composite_justification_cache nested;
+        lean_assert(is_eqp(mk_composite1(a1, a2), j1));
+    }
+    lean_assert(is_eqp(mk_composite1(a1, a2), j1));
+}
+
+static void tst4() {
+    // composite justifications are not reused outside of a scoped_composite_justification_cache
+    justification a1 = mk_assumption_justification(1);
+    justification a2 = mk_assumption_justification(2);
+    justification j1;
+    {
+        scoped_composite_justification_cache cache;
+        j1 = mk_composite1(a1, a2);
+    }
+    lean_assert(!is_eqp(mk_composite1(a1, a2), j1));
+    lean_assert(!is_eqp(mk_composite1(a1, a2), mk_composite1(a1, a2)));
+}
+
+static void tst3() {
+    justification j = mk_assumption_justification(0);
+    for (unsigned i = 1; i < 1000; i++) {
+        justification a = mk_assumption_justification(i % 200);
+        j = mk_composite1(mk_composite1(j, a), mk_composite1(a, j));
+    }
+    {
+        timeit timer(std::cout, "depends_on 1000 calls on a deep DAG");
+        for (unsigned i = 0; i < 1000; i++) {
+            lean_assert(depends_on(j, i % 200));
+            lean_assert(!depends_on(j, 200 + i));
+        }
+    }
+    justification k = mk_assumption_justification(0);
+    for (unsigned i = 1; i < 10000; i++) {
+        justification a = mk_assumption_justification(i % 50);
+        k = mk_composite1(mk_composite1(k, a), mk_composite1(a, k));
+    }
+    {
+        timeit timer(std::cout, "depends_on 1000000 calls on a deep DAG (exact assumption set)");
+        for (unsigned i = 0; i < 1000000; i++) {
+            lean_assert(depends_on(k, i % 50));
+            lean_assert(!depends_on(k, 50 + (i % 500)));
+        }
+    }
+}
+
+int main() {
+    save_stack_info();
+    tst1();
+    tst2();
+    tst3();
+    tst4();
+    return has_violations() ? 1 : 0;
+}
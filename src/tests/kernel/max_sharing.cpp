@@ -5,7 +5,9 @@ Released under Apache 2.0 license as described in the file LICENSE.
 Author: Leonardo de Moura
 */
 #include <iostream>
+#include <vector>
 #include "util/test.h"
+#include "util/timeit.h"
 #include "kernel/abstract.h"
 #include "kernel/max_sharing.h"
 using namespace lean;
@@ -62,10 +64,103 @@ static void tst3() {
     lean_assert(is_eqp(t1, t3));
 }
 
+static expr mk_big(expr const & f, expr const & a, unsigned d) {
+    if (d == 0)
+        return a;
+    else
+        return f(mk_big(f, a, d - 1), mk_big(f, a, d - 1));
+}
+
+static void tst4() {
+    expr f = Const("f");
+    expr g = Const("g");
+    expr a = Const("a");
+    expr x = Const("x");
+    std::vector<expr> cs;
+    for (unsigned i = 0; i < 10; i++)
+        cs.push_back(Const(name("c", i)));
+    // the roots share a lot of sub-expressions, but they are not pointer equal
+    buffer<expr> es;
+    for (unsigned i = 0; i < 4000; i++) {
+        expr t = g(mk_big(f, cs[i % cs.size()], 8), Fun({x, Type}, f(x, mk_big(f, a, 6))));
+        if (i % 2 == 0)
+            t = g(t, mk_big(g, Const(name("d", i)), 8));
+        es.push_back(i % 3 == 0 ? t : Pi({x, Type}, t));
+    }
+    buffer<expr> r1;
+    sharing_stats s1;
+    {
+        timeit timer(std::cout, "max_sharing (batch, 1 thread)");
+        s1 = max_sharing(es.size(), es.data(), r1, 1);
+    }
+    buffer<expr> r2;
+    sharing_stats s2;
+    {
+        timeit timer(std::cout, "max_sharing (batch, 4 threads)");
+        s2 = max_sharing(es.size(), es.data(), r2, 4);
+    }
+    std::cout << "cells: " << s2.m_num_cells_before << " => " << s2.m_num_cells_after << "\n";
+    unsigned n;
+    {
+        timeit timer(std::cout, "get_num_cells");
+        n = get_num_cells(es.size(), es.data());
+    }
+    lean_assert(s1.m_num_cells_before == n);
+    lean_assert(s1.m_num_cells_after == s2.m_num_cells_after);
+    lean_assert(s2.m_num_cells_after < s2.m_num_cells_before / 50);
+    lean_assert(r1.size() == es.size() && r2.size() == es.size());
+    for (unsigned i = 0; i < es.size(); i++) {
+        lean_assert(r2[i] == es[i]);
+        lean_assert(r1[i] == r2[i]);
+    }
+    // identical sub-expressions of different roots are shared
+    lean_assert(is_eqp(r2[1], r2[31]));
+    lean_assert(is_eqp(app_arg(app_fn(r2[0])), app_arg(app_fn(binder_body(r2[10])))));
+    // a sequential max_sharing_fn produces the same number of cells
+    max_sharing_fn max_fn;
+    buffer<expr> r3;
+    {
+        timeit timer(std::cout, "max_sharing_fn");
+        for (expr const & e : es)
+            r3.push_back(max_fn(e));
+    }
+    lean_assert(get_num_cells(r3.size(), r3.data()) == s2.m_num_cells_after);
+}
+
+static void tst5() {
+    expr f = Const("f");
+    expr t1 = mk_pi("A", Type, mk_pi("a", mk_var(0), mk_var(1)), expr_binder_info(true));
+    expr t2 = mk_pi("B", Type, mk_pi("b", mk_var(0), mk_var(1)));
+    expr t3 = mk_pi("A", Type, mk_pi("a", mk_var(0), mk_var(1)));
+    lean_assert(t1 == t2 && t1 == t3);
+    lean_assert(!is_bi_equal(t1, t2) && !is_bi_equal(t1, t3) && !is_bi_equal(t2, t3));
+    lean_assert(is_bi_equal(t1, mk_pi("A", Type, mk_pi("a", mk_var(0), mk_var(1)), expr_binder_info(true))));
+    // terms that differ only in binder names or binder_info are not merged
+    expr es[3] = { t1, t2, t3 };
+    buffer<expr> r;
+    max_sharing(3, es, r, 2);
+    for (unsigned i = 0; i < 3; i++) {
+        lean_assert(is_bi_equal(r[i], es[i]));
+        lean_assert(binder_name(r[i]) == binder_name(es[i]));
+        lean_assert(binder_info(r[i]) == binder_info(es[i]));
+    }
+    lean_assert(binder_info(r[0]).is_implicit() && !binder_info(r[1]).is_implicit());
+    lean_assert(binder_name(binder_body(r[1])) == "b");
+    // their domains are still shared
+    lean_assert(is_eqp(binder_domain(r[0]), binder_domain(r[1])));
+    // the same holds for sub-expressions
+    expr fs[2] = { f(t1), f(t2) };
+    max_sharing(2, fs, r, 1);
+    lean_assert(is_bi_equal(r[0], fs[0]) && is_bi_equal(r[1], fs[1]));
+    lean_assert(binder_name(app_arg(r[1])) == "B" && !binder_info(app_arg(r[1])).is_implicit());
+}
+
 int main() {
     save_stack_info();
     tst1();
     tst2();
     tst3();
+    tst4();
+    tst5();
     return has_violations() ? 1 : 0;
 }
@@ -11,6 +11,7 @@ Author: Leonardo de Moura
 #include <set>
 #include "util/test.h"
 #include "util/buffer.h"
+#include "util/timeit.h"
 #include "kernel/metavar.h"
 #include "kernel/instantiate.h"
 #include "kernel/abstract.h"
@@ -136,10 +137,79 @@ static void tst3() {
     std::cout << s.instantiate_metavars(m1(a, b, g(a))).first << "\n";
 }
 
+static void tst4() {
+    expr f  = Const("f");
+    expr a  = Const("a");
+    expr m1 = mk_metavar("m1", Bool);
+    expr m2 = mk_metavar("m2", Bool);
+    level u = mk_meta_univ("u");
+    expr T  = mk_sort(u);
+    lean_assert((get_mv_fingerprint(f(m1, a)) & mk_mv_fingerprint("m1")) != 0);
+    lean_assert((get_mv_fingerprint(f(T, a)) & mk_mv_fingerprint("u")) != 0);
+    lean_assert(get_mv_fingerprint(f(a, a)) == 0);
+    substitution s;
+    s = s.assign(m1, a, mk_assumption_justification(1));
+    s = s.assign(u, mk_level_one(), mk_assumption_justification(2));
+    expr fm2 = f(m2);
+    lean_assert(is_eqp(s.instantiate_metavars_wo_jst(fm2), fm2) ||
+                mk_mv_fingerprint("m1") == mk_mv_fingerprint("m2") ||
+                mk_mv_fingerprint("u") == mk_mv_fingerprint("m2"));
+    lean_assert_eq(s.instantiate_metavars_wo_jst(f(m1, T, m2)), f(a, mk_sort(mk_level_one()), m2));
+    auto p1 = s.instantiate_metavars(f(m1, T, m2));
+    auto p2 = s.instantiate_metavars(f(m1, T, m2));
+    lean_assert(check_assumptions(p1.second, {1, 2}));
+    lean_assert(p1.first == p2.first);
+    expr t  = f(m1, m2);
+    auto p3 = s.instantiate_metavars(t);
+    auto p4 = s.instantiate_metavars(t);
+    lean_assert(is_eqp(p3.first, p4.first));
+    lean_assert(s.occurs(m2, f(m2)));
+    lean_assert(!s.occurs(m2, f(m1, T)));
+}
+
+static expr mk_big(expr const & f, unsigned depth, buffer<expr> const & ms) {
+    if (depth == 0)
+        return ms[depth % ms.size()];
+    expr r = mk_big(f, depth - 1, ms);
+    return f(r, ms[depth % ms.size()], r);
+}
+
+static void tst5() {
+    expr f = Const("f");
+    expr a = Const("a");
+    buffer<expr> ms;
+    for (unsigned i = 0; i < 64; i++)
+        ms.push_back(mk_metavar(name("m", i), Bool));
+    expr t = mk_big(f, 20, ms);
+    substitution s;
+    s = s.assign(ms[0], a);
+    expr r1, r2;
+    {
+        timeit timer(std::cout, "instantiate_metavars (first call)");
+        r1 = s.instantiate_metavars_wo_jst(t);
+    }
+    {
+        timeit timer(std::cout, "instantiate_metavars 1000 calls (cached)");
+        for (unsigned i = 0; i < 1000; i++)
+            r2 = s.instantiate_metavars_wo_jst(t);
+    }
+    lean_assert(is_eqp(r1, r2));
+    substitution s2;
+    s2 = s2.assign(mk_metavar("n", Bool), a);
+    {
+        timeit timer(std::cout, "instantiate_metavars 1000 calls (no assigned metavariables)");
+        for (unsigned i = 0; i < 1000; i++)
+            r2 = s2.instantiate_metavars_wo_jst(t);
+    }
+    lean_assert(is_eqp(r2, t) || (get_mv_fingerprint(t) & mk_mv_fingerprint("n")) != 0);
+}
+
 int main() {
     save_stack_info();
     tst1();
     tst2();
     tst3();
+    tst4();
+    tst5();
     return has_violations() ? 1 : 0;
 }
@@ -5,7 +5,10 @@ Released under Apache 2.0 license as described in the file LICENSE.
 Author: Leonardo de Moura
 */
 #include "util/test.h"
+#include <vector>
 #include "util/name.h"
+#include "util/timeit.h"
+#include "util/memory_pool.h"
 #include "kernel/expr.h"
 #include "kernel/abstract.h"
 #include "kernel/instantiate.h"
@@ -107,11 +110,99 @@ static void tst3() {
     lean_assert(trace.find(arg(arg(arg(binder_body(r), 2), 1), 2)) == trace.end());
 }
 
+static void tst4() {
+    // cells that are not shared are updated in place
+    expr f = Const("f");
+    expr g = Const("g");
+    expr a = Const("a");
+    expr b = Const("b");
+    expr t = f(a);
+    t.set_tag(7);
+    expr_cell * c = t.raw();
+    t = update_app(std::move(t), g, b);
+    lean_assert(t.raw() == c);
+    lean_assert(t == g(b));
+    lean_assert(t.hash() == g(b).hash());
+    lean_assert(t.get_tag() == 7);
+    expr t2 = t;
+    expr t3 = update_app(std::move(t2), f, b);
+    lean_assert(t3.raw() != c);
+    lean_assert(t == g(b) && t3 == f(b));
+    expr l = mk_lambda("x", mk_Type(), mk_var(0));
+    c = l.raw();
+    l = update_binder(std::move(l), mk_Bool(), binder_body(l));
+    lean_assert(l.raw() == c);
+    lean_assert(l == mk_lambda("y", mk_Bool(), mk_var(0)));
+    lean_assert(!is_arrow(l));
+    // rvalue versions of instantiate and abstract produce the same results
+    expr x = Const("x");
+    expr r1 = mk_big(f, 12, 0);
+    expr n  = Const(name("foo"));
+    expr r2 = r1;
+    for (unsigned i = 0; i < 5; i++) {
+        r1 = instantiate(abstract(r1, n), x);
+        r2 = instantiate(abstract(mk_big(f, 12, 0), n), x);
+    }
+    lean_assert(r1 == r2);
+    expr t4 = f(f(a, n), f(n, b));
+    c = t4.raw();
+    expr_cell * c1 = app_fn(t4).raw();
+    expr r4 = abstract(std::move(t4), n);
+    lean_assert(r4.raw() == c && app_fn(r4).raw() == c1);
+    lean_assert(r4 == f(f(a, mk_var(0)), f(mk_var(0), b)));
+    expr h = Const("h");
+    expr p = h(mk_var(0), mk_lambda("y", mk_var(1), h(mk_var(0), mk_var(1), mk_var(2))));
+    lean_assert(instantiate(expr(p), a) == instantiate(p, a));
+    lean_assert(instantiate(h(mk_var(0), h(mk_var(1), mk_var(0))), 2, std::vector<expr>{a, b}.data()) ==
+                h(a, h(b, a)));
+    lean_assert(abstract(h(a, mk_lambda("y", mk_Bool(), h(a, b))), a) ==
+                h(mk_var(0), mk_lambda("y", mk_Bool(), h(mk_var(1), b))));
+}
+
+static expr mk_big2(expr f, expr const & n, unsigned depth, unsigned val) {
+    if (depth == 1)
+        return f(n, mk_constant(name(name("bla"), val)));
+    else
+        return f(mk_big2(f, n, depth - 1, val << 1), mk_big2(f, n, depth - 1, (val << 1) + 1));
+}
+
+static void tst5() {
+    // rewriting pipeline that builds and discards a term at each step
+    expr f  = Const("f");
+    expr x  = Const("x");
+    expr n  = Const(name("foo"));
+    unsigned num = 5;
+    unsigned depth = 16;
+    // Remark: the in place version is executed first, since the memory pool never returns memory to the system
+    size_t pool_before = get_pool_memory();
+    expr r1;
+    for (unsigned i = 0; i < num; i++) {
+        expr t = mk_big2(f, n, depth, 0);
+        timeit timer(std::cout, "abstract+instantiate (in place)");
+        r1 = instantiate(abstract(std::move(t), n), x);
+    }
+    size_t pool_in_place = get_pool_memory();
+    expr r2;
+    for (unsigned i = 0; i < num; i++) {
+        expr t = mk_big2(f, n, depth, 0);
+        timeit timer(std::cout, "abstract+instantiate (copying)");
+        expr const & ct = t;
+        expr t1 = abstract(ct, n);
+        expr const & ct1 = t1;
+        r2 = instantiate(ct1, x);
+    }
+    std::cout << "memory pool growth, in place: " << (pool_in_place - pool_before) / 1024 << " Kb, "
+              << "copying: " << (get_pool_memory() - pool_in_place) / 1024 << " Kb\n";
+    lean_assert(r1 == r2);
+}
+
 int main() {
     save_stack_info();
     tst1();
     tst2();
     tst3();
+    tst4();
+    tst5();
     std::cout << "done" << "\n";
     return has_violations() ? 1 : 0;
 }
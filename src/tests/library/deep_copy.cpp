@@ -23,8 +23,38 @@ static void tst1() {
     lean_assert(!is_eqp(F, G));
 }
 
+static void tst2() {
+    expr f = Const("f");
+    expr a = Const("a");
+    expr x = Var(0);
+    expr t = f(f(x, a), Const("b"));
+    expr s = mk_lambda("x", Type, f(t, t));
+    buffer<expr> es;
+    for (unsigned i = 0; i < 1000; i++)
+        es.push_back(i % 2 == 0 ? f(s, mk_var(i)) : mk_pi("y", Type, t));
+    buffer<expr> r;
+    sharing_stats stats = deep_copy(es.size(), es.data(), r, 4);
+    lean_assert(r.size() == es.size());
+    // the sharing of the input is preserved
+    lean_assert(stats.m_num_cells_before == stats.m_num_cells_after);
+    for (unsigned i = 0; i < es.size(); i++) {
+        lean_assert(r[i] == es[i]);
+        lean_assert(!is_eqp(r[i], es[i]));
+    }
+    lean_assert(is_eqp(app_arg(app_fn(r[0])), app_arg(app_fn(r[998]))));
+    lean_assert(is_eqp(binder_body(r[1]), binder_body(r[999])));
+    lean_assert(!is_eqp(binder_body(r[1]), t));
+    lean_assert(is_eqp(app_arg(binder_body(app_arg(app_fn(r[0])))), binder_body(r[1])));
+    // the copies do not share any cell with the input
+    buffer<expr> all;
+    all.append(es);
+    all.append(r);
+    lean_assert(get_num_cells(all.size(), all.data()) == 2 * stats.m_num_cells_before);
+}
+
 int main() {
     save_stack_info();
     tst1();
+    tst2();
     return has_violations() ? 1 : 0;
 }
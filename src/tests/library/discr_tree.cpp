@@ -0,0 +1,131 @@
+/*
+Copyright (c) 2014 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+
+Author: Leonardo de Moura
+*/
+#include <algorithm>
+#include <vector>
+#include "util/test.h"
+#include "util/timeit.h"
+#include "library/discr_tree.h"
+using namespace lean;
+
+static bool contains(buffer<expr> const & b, expr const & e) {
+    return std::find(b.begin(), b.end(), e) != b.end();
+}
+
+static void tst1() {
+    expr f = Const("f");
+    expr g = Const("g");
+    expr h = Const("h");
+    expr a = Const("a");
+    expr b = Const("b");
+    expr x = mk_metavar("x", Bool);
+    expr y = mk_metavar("y", Bool);
+    expr l = mk_local("l", Bool);
+    expr p1 = f(x, a);
+    expr p2 = f(a, x);
+    expr p3 = f(x, y);
+    expr p4 = g(x);
+    expr p5 = f(a, b);
+    expr p6 = h(f(l, a));
+    discr_tree<expr> t;
+    for (expr const & p : {p1, p2, p3, p4, p5, p6})
+        t.insert(p, p);
+    t.insert(p1, p1);
+    lean_assert(t.size() == 6);
+    buffer<expr> r;
+    t.get_generalizations(f(a, b), r);
+    lean_assert(r.size() == 3 && contains(r, p2) && contains(r, p3) && contains(r, p5));
+    r.clear();
+    t.get_instances(f(x, b), r);
+    lean_assert(r.size() == 1 && contains(r, p5));
+    r.clear();
+    t.get_instances(f(x, y), r);
+    lean_assert(r.size() == 4 && !contains(r, p4) && !contains(r, p6));
+    r.clear();
+    t.get_unifiables(f(x, b), r);
+    lean_assert(r.size() == 3 && contains(r, p2) && contains(r, p3) && contains(r, p5));
+    r.clear();
+    t.get_unifiables(x, r);
+    lean_assert(r.size() == 6);
+    r.clear();
+    t.get_generalizations(h(f(b, a)), r);
+    lean_assert(r.size() == 1 && contains(r, p6));
+    r.clear();
+    t.get_generalizations(h(f(b, b)), r);
+    lean_assert(r.empty());
+    // the tree is persistent
+    discr_tree<expr> t2 = erase(t, p3, p3);
+    t2.erase(p6, p6);
+    t2.erase(p6, p6);
+    lean_assert(t2.size() == 4 && t.size() == 6);
+    r.clear();
+    t2.get_generalizations(f(a, b), r);
+    lean_assert(r.size() == 2 && !contains(r, p3));
+    r.clear();
+    t.get_generalizations(f(a, b), r);
+    lean_assert(r.size() == 3 && contains(r, p3));
+    buffer<discr_tree_key> ks;
+    get_discr_tree_keys(p6, ks);
+    lean_assert(ks.size() == 4 && ks[0].get_arity() == 1 && ks[2].is_star());
+}
+
+/** \brief First-order matching, the metavariables in \c p are wildcards. */
+static bool simple_match(expr const & p, expr const & e) {
+    if (is_metavar(p))
+        return true;
+    if (is_app(p) && is_app(e))
+        return simple_match(app_fn(p), app_fn(e)) && simple_match(app_arg(p), app_arg(e));
+    return p == e;
+}
+
+static void tst2() {
+    // benchmark: discrimination tree vs linear scan
+    unsigned num_consts = 100;
+    unsigned n = num_consts * num_consts;
+    std::vector<expr> cs;
+    for (unsigned i = 0; i < num_consts; i++)
+        cs.push_back(Const(name("c", i)));
+    expr x = mk_metavar("x", Bool);
+    std::vector<expr> patterns;
+    discr_tree<expr> t;
+    for (unsigned i = 0; i < n; i++) {
+        expr p = cs[i % num_consts](cs[(i / num_consts) % num_consts](x), (i % 3 == 0) ? x : cs[(i * 7) % num_consts]);
+        patterns.push_back(p);
+        t.insert(p, p);
+    }
+    std::vector<expr> queries;
+    for (unsigned i = 0; i < 1000; i++)
+        queries.push_back(cs[(i * 13) % num_consts](cs[i % num_consts](cs[(i * 3) % num_consts]), cs[(i * 7) % num_consts]));
+    unsigned r1 = 0, r2 = 0;
+    {
+        timeit timer(std::cout, "retrieve generalizations using discrimination tree");
+        for (expr const & q : queries) {
+            t.for_each_generalization(q, [&](expr const & p) {
+                    if (simple_match(p, q))
+                        r1++;
+                });
+        }
+    }
+    {
+        timeit timer(std::cout, "retrieve generalizations using linear scan");
+        for (expr const & q : queries) {
+            for (expr const & p : patterns) {
+                if (simple_match(p, q))
+                    r2++;
+            }
+        }
+    }
+    std::cout << "matches: " << r1 << "\n";
+    lean_assert(r1 == r2);
+    lean_assert(r1 > 0);
+}
+
+int main() {
+    save_stack_info();
+    tst1();
+    tst2();
+    return has_violations() ? 1 : 0;
+}
@@ -4,7 +4,10 @@ Released under Apache 2.0 license as described in the file LICENSE.
 
 Author: Leonardo de Moura
 */
+#include <algorithm>
+#include <vector>
 #include "util/test.h"
+#include "util/timeit.h"
 #include "kernel/abstract.h"
 #include "library/expr_lt.h"
 using namespace lean;
@@ -31,8 +34,64 @@ static void tst1() {
     lt(Const("f")(Var(0), Const("b")), Const("f")(Var(0), Const("a")), false);
 }
 
+static void tst2() {
+    expr f = Const("f");
+    expr a = Const("a");
+    expr t1 = f(Var(0), a);
+    expr t2 = f(a, Var(0));
+    expr t3 = f(f(a));
+    for (expr const & e1 : {t1, t2, t3, a, Var(1)}) {
+        for (expr const & e2 : {t1, t2, t3, a, Var(1)}) {
+            if ((get_lt_key(e1) >> 32) != (get_lt_key(e2) >> 32))
+                lean_assert(is_lt(e1, e2, false) == (get_lt_key(e1) < get_lt_key(e2)));
+            if (get_lt_key(e1) != get_lt_key(e2))
+                lean_assert(is_lt(e1, e2, true) == (get_lt_key(e1) < get_lt_key(e2)));
+        }
+    }
+    lean_assert(get_lt_key(t1) == get_lt_key(f(Var(0), a)));
+    lean_assert(get_lt_key(Var(0)) < get_lt_key(t1));
+}
+
+static void tst3() {
+    // benchmark: sort 1M terms
+    unsigned n = 1000000;
+    std::vector<expr> cs;
+    for (unsigned i = 0; i < 100; i++)
+        cs.push_back(Const(name("c", i)));
+    expr f = Const("f");
+    expr g = Const("g");
+    std::vector<expr> es;
+    for (unsigned i = 0; i < n; i++) {
+        expr c1 = cs[i % 100];
+        expr c2 = cs[(i / 100) % 100];
+        expr c3 = cs[(i / 10000) % 100];
+        switch (i % 4) {
+        case 0: es.push_back(f(c1, c2, c3)); break;
+        case 1: es.push_back(g(f(c1), c2, c3)); break;
+        case 2: es.push_back(f(g(c1, Var(i % 5)), c2, c3)); break;
+        default: es.push_back(f(c3, c2)); break;
+        }
+    }
+    std::vector<expr> es1 = es;
+    std::vector<expr> es2 = es;
+    {
+        timeit timer(std::cout, "sort 1M terms using operator<");
+        std::sort(es1.begin(), es1.end(), [](expr const & a, expr const & b) { return a < b; });
+    }
+    {
+        timeit timer(std::cout, "sort 1M terms using sort_exprs");
+        sort_exprs(es2.size(), es2.data());
+    }
+    lean_assert(std::is_sorted(es2.begin(), es2.end(), [](expr const & a, expr const & b) { return a < b; }));
+    for (unsigned i = 0; i < n; i++) {
+        lean_assert(es1[i] == es2[i]);
+    }
+}
+
 int main() {
     save_stack_info();
     tst1();
+    tst2();
+    tst3();
     return has_violations() ? 1 : 0;
 }
@@ -5,7 +5,10 @@ Released under Apache 2.0 license as described in the file LICENSE.
 Author: Leonardo de Moura
 */
 #include "util/test.h"
+#include "util/timeit.h"
+#include "util/buffer.h"
 #include "kernel/abstract.h"
+#include "kernel/find_fn.h"
 #include "library/occurs.h"
 using namespace lean;
 
@@ -22,8 +25,102 @@ static void tst1() {
     lean_assert(!occurs(a, Fun({a, T}, f(a))));
 }
 
+static void tst2() {
+    // occurs checks prune subterms using the name fingerprints
+    expr f = Const("f");
+    buffer<expr> cs;
+    unsigned fingerprint = 0;
+    for (unsigned i = 0; cs.size() < 4; i++) {
+        name n("c", i);
+        if ((fingerprint & mk_name_fingerprint(n)) == 0) {
+            fingerprint |= mk_name_fingerprint(n) | mk_name_fingerprint("f");
+            cs.push_back(Const(n));
+        }
+    }
+    // c is a constant whose fingerprint bit is not set in the fingerprint of the terms below
+    name c("d", 0u);
+    for (unsigned i = 0; (mk_name_fingerprint(c) & fingerprint) != 0; i++)
+        c = name("d", i);
+    buffer<expr> ts;
+    for (unsigned i = 0; i < 1000; i++) {
+        expr t = cs[i % cs.size()];
+        for (unsigned j = 0; j < 100; j++)
+            t = f(t, cs[(i + j) % cs.size()]);
+        ts.push_back(t);
+    }
+    unsigned r1 = 0, r2 = 0;
+    {
+        timeit timer(std::cout, "occurs with fingerprints");
+        for (expr const & t : ts) {
+            if (occurs(c, t) || occurs(Const(c), t))
+                r1++;
+        }
+    }
+    {
+        timeit timer(std::cout, "occurs without fingerprints");
+        for (expr const & t : ts) {
+            if (find(t, [&](expr const & e, unsigned) { return is_constant(e) && const_name(e) == c; }))
+                r2++;
+        }
+    }
+    lean_assert(r1 == 0 && r2 == 0);
+    lean_assert(occurs(cs[0], ts[0]));
+    lean_assert(occurs(f(cs[0], cs[0]), ts[0]));
+    lean_assert(!occurs(f(cs[0], cs[1]), ts[0]));
+    lean_assert(occurs(const_name(cs[1]), ts[5]));
+}
+
+static void tst3() {
+    // terms using k constants with numeric suffixes (e.g., names produced by name generators),
+    // the fingerprint of the root must rule out many absent constants
+    expr f = Const("f");
+    unsigned seed = 7;
+    auto next = [&]() { seed = seed * 1103515245u + 12345u; return (seed >> 8) % 1000; };
+    for (unsigned k : {4, 8, 12, 16}) {
+        buffer<expr> ts;
+        for (unsigned i = 0; i < 1000; i++) {
+            expr t = Const(name("c", next()));
+            for (unsigned j = 1; j < k; j++)
+                t = f(t, Const(name("c", next())));
+            for (unsigned j = 0; j < 6; j++)
+                t = f(t, t);
+            ts.push_back(t);
+        }
+        unsigned num_pruned = 0, num_queries = 0, r1 = 0, r2 = 0;
+        for (expr const & t : ts) {
+            for (unsigned i = 0; i < 100; i++) {
+                num_queries++;
+                if ((get_name_fingerprint(t) & mk_name_fingerprint(name("c", 1000 + i))) == 0)
+                    num_pruned++;
+            }
+        }
+        {
+            timeit timer(std::cout, "occurs with fingerprints");
+            for (expr const & t : ts)
+                for (unsigned i = 0; i < 100; i++)
+                    if (occurs(name("c", 1000 + i), t))
+                        r1++;
+        }
+        {
+            timeit timer(std::cout, "occurs without fingerprints");
+            for (expr const & t : ts)
+                for (unsigned i = 0; i < 100; i++)
+                    if (find(t, [&](expr const & e, unsigned) { return is_constant(e) && const_name(e) == name("c", 1000 + i); }))
+                        r2++;
+        }
+        std::cout << k << " constants per term, absent constants ruled out at the root: "
+                  << (100.0 * num_pruned) / num_queries << "%\n";
+        lean_assert(r1 == 0 && r2 == 0);
+        lean_assert(num_pruned > num_queries / 4);
+        if (k == 4)
+            lean_assert(num_pruned > num_queries / 2);
+    }
+}
+
 int main() {
     save_stack_info();
     tst1();
+    tst2();
+    tst3();
     return has_violations() ? 1 : 0;
 }
@@ -0,0 +1,109 @@
+/*
+Copyright (c) 2014 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+
+Author: Leonardo de Moura
+*/
+#include <iostream>
+#include "util/test.h"
+#include "util/timeit.h"
+#include "util/interrupt.h"
+#include "util/parallel_for.h"
+using namespace lean;
+
+static void tst1() {
+    // request_interrupt is detected by the next check_system
+    for (unsigned i = 0; i < 10; i++)
+        check_system("test");
+    request_interrupt();
+    try {
+        check_system("test");
+        lean_unreachable();
+    } catch (interrupted &) {
+        std::cout << "interrupted\n";
+    }
+    lean_assert(!interrupt_requested());
+    for (unsigned i = 0; i < 1000; i++)
+        check_system("test");
+}
+
+static void tst2() {
+#if defined(LEAN_MULTI_THREAD)
+    // interrupt requests from other threads are detected in at most LEAN_CHECK_SYSTEM_PERIOD invocations
+    atomic<bool> started(false);
+    atomic<unsigned> num(0);
+    interruptible_thread t([&]() {
+            try {
+                while (true) {
+                    started = true;
+                    check_system("test");
+                    num++;
+                }
+            } catch (interrupted &) {
+            }
+        });
+    while (!started)
+        this_thread::yield();
+    t.request_interrupt();
+    t.join();
+    std::cout << "number of check_system invocations: " << num.load() << "\n";
+#endif
+}
+
+static void tst4() {
+#if defined(LEAN_MULTI_THREAD)
+    // interrupt requests are forwarded to the worker threads of parallel_for
+    atomic<unsigned> started(0);
+    atomic<bool>     caught(false);
+    interruptible_thread t([&]() {
+            try {
+                parallel_for(4, 2, [&](unsigned, unsigned) {
+                        started++;
+                        while (true)
+                            check_system("test");
+                    });
+            } catch (interrupted &) {
+                caught = true;
+            }
+        });
+    while (started == 0)
+        this_thread::yield();
+    t.request_interrupt();
+    t.join();
+    lean_assert(caught);
+    lean_assert(started <= 2);
+    // exceptions thrown by the worker threads are rethrown
+    try {
+        parallel_for(100, 3, [&](unsigned i, unsigned) {
+                if (i == 50)
+                    throw exception("failed");
+            });
+        lean_unreachable();
+    } catch (exception & ex) {
+        std::cout << "expected error: " << ex.what() << "\n";
+    }
+#endif
+}
+
+static void tst3() {
+    unsigned n = 100000000;
+    {
+        timeit timer(std::cout, "check_system (amortized)");
+        for (unsigned i = 0; i < n; i++)
+            check_system("test");
+    }
+    {
+        timeit timer(std::cout, "check_system_core");
+        for (unsigned i = 0; i < n; i++)
+            check_system_core("test");
+    }
+}
+
+int main() {
+    save_stack_info();
+    tst1();
+    tst2();
+    tst3();
+    tst4();
+    return has_violations() ? 1 : 0;
+}
@@ -7,6 +7,7 @@ Author: Leonardo de Moura
 #pragma once
 #include <algorithm>
 #include <cstring>
+#include <utility>
 #include "util/debug.h"
 
 namespace lean {
@@ -110,11 +111,18 @@ public:
         m_pos++;
     }
 
+    void push_back(T && elem) {
+        if (m_pos >= m_capacity)
+            expand();
+        new (m_buffer + m_pos) T(std::move(elem));
+        m_pos++;
+    }
+
     template<typename... Args>
     void emplace_back(Args&&... args) {
         if (m_pos >= m_capacity)
             expand();
-        new (m_buffer + m_pos) T(args...);
+        new (m_buffer + m_pos) T(std::forward<Args>(args)...);
         m_pos++;
     }
 
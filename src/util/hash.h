@@ -6,6 +6,7 @@ Author: Leonardo de Moura
 */
 #pragma once
 #include "util/debug.h"
+#include "util/int64.h"
 
 namespace lean {
 
@@ -13,6 +14,20 @@ void mix(unsigned & a, unsigned & b, unsigned & c);
 
 unsigned hash_str(unsigned len, char const * str, unsigned init_value);
 
+/**
+   \brief Combine two 64-bit hash codes. The result depends on the order of the arguments.
+   It uses the finalizer of MurmurHash3, so all bits of the result depend on all bits of the arguments.
+*/
+inline uint64 hash64(uint64 h1, uint64 h2) {
+    uint64 h = h1 ^ (h2 + 0x9e3779b97f4a7c15ull + (h1 << 6) + (h1 >> 2));
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
 inline unsigned hash(unsigned h1, unsigned h2) {
     h2 -= h1; h2 ^= (h1 << 8);
     h1 -= h2; h2 ^= (h1 << 16);
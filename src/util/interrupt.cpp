@@ -10,9 +10,11 @@ Author: Leonardo de Moura
 
 namespace lean {
 static LEAN_THREAD_LOCAL atomic_bool g_interrupt;
+LEAN_THREAD_LOCAL unsigned g_check_system_countdown = LEAN_CHECK_SYSTEM_PERIOD;
 
 void request_interrupt() {
     g_interrupt.store(true);
+    g_check_system_countdown = 1;
 }
 
 void reset_interrupt() {
@@ -30,6 +32,12 @@ void check_interrupted() {
     }
 }
 
+void check_system_core(char const * component_name) {
+    g_check_system_countdown = LEAN_CHECK_SYSTEM_PERIOD;
+    check_stack(component_name);
+    check_interrupted();
+}
+
 void sleep_for(unsigned ms, unsigned step_ms) {
     if (step_ms == 0)
         step_ms = 1;
@@ -13,6 +13,8 @@ Author: Leonardo de Moura
 namespace lean {
 /**
    \brief Mark flag for interrupting current thread.
+
+   \remark It only updates thread local variables. So, it can be used in signal handlers.
 */
 void request_interrupt();
 /**
@@ -30,7 +32,30 @@ bool interrupt_requested();
 */
 void check_interrupted();
 
-inline void check_system(char const * component_name) { check_stack(component_name); check_interrupted(); }
+#ifndef LEAN_CHECK_SYSTEM_PERIOD
+#define LEAN_CHECK_SYSTEM_PERIOD 32
+#endif
+
+/**
+   \brief Number of \c check_system invocations the current thread can still perform before
+   the actual stack and interrupt checks are executed.
+*/
+extern LEAN_THREAD_LOCAL unsigned g_check_system_countdown;
+
+/** \brief Check whether the stack space is low or the current thread was interrupted, and reset \c g_check_system_countdown. */
+void check_system_core(char const * component_name);
+
+/**
+   \brief Throw an exception if the amount of available stack space is low, or the current thread was interrupted.
+
+   \remark To minimize the overhead in hot loops, the actual checks are performed once every
+   LEAN_CHECK_SYSTEM_PERIOD invocations. \c request_interrupt forces the next invocation to perform them.
+   Note that LEAN_MIN_STACK_SPACE must be big enough for LEAN_CHECK_SYSTEM_PERIOD recursive calls.
+*/
+inline void check_system(char const * component_name) {
+    if (--g_check_system_countdown == 0)
+        check_system_core(component_name);
+}
 
 constexpr unsigned g_small_sleep = 50;
 
@@ -0,0 +1,163 @@
+/*
+Copyright (c) 2014 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+
+Author: Leonardo de Moura
+*/
+#include <cstdlib>
+#include <new>
+#include <utility>
+#include <algorithm>
+#include "util/thread.h"
+#include "util/debug.h"
+#include "util/memory_pool.h"
+#if defined(LEAN_WINDOWS) && !defined(LEAN_CYGWIN)
+#include <malloc.h> // NOLINT
+#endif
+
+namespace lean {
+constexpr size_t   g_chunk_size  = LEAN_MEMORY_POOL_CHUNK_SIZE;
+constexpr size_t   g_header_size = 16; // space reserved for pool_chunk_header
+constexpr unsigned g_num_classes = LEAN_MEMORY_POOL_MAX_OBJECT_SIZE / 8;
+static_assert((g_chunk_size & (g_chunk_size - 1)) == 0, "LEAN_MEMORY_POOL_CHUNK_SIZE must be a power of two");
+static_assert(sizeof(pool_chunk_header) <= g_header_size, "unexpected chunk header size");
+
+static unsigned get_class(size_t sz) { lean_assert(sz > 0 && sz <= LEAN_MEMORY_POOL_MAX_OBJECT_SIZE); return (sz + 7) / 8 - 1; }
+static size_t get_class_size(unsigned c) { return (c + 1) * 8; }
+
+struct free_node {
+    free_node * m_next;
+};
+
+/** \brief Free lists of terminated threads, and counters shared by all threads. */
+struct global_pool {
+    mutex            m_mutex;
+    free_node *      m_free[g_num_classes];
+    atomic<unsigned> m_next_chunk_id;
+    atomic<unsigned> m_num_chunks;
+    global_pool():m_next_chunk_id(0), m_num_chunks(0) {
+        for (unsigned i = 0; i < g_num_classes; i++)
+            m_free[i] = nullptr;
+    }
+};
+
+static global_pool & get_global_pool() {
+    // Remark: the global pool is never deleted, since objects may be deallocated during the destruction of static objects.
+    static global_pool * g_pool = new global_pool();
+    return *g_pool;
+}
+
+/** \brief Reserve a new chunk for objects of class \c c, and return the list of its slots. */
+static free_node * mk_chunk(unsigned c) {
+    global_pool & g = get_global_pool();
+    void * r = nullptr;
+#if defined(LEAN_WINDOWS) && !defined(LEAN_CYGWIN)
+    r = _aligned_malloc(g_chunk_size, g_chunk_size);
+#else
+    if (posix_memalign(&r, g_chunk_size, g_chunk_size) != 0)
+        r = nullptr;
+#endif
+    if (r == nullptr)
+        throw std::bad_alloc();
+    g.m_num_chunks++;
+    char * base = static_cast<char *>(r);
+    reinterpret_cast<pool_chunk_header *>(base)->m_id = g.m_next_chunk_id++;
+    size_t sz    = get_class_size(c);
+    // build the free list in reverse order, so that objects are allocated in increasing address order
+    free_node * head = nullptr;
+    size_t n = (g_chunk_size - g_header_size) / sz;
+    for (size_t i = n; i > 0; i--) {
+        free_node * node = reinterpret_cast<free_node *>(base + g_header_size + (i - 1) * sz);
+        lean_assert(reinterpret_cast<char *>(node) + sz <= base + g_chunk_size);
+        node->m_next = head;
+        head = node;
+    }
+    return head;
+}
+
+static void append(free_node * & l1, free_node * l2) {
+    if (l2 == nullptr)
+        return;
+    free_node * it = l2;
+    while (it->m_next)
+        it = it->m_next;
+    it->m_next = l1;
+    l1 = l2;
+}
+
+class thread_pool {
+    free_node * m_free[g_num_classes];
+public:
+    thread_pool() {
+        for (unsigned i = 0; i < g_num_classes; i++)
+            m_free[i] = nullptr;
+    }
+    ~thread_pool() {
+        global_pool & g = get_global_pool();
+        lock_guard<mutex> lock(g.m_mutex);
+        for (unsigned i = 0; i < g_num_classes; i++)
+            append(g.m_free[i], m_free[i]);
+    }
+    void * alloc(unsigned c) {
+        if (m_free[c] == nullptr) {
+            global_pool & g = get_global_pool();
+            {
+                lock_guard<mutex> lock(g.m_mutex);
+                std::swap(m_free[c], g.m_free[c]);
+            }
+            if (m_free[c] == nullptr)
+                m_free[c] = mk_chunk(c);
+        }
+        free_node * r = m_free[c];
+        m_free[c] = r->m_next;
+        return r;
+    }
+    void dealloc(void * p, unsigned c) {
+        free_node * n = static_cast<free_node *>(p);
+        n->m_next  = m_free[c];
+        m_free[c]  = n;
+    }
+};
+
+// Remark: the thread pool of the current thread may have been destroyed before static objects (and thread local objects)
+// that contain objects allocated in the pool. The flag \c g_finalized is used to detect this case.
+static LEAN_THREAD_LOCAL bool g_finalized = false;
+
+struct thread_pool_holder {
+    thread_pool m_pool;
+    ~thread_pool_holder() { g_finalized = true; }
+};
+
+static thread_pool & get_thread_pool() {
+    static LEAN_THREAD_LOCAL thread_pool_holder g_holder;
+    return g_holder.m_pool;
+}
+
+void * pool_alloc(size_t sz) {
+    unsigned c = get_class(sz);
+    if (!g_finalized)
+        return get_thread_pool().alloc(c);
+    global_pool & g = get_global_pool();
+    lock_guard<mutex> lock(g.m_mutex);
+    if (g.m_free[c] == nullptr)
+        g.m_free[c] = mk_chunk(c);
+    free_node * r = g.m_free[c];
+    g.m_free[c] = r->m_next;
+    return r;
+}
+
+void pool_dealloc(void * p, size_t sz) {
+    unsigned c = get_class(sz);
+    if (!g_finalized)
+        return get_thread_pool().dealloc(p, c);
+    global_pool & g = get_global_pool();
+    lock_guard<mutex> lock(g.m_mutex);
+    free_node * n = static_cast<free_node *>(p);
+    n->m_next = g.m_free[c];
+    g.m_free[c] = n;
+}
+
+size_t get_pool_memory() {
+    return static_cast<size_t>(get_global_pool().m_num_chunks.load()) * g_chunk_size;
+}
+}
@@ -0,0 +1,51 @@
+/*
+Copyright (c) 2014 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+
+Author: Leonardo de Moura
+*/
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#ifndef LEAN_MEMORY_POOL_CHUNK_SIZE
+#define LEAN_MEMORY_POOL_CHUNK_SIZE 65536
+#endif
+
+#ifndef LEAN_MEMORY_POOL_MAX_OBJECT_SIZE
+#define LEAN_MEMORY_POOL_MAX_OBJECT_SIZE 128
+#endif
+
+namespace lean {
+/**
+   \brief Allocate an object of size \c sz (<= LEAN_MEMORY_POOL_MAX_OBJECT_SIZE) from the memory pool.
+
+   The memory pool reserves chunks of LEAN_MEMORY_POOL_CHUNK_SIZE bytes aligned at their size.
+   Each chunk only contains objects of the same size (rounded up to a multiple of 8).
+   Each thread has its own free lists, so no synchronization is needed in the common case.
+   The free lists of terminated threads are reused by other threads.
+   Remark: the chunks are never returned to the system.
+*/
+void * pool_alloc(size_t sz);
+/** \brief Return the object \c p of size \c sz to the memory pool. */
+void pool_dealloc(void * p, size_t sz);
+/** \brief Return the total amount of memory (in bytes) reserved by the memory pool. */
+size_t get_pool_memory();
+
+/** \brief Header stored at the beginning of each chunk. */
+struct pool_chunk_header {
+    unsigned m_id;
+};
+
+/**
+   \brief Return an identifier for the memory slot containing the object \c p allocated by \c pool_alloc.
+   Live objects have distinct identifiers (as long as less than 2^32 / (LEAN_MEMORY_POOL_CHUNK_SIZE / 8) chunks are used).
+   The chunk identifiers are assigned in order, so the identifiers are deterministic in single threaded executions.
+*/
+inline unsigned get_pool_slot(void const * p) {
+    uintptr_t a    = reinterpret_cast<uintptr_t>(p);
+    uintptr_t base = a & ~static_cast<uintptr_t>(LEAN_MEMORY_POOL_CHUNK_SIZE - 1);
+    unsigned id    = reinterpret_cast<pool_chunk_header const *>(base)->m_id;
+    return id * (LEAN_MEMORY_POOL_CHUNK_SIZE / 8) + static_cast<unsigned>((a - base) / 8);
+}
+}
@@ -0,0 +1,105 @@
+/*
+Copyright (c) 2014 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+
+Author: Leonardo de Moura
+*/
+#pragma once
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include "util/thread.h"
+#include "util/interrupt.h"
+#include "util/exception.h"
+
+namespace lean {
+/**
+   \brief Return the number of threads used by \c parallel_for to process \c num indices when
+   \c num_threads threads are requested (0 means one per hardware thread).
+*/
+#if defined(LEAN_MULTI_THREAD)
+inline unsigned get_parallel_for_num_threads(unsigned num, unsigned num_threads) {
+    if (num_threads == 0)
+        num_threads = std::max(thread::hardware_concurrency(), 1u);
+    return std::max(std::min(num_threads, num), 1u);
+}
+#else
+inline unsigned get_parallel_for_num_threads(unsigned, unsigned) { return 1; }
+#endif
+
+/**
+   \brief Invoke <tt>fn(i, w)</tt> for each \c i in <tt>[0, num)</tt> using \c num_threads threads
+   (0 means one per hardware thread). The argument \c w is the index of the thread processing \c i, it is
+   smaller than <tt>get_parallel_for_num_threads(num, num_threads)</tt>, and can be used to access
+   thread specific data. The indices are assigned to the threads on demand, so \c fn must be thread safe,
+   and the order of the invocations is not specified.
+
+   If \c fn throws an exception, then the indices that were not processed yet are skipped, and
+   the exception is rethrown (if several invocations fail, one of the exceptions is selected).
+   If the calling thread is interrupted while it waits for the worker threads, then the interrupt request
+   is forwarded to them, and \c interrupted is thrown after they finish.
+
+   \remark When Lean is compiled without support for multi-threading, the indices are processed
+   sequentially by the current thread.
+*/
+template<typename F>
+void parallel_for(unsigned num, unsigned num_threads, F && fn) {
+    num_threads = get_parallel_for_num_threads(num, num_threads);
+#if defined(LEAN_MULTI_THREAD)
+    if (num_threads > 1) {
+        atomic<unsigned>                                   next(0);
+        mutex                                              mtx;
+        condition_variable                                 cv;
+        unsigned                                           num_done = 0; // number of worker threads that finished
+        std::unique_ptr<exception>                         ex;
+        std::vector<std::unique_ptr<interruptible_thread>> threads;
+        auto set_exception = [&](exception const & e) {
+            lock_guard<mutex> lock(mtx);
+            if (!ex)
+                ex.reset(e.clone());
+            next = num;
+        };
+        for (unsigned w = 0; w < num_threads; w++) {
+            threads.emplace_back(new interruptible_thread([&, w]() {
+                        try {
+                            while (true) {
+                                unsigned i = next++;
+                                if (i >= num)
+                                    break;
+                                fn(i, w);
+                            }
+                        } catch (exception & e) {
+                            set_exception(e);
+                        } catch (...) {
+                            set_exception(exception("unexpected error in parallel task"));
+                        }
+                        lock_guard<mutex> lock(mtx);
+                        num_done++;
+                        cv.notify_all();
+                    }));
+        }
+        try {
+            unique_lock<mutex> lock(mtx);
+            while (num_done < num_threads) {
+                check_interrupted();
+                cv.wait_for(lock, chrono::milliseconds(g_small_sleep));
+            }
+        } catch (...) {
+            next = num;
+            for (auto & t : threads)
+                t->request_interrupt();
+            for (auto & t : threads)
+                t->join();
+            throw;
+        }
+        for (auto & t : threads)
+            t->join();
+        if (ex)
+            ex->rethrow();
+        return;
+    }
+#endif
+    for (unsigned i = 0; i < num; i++)
+        fn(i, 0);
+}
+}
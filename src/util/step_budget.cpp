@@ -0,0 +1,37 @@
+/*
+Copyright (c) 2014 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+
+Author: Leonardo de Moura
+*/
+#include <limits>
+#include <algorithm>
+#include "util/step_budget.h"
+
+namespace lean {
+LEAN_THREAD_LOCAL uint64 g_steps_left = std::numeric_limits<uint64>::max();
+static unsigned g_default_max_steps = 0;
+
+void throw_step_budget_exception() {
+    g_steps_left = 0;
+    throw step_budget_exception();
+}
+
+scoped_step_budget::scoped_step_budget(unsigned max_steps, unsigned & used):
+    m_old_steps_left(g_steps_left), m_used(used) {
+    if (max_steps == 0)
+        m_start = m_old_steps_left;
+    else
+        m_start = std::min(m_old_steps_left, static_cast<uint64>(used < max_steps ? max_steps - used : 0));
+    g_steps_left = m_start;
+}
+
+scoped_step_budget::~scoped_step_budget() {
+    uint64 consumed = m_start - g_steps_left;
+    m_used        += static_cast<unsigned>(consumed);
+    g_steps_left   = m_old_steps_left - consumed;
+}
+
+void set_default_max_steps(unsigned max_steps) { g_default_max_steps = max_steps; }
+unsigned get_default_max_steps() { return g_default_max_steps; }
+}
@@ -0,0 +1,64 @@
+/*
+Copyright (c) 2014 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+
+Author: Leonardo de Moura
+*/
+#pragma once
+#include "util/thread.h"
+#include "util/int64.h"
+#include "util/exception.h"
+
+namespace lean {
+/**
+   \brief Exception used to sign that the deterministic step budget of the current
+   thread has been exhausted (see \c scoped_step_budget).
+*/
+class step_budget_exception : public exception {
+public:
+    step_budget_exception() {}
+    virtual ~step_budget_exception() noexcept {}
+    virtual char const * what() const noexcept { return "step budget exhausted"; }
+    virtual exception * clone() const { return new step_budget_exception(); }
+    virtual void rethrow() const { throw *this; }
+};
+
+/** \brief Number of steps the current thread can still perform. It is "infinite" if there is no budget. */
+extern LEAN_THREAD_LOCAL uint64 g_steps_left;
+
+[[ noreturn ]] void throw_step_budget_exception();
+
+/**
+   \brief Consume \c n steps from the budget of the current thread.
+   Throw a \c step_budget_exception if the budget is exhausted.
+
+   Unlike \c check_interrupted, the exception is thrown at the same point in every
+   execution. So, it can be used to bound the cost of kernel operations in a
+   machine independent way.
+*/
+inline void consume_steps(unsigned n = 1) {
+    if (n > g_steps_left)
+        throw_step_budget_exception();
+    g_steps_left -= n;
+}
+
+/**
+   \brief Install a budget of \c max_steps steps (0 means unlimited) for the current thread
+   while this object is alive. \c used is the number of steps already consumed from this budget,
+   and it is updated when the object is destructed.
+   Nested budgets are intersected with the enclosing ones, and the steps consumed
+   in a nested budget are also consumed from the enclosing ones.
+*/
+class scoped_step_budget {
+    uint64     m_old_steps_left;
+    uint64     m_start;
+    unsigned & m_used;
+public:
+    scoped_step_budget(unsigned max_steps, unsigned & used);
+    ~scoped_step_budget();
+};
+
+/** \brief Set the budget used by type checkers when no budget is explicitly provided (0 means unlimited). */
+void set_default_max_steps(unsigned max_steps);
+unsigned get_default_max_steps();
+}
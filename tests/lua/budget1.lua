@@ -0,0 +1,26 @@
+local f   = Const("f")
+local x   = Const("x")
+local a   = mk_local("a", Bool)
+local B2B = mk_arrow(Bool, Bool)
+local function church(k)
+   local r = x
+   for i = 1, k do r = f(r) end
+   return Fun({{f, B2B}, {x, Bool}}, r)
+end
+local env = empty_environment()
+local t   = church(100)(Fun(x, Bool, x), a)
+local tc  = type_checker(env, name_generator("tst"))
+assert(tc:whnf(t) == a)
+local n   = tc:num_steps()
+print(n)
+assert(n >= 100)
+local tc2 = type_checker(env, name_generator("tst"), {max_steps=n-1})
+assert(not pcall(function() tc2:whnf(t) end))
+assert(tc2:num_steps() == n-1)
+tc2:set_max_steps(n)
+assert(tc2:whnf(t) == a)
+set_default_max_steps(10)
+assert(get_default_max_steps() == 10)
+local tc3 = type_checker(env, name_generator("tst"))
+assert(not pcall(function() tc3:whnf(t) end))
+set_default_max_steps(0)
@@ -0,0 +1,29 @@
+local f, g, a, b = Const("f"), Const("g"), Const("a"), Const("b")
+local x, y       = mk_metavar("x", Bool), mk_metavar("y", Bool)
+local l          = mk_local("l", Bool)
+local t = discr_tree()
+assert(is_discr_tree(t))
+assert(t:empty())
+t = t:insert(f(x, a)):insert(f(a, x)):insert(f(l, y), Const("rule")):insert(g(x))
+assert(t:size() == 4)
+local function contains(vs, e)
+   for _, v in ipairs(vs) do
+      if v == e then return true end
+   end
+   return false
+end
+local r = t:generalizations(f(a, b))
+assert(#r == 2)
+assert(contains(r, f(a, x)))
+assert(contains(r, Const("rule")))
+assert(#t:instances(f(x, a)) == 1)
+assert(#t:unifiables(f(x, b)) == 2)
+assert(#t:unifiables(x) == 4)
+local t2 = t:erase(f(l, y), Const("rule"))
+assert(t2:size() == 3)
+assert(t:size() == 4)
+assert(not contains(t2:generalizations(f(a, b)), Const("rule")))
+local ks = discr_tree_keys(f(g(x), a))
+assert(#ks == 4)
+assert(ks[1] == "f/2")
+assert(ks[3] == "*")
@@ -0,0 +1,36 @@
+local env = empty_environment()
+local x   = Const("x")
+env = add_decl(env, mk_var_decl("N", Type))
+env = add_decl(env, mk_var_decl("P", mk_arrow(Const("N"), Bool)))
+for i = 1, 100 do
+   -- each declaration uses its own copy of N -> N -> N
+   local N = Const("N")
+   env = add_decl(env, mk_var_decl("f" .. i, mk_arrow(N, mk_arrow(N, N))))
+   env = add_decl(env, mk_axiom("ax" .. i, Pi(x, N, Const("P")(Const("f" .. i)(x, x)))))
+end
+-- structurally equal types with different binder names and binder_info
+env = add_decl(env, mk_var_decl("g", mk_pi("A", Type, mk_arrow(Var(0), Var(1)), binder_info(true))))
+env = add_decl(env, mk_var_decl("h", mk_pi("B", Type, mk_arrow(Var(0), Var(1)))))
+local env2, r = env:compact()
+assert(env2:is_descendant(env))
+assert(r.definitions == 204)
+assert(r.cells_after < r.cells_before)
+assert(r.size_after < r.size_before)
+assert(r.names > 0 and r.levels >= 0)
+print("cells: " .. r.cells_before .. " => " .. r.cells_after)
+for i = 1, 100 do
+   assert(env2:get("f" .. i):type() == env:get("f" .. i):type())
+   assert(env2:get("ax" .. i):type() == env:get("ax" .. i):type())
+end
+assert(env2:get("f1"):type():is_pi())
+local g_type = env2:get("g"):type()
+local h_type = env2:get("h"):type()
+assert(g_type == h_type)
+assert(g_type:binder_name() == name("A") and g_type:binder_info():is_implicit())
+assert(h_type:binder_name() == name("B") and not h_type:binder_info():is_implicit())
+-- the number of threads is optional
+local env3, r3 = env:compact(2)
+assert(r3.cells_after == r.cells_after)
+-- the compacted environment can be stored in the global environment
+set_environment(env2)
+assert(get_environment():find("ax1"))
@@ -0,0 +1,30 @@
+local env = empty_environment()
+local x   = Const("x")
+local B2B = mk_arrow(Bool, Bool)
+local a, b, c, d = Const("a"), Const("b"), Const("c"), Const("d")
+env = add_decl(env, mk_definition("a", B2B, Fun(x, Bool, x), {opaque=false}))
+env = add_decl(env, mk_definition("b", B2B, a, {opaque=false}))
+env = add_decl(env, mk_definition("c", B2B, Fun(x, Bool, b(x)), {opaque=false}))
+env = add_decl(env, mk_definition("d", B2B, Fun(x, Bool, x), {opaque=false}))
+assert(env:dependencies("c"):contains("b"))
+assert(env:dependents("a"):contains("b"))
+local l = env:transitive_dependents("a")
+assert(#l == 3)
+assert(l:head() == name("a"))
+assert(l:tail():tail():head() == name("c"))
+assert(#env:transitive_dependents({"a", "d"}) == 4)
+assert(not pcall(function() env:remove(name_set("b")) end))
+local env2 = env:remove(name_set("b", "c"))
+assert(not env2:find("b"))
+assert(not env2:dependents("a"):contains("b"))
+local env3 = recheck(env, {mk_definition("a", B2B, Fun(x, Bool, d(x)), {opaque=false})})
+assert(env3:find("c"))
+assert(env3:get("a"):value() == Fun(x, Bool, d(x)))
+assert(env3:dependents("d"):contains("a"))
+assert(not pcall(function() recheck(env, {mk_definition("a", Bool, Bool)}) end))
+-- a new value may refer to a new definition
+local f = Const("f")
+local env4 = recheck(env, {mk_definition("a", B2B, Fun(x, Bool, f(x)), {opaque=false}),
+                           mk_definition("f", B2B, Fun(x, Bool, x), {opaque=false})})
+assert(env4:dependents("f"):contains("a"))
+assert(env4:find("c"))
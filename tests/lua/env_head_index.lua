@@ -0,0 +1,23 @@
+local env = empty_environment()
+local A, P, a = Const("A"), Const("P"), Const("a")
+local x   = Const("x")
+env = add_decl(env, mk_var_decl("N", Type))
+env = add_decl(env, mk_var_decl("zero", Const("N")))
+env = add_decl(env, mk_var_decl("le", mk_arrow(Const("N"), mk_arrow(Const("N"), Bool))))
+env = add_decl(env, mk_axiom("le_refl", Pi(x, Const("N"), Const("le")(x, x))))
+assert(not env:has_head_index())
+assert(not pcall(function() env:definitions_with_head("le") end))
+env = env:enable_head_index()
+assert(env:has_head_index())
+assert(env:definitions_with_head("N"):contains("zero"))
+assert(env:definitions_with_head("le"):contains("le_refl"))
+assert(not env:definitions_with_head("le"):contains("le_zero"))
+-- the index is updated incrementally
+env = add_decl(env, mk_axiom("le_zero", Pi(x, Const("N"), Const("le")(Const("zero"), x))))
+env = add_decl(env, mk_var_decl("f", Pi(A, Type, P, mk_arrow(A, Bool), a, A, P(a))))
+assert(env:definitions_with_head("le"):contains("le_zero"))
+assert(not env:definitions_with_head("P"):contains("f"))
+local env2 = env:remove(name_set("le_refl"))
+assert(env2:has_head_index())
+assert(not env2:definitions_with_head("le"):contains("le_refl"))
+assert(env:definitions_with_head("le"):contains("le_refl"))
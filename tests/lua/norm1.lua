@@ -0,0 +1,31 @@
+local env = empty_environment()
+local f   = Const("f")
+local x   = Const("x")
+local n   = Const("n")
+local m   = Const("m")
+local B2B = mk_arrow(Bool, Bool)
+local N   = mk_arrow(B2B, B2B)
+local function church(k)
+   local r = x
+   for i = 1, k do r = f(r) end
+   return Fun({{f, B2B}, {x, Bool}}, r)
+end
+env = add_decl(env, mk_definition("two", N, church(2), {opaque=false}))
+env = add_decl(env, mk_definition("add", mk_arrow(N, mk_arrow(N, N)),
+                                  Fun({{n, N}, {m, N}, {f, B2B}, {x, Bool}}, n(f, m(f, x))), {opaque=false}))
+local tc  = type_checker(env, name_generator("tst"))
+local r   = tc:normalize(Const("add")(Const("two"), Const("two")))
+print(r)
+assert(r == church(4))
+-- opaque definitions are not unfolded
+env = add_decl(env, mk_definition("two_opaque", N, church(2)))
+tc  = type_checker(env, name_generator("tst"))
+r   = tc:normalize(Const("add")(Const("two_opaque"), Const("two_opaque")))
+print(r)
+assert(r == Fun({{f, B2B}, {x, Bool}}, Const("two_opaque")(f, Const("two_opaque")(f, x))))
+-- loose variables are not captured by the binders of the result
+r   = tc:normalize(mk_lambda("x", Bool, Var(1)))
+assert(r == mk_lambda("x", Bool, Var(1)))
+r   = tc:normalize(mk_lambda("y", Bool, mk_lambda("x", Bool, f(Var(1), Var(2), Var(3))))(Const("a")))
+print(r)
+assert(r == mk_lambda("x", Bool, f(Const("a"), Var(1), Var(2))))
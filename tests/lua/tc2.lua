@@ -0,0 +1,34 @@
+local env = empty_environment()
+local g   = name_generator("tst")
+local a   = Const("a")
+local calls = 0
+local cs  = {}
+local tc  = type_checker(env, g, constraint_handler(function (b)
+                                                       calls = calls + 1
+                                                       for i = 1, #b do
+                                                          print(b[i])
+                                                          cs[#cs+1] = b[i]
+                                                       end
+                                                    end, true))
+local m   = mk_metavar("m1", mk_metavar("m2", mk_sort(mk_meta_univ("u"))))
+local t   = Fun(a, Bool, m(a))
+print(tc:check(t))
+assert(calls == 1)
+assert(#cs == 2)
+-- duplicate constraints are sent only once
+local f   = Const("f")
+local m3  = mk_metavar("m3", Bool)
+assert(tc:is_def_eq(f(m3, m3), f(a, a)))
+assert(calls == 2)
+assert(#cs == 3)
+-- no constraints, handler is not invoked
+print(tc:check(Fun(a, Bool, a)))
+assert(calls == 2)
+-- handlers created without the batch flag receive each constraint as soon as it is produced
+local calls2 = 0
+local tc2 = type_checker(env, g, constraint_handler(function (c)
+                                                        assert(is_constraint(c))
+                                                        calls2 = calls2 + 1
+                                                     end))
+print(tc2:check(t))
+assert(calls2 == 2)
@@ -0,0 +1,24 @@
+local env = empty_environment()
+local f   = Const("f")
+local x   = Const("x")
+local B2B = mk_arrow(Bool, Bool)
+local N   = mk_arrow(B2B, B2B)
+env = add_decl(env, mk_definition("two", N, Fun({{f, B2B}, {x, Bool}}, f(f(x))), {opaque=false}))
+env = add_decl(env, mk_definition("id", mk_arrow(N, N), Fun({{x, N}}, x), {opaque=false}))
+local tc = type_checker(env, name_generator("tst"))
+local s  = tc:stats()
+assert(s.infer == 0 and s.whnf == 0 and s.delta == 0 and s.is_def_eq == 0)
+assert(tc:is_def_eq(Const("id")(Const("two")), Fun({{f, B2B}, {x, Bool}}, f(f(x)))))
+tc:infer(Const("id")(Const("two")))
+tc:infer(Const("id")(Const("two")))
+s = tc:stats()
+for k, v in pairs(s) do print(k, v) end
+assert(s.is_def_eq == 1)
+assert(s.delta >= 2)
+assert(s.infer > 0 and s.infer_hits > 0)
+assert(s.whnf_core > 0)
+assert(s.is_def_eq_time >= 0)
+assert(s.cnstrs == 0)
+assert(s.struct_fallbacks >= 0 and s.infer_struct_fallbacks >= 0)
+tc:reset_stats()
+assert(tc:stats().infer == 0)